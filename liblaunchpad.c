@@ -25,42 +25,595 @@
  */
 
 #include "liblaunchpad.h"
+#include "lpcapture.h"
+#include "lprt.h"
 #include <unistd.h>
+#include <string.h>
 
-struct launchpad* lp_register()
+// bits of the velocity sent to a led
+#define LED_COLOUR 0x33 // red and green intensities
+#define LED_COPY   0x04 // write the led in both buffers
+#define LED_CLEAR  0x08 // clear the led in the other buffer
+
+// commands queued for the writer thread, below any midi status byte
+#define CMD_HIDE 0x01 // see lp_hide
+#define CMD_SWAP 0x02 // see lp_swap
+
+/* value of the buffer selection message, see lp_setmode */
+static int lp_mode(int displaying, int updating, int flashing, int copy)
 {
-    struct launchpad *lp;
+    return 32 + displaying + updating * 4 + flashing * 8 + copy * 16;
+}
+
+/* forget what we know about the leds, so that the next writes are sent */
+static void lp_invalidate(struct launchpad* lp)
+{
+    memset(lp->leds, LED_UNKNOWN, sizeof(lp->leds));
+}
+
+/* record a led write in the updating buffer. returns false if the write does
+ * not change anything */
+static int lp_apply(struct launchpad* lp, int led, int velocity)
+{
+    unsigned char *updated = &lp->leds[lp->updating][led];
+    unsigned char *other = &lp->leds[1 - lp->updating][led];
+    unsigned char colour = velocity & LED_COLOUR;
+    unsigned char other_colour = *other;
     
-    //build the struct
-    lp = malloc(sizeof(struct launchpad));
-    if (lp == NULL) {
-	fprintf(stderr,"Unable to allocate memory\n");
-	return NULL;
+    if (velocity & LED_COPY) {
+	other_colour = colour;
+    } else if (velocity & LED_CLEAR) {
+	other_colour = 0;
     }
     
-    //initialize usb
-    if(libusb_init(NULL)!=0){
-	fprintf(stderr,"Unable to initialize usb\n");
-	return NULL;
+    if (*updated == colour && *other == other_colour) {
+	return false;
+    }
+    
+    *updated = colour;
+    *other = other_colour;
+    return true;
+}
+
+/* find which led a message is about. returns -1 if it is not a led write */
+static int lp_led_of(struct launchpad* lp, unsigned int data0, unsigned int data1)
+{
+    int row = data1 / 16;
+    int col = data1 % 16;
+    
+    if (lp->layout != 1) {
+	return -1;
+    }
+    
+    if (data0 == NOTE_ON || data0 == NOTE_OFF) {
+	if (row > 7 || col > 8) {
+	    return -1;
+	}
+	return col == 8 ? LP_SCENE_LED(row) : LP_MATRIX_LED(row, col);
+    }
+    
+    if (data0 == CTRL && data1 >= 104 && data1 < 112) {
+	return LP_CTRL_LED(data1 - 104);
+    }
+    
+    return -1;
+}
+
+/* update the known state of the launchpad with a message about to be sent.
+ * returns false if the message does not need to be sent */
+static int lp_track(struct launchpad* lp, unsigned int data0, unsigned int data1, unsigned int data2)
+{
+    int led = lp_led_of(lp, data0, data1);
+    
+    if (led >= 0) {
+	return lp_apply(lp, led, data0 == NOTE_OFF ? 0 : data2);
+    }
+    
+    if (data0 == CTRL && data1 == 0) {
+	if (data2 == 0) {
+	    // reset
+	    memset(lp->leds, 0, sizeof(lp->leds));
+	    lp->layout = 1;
+	    lp->displaying = buffer0;
+	    lp->updating = buffer0;
+	    lp->flashing = false;
+	    lp->hidden = false;
+	} else if (data2 == 1 || data2 == 2) {
+	    // layout selection
+	    lp->layout = data2;
+	} else if (data2 >= 32 && data2 < 64) {
+	    // buffer selection, see lp_setmode
+	    lp->displaying = data2 & 1;
+	    lp->updating = (data2 >> 2) & 1;
+	    lp->flashing = (data2 >> 3) & 1;
+	    if (lp->displaying == lp->updating) {
+		lp->hidden = false;
+	    }
+	    if (data2 & 16) {
+		memcpy(lp->leds[lp->updating], lp->leds[lp->displaying], LP_LEDS);
+	    }
+	} else {
+	    // test mode, brightness...
+	    lp_invalidate(lp);
+	}
+    } else if (data0 != NOTE_ON && data0 != NOTE_OFF && data0 != CTRL) {
+	// rapid updates and anything else we do not follow
+	lp_invalidate(lp);
+    }
+    
+    return true;
+}
+
+/* velocity to send for a led. drawing in the hidden buffer must not touch the
+ * displayed one */
+static int lp_velocity(struct launchpad* lp, int velocity)
+{
+    return lp->hidden ? velocity & LED_COLOUR : velocity;
+}
+
+/* append a message to lp->tdata, sending what is waiting first if the message
+ * does not fit */
+static void lp_append3(struct launchpad* lp, int *transmitted, unsigned int data0, unsigned int data1, unsigned int data2)
+{
+    if (lp->tsize + 3 > MAX_TRANSFER_SIZE) {
+	*transmitted += lp_send(lp, lp->tsize);
+	lp->tsize = 0;
+    }
+    
+    lp->tdata[lp->tsize++] = data0;
+    lp->tdata[lp->tsize++] = data1;
+    lp->tdata[lp->tsize++] = data2;
+}
+
+/* append a message to lp->tdata, after updating the known state with it */
+static void lp_emit(struct launchpad* lp, int *transmitted, unsigned int data0, unsigned int data1, unsigned int data2)
+{
+    lp_track(lp, data0, data1, data2);
+    lp_append3(lp, transmitted, data0, data1, data2);
+}
+
+/* append the message writing a led to lp->tdata */
+static void lp_append_led(struct launchpad* lp, int *transmitted, int led, int velocity)
+{
+    if (led < 64) {
+	lp_append3(lp, transmitted, NOTE, led/8*16 + led%8, velocity);
+    } else if (led < 72) {
+	lp_append3(lp, transmitted, NOTE, (led-64)*16 + 8, velocity);
     } else {
-        printf("usb initialized\n");
+	lp_append3(lp, transmitted, CTRL, 104 + led-72, velocity);
+    }
+}
+
+/* record a led write, to be sent by the next flush. only the newest write to
+ * each led is kept */
+static void lp_pend(struct launchpad* lp, int led, int velocity)
+{
+    if (lp->dirty[led]) {
+	lp->stats.coalesced++;
+    } else {
+	// a single clock reading for all the writes between two flushes
+	if (lp->batch == 0) {
+	    lp->batch = lp_now();
+	}
+	lp->since[led] = lp->batch;
+	if (lp->ndirty++ == 0) {
+	    lp->backlog = lp->batch;
+	}
+	lp->dirty[led] = true;
+    }
+    lp->pending[led] = velocity;
+}
+
+/* hold back the changed leds beyond the first kept ones, from lp->flush_at
+ * on so that every led gets its turn. before is the state they had */
+static void lp_defer(struct launchpad* lp, unsigned char before[2][LP_LEDS], int kept)
+{
+    int i, led;
+    
+    lp->backlog = 0;
+    for (i = 0; i < LP_LEDS; i++) {
+	led = (lp->flush_at + i) % LP_LEDS;
+	if (before[0][led] == lp->leds[0][led] && before[1][led] == lp->leds[1][led]) {
+	    continue;
+	}
+	
+	if (kept > 0) {
+	    kept--;
+	    lp->flush_at = (led + 1) % LP_LEDS;
+	    continue;
+	}
+	
+	lp->leds[0][led] = before[0][led];
+	lp->leds[1][led] = before[1][led];
+	lp->dirty[led] = true;
+	lp->ndirty++;
+	if (lp->backlog == 0 || lp->since[led] < lp->backlog) {
+	    lp->backlog = lp->since[led];
+	}
+    }
+}
+
+/* append the pending led writes to lp->tdata, keeping only those which change
+ * something. few changes are sent one by one, otherwise all the leds are sent
+ * with rapid updates. when appending them all would take more than budget
+ * messages, the leds left over stay pending. returns the amount of messages
+ * appended */
+static int lp_flush_leds(struct launchpad* lp, int *transmitted, int budget)
+{
+    int i;
+    int changed = 0;
+    int messages;
+    int rapid = true;
+    unsigned char before[2][LP_LEDS];
+    unsigned char velocities[LP_LEDS];
+    
+    if (lp->ndirty == 0) {
+	return 0;
+    }
+    
+    memcpy(before, lp->leds, sizeof(before));
+    for (i = 0; i < LP_LEDS; i++) {
+	if (lp->dirty[i]) {
+	    velocities[i] = lp_velocity(lp, lp->pending[i]);
+	    changed += lp_apply(lp, i, velocities[i]);
+	    lp->dirty[i] = false;
+	} else {
+	    // rewrite the updating buffer only, as it is
+	    velocities[i] = before[lp->updating][i];
+	    rapid = rapid && velocities[i] != LED_UNKNOWN;
+	}
+    }
+    
+    lp->stats.suppressed += lp->ndirty - changed;
+    lp->ndirty = 0;
+    lp->backlog = 0;
+    
+    if (changed == 0) {
+	return 0;
+    }
+    
+    rapid = rapid && changed * 3 >= 3 + LP_LEDS / 2 * 3;
+    messages = rapid ? 1 + LP_LEDS / 2 : changed + (lp->layout != 1);
+    if (budget >= 0 && messages > budget) {
+	rapid = false;
+	messages = budget;
+	lp_defer(lp, before, budget - (lp->layout != 1));
+	changed -= lp->ndirty;
+	if (changed <= 0) {
+	    return 0;
+	}
     }
+    lp->stats.sent += changed;
+    
+    if (rapid) {
+	// selecting the x-y layout moves the rapid update cursor to the first led
+	lp_append3(lp, transmitted, CTRL, 0, 1);
+	lp->layout = 1;
+	
+	for (i = 0; i < LP_LEDS; i += 2) {
+	    lp_append3(lp, transmitted, RAPID, velocities[i], velocities[i+1]);
+	}
+	return messages;
+    }
+    
+    if (lp->layout != 1) {
+	lp_append3(lp, transmitted, CTRL, 0, 1);
+	lp->layout = 1;
+    }
+    
+    for (i = 0; i < LP_LEDS; i++) {
+	if (before[0][i] != lp->leds[0][i] || before[1][i] != lp->leds[1][i]) {
+	    lp_append_led(lp, transmitted, i, velocities[i]);
+	}
+    }
+    return messages;
+}
+
+/* messages which can be sent at the limited rate, at a given time. only the
+ * thread flushing keeps the credit, and starts it again when the rate changed */
+static double lp_credit(struct launchpad* lp, int rate, unsigned long long now)
+{
+    double credit;
     
-    //find the device
-    lp->device = libusb_open_device_with_vid_pid(NULL, ID_VENDOR, ID_PRODUCT);
-    if (lp->device == NULL) {
-	fprintf(stderr,"Unable to find the launchpad\n");
- 	return NULL;
+    if (rate != lp->rated) {
+	return LP_BURST;
+    }
+    credit = lp->credit + (now - lp->refilled) * (double) rate / 1e9;
+    
+    return credit < LP_BURST ? credit : LP_BURST;
+}
+
+/* hand data to the transport, counting and capturing it */
+static int lp_deliver(struct launchpad* lp, const unsigned char* data, int size)
+{
+    lp->stats.transfers++;
+    lp->stats.bytes += size;
+    if (lp->capturing) {
+	lp_capture(lp, lp_outbound, data, size, lp_now());
+    }
+    return lp->transport->send(lp, data, size);
+}
+
+/* append a message to a burst */
+static int lp_burst3(unsigned char* burst, int size, int data0, int data1, int data2)
+{
+    burst[size++] = data0;
+    burst[size++] = data1;
+    burst[size++] = data2;
+    return size;
+}
+
+/* bring a device plugged back, blank, to the known state of the leds: a
+ * reset, both buffers rewritten with rapid updates, then the mode. a buffer
+ * all off is skipped, and one pass writes both buffers when they are alike */
+static int lp_restore(struct launchpad* lp)
+{
+    unsigned char burst[LP_RESTORE_SIZE];
+    int size = 0, transmitted = 0;
+    int i, b, lit, alike;
+    
+    __atomic_store_n(&lp->restore, false, __ATOMIC_RELAXED);
+    
+    // the leds of unknown colour get turned off
+    for (i = 0; i < LP_LEDS; i++) {
+	for (b = 0; b < 2; b++) {
+	    if (lp->leds[b][i] == LED_UNKNOWN)
+		lp->leds[b][i] = 0;
+	}
+    }
+    alike = memcmp(lp->leds[0], lp->leds[1], LP_LEDS) == 0;
+    
+    size = lp_burst3(burst, size, CTRL, 0, 0);
+    for (b = 0; b < (alike ? 1 : 2); b++) {
+	for (i = 0, lit = false; i < LP_LEDS; i++) {
+	    lit = lit || lp->leds[b][i] != 0;
+	}
+	if (!lit) {
+	    continue;
+	}
+	
+	// selecting the x-y layout moves the rapid update cursor to the first led
+	size = lp_burst3(burst, size, CTRL, 0, lp_mode(buffer0, b, false, false));
+	size = lp_burst3(burst, size, CTRL, 0, 1);
+	for (i = 0; i < LP_LEDS; i += 2) {
+	    size = lp_burst3(burst, size, RAPID,
+			     lp->leds[b][i] | (alike ? LED_COPY | LED_CLEAR : 0),
+			     lp->leds[b][i+1] | (alike ? LED_COPY | LED_CLEAR : 0));
+	}
+    }
+    if (lp->displaying != buffer0 || lp->updating != buffer0 || lp->flashing) {
+	size = lp_burst3(burst, size, CTRL, 0, lp_mode(lp->displaying, lp->updating, lp->flashing, false));
+    }
+    if (lp->layout != 1) {
+	size = lp_burst3(burst, size, CTRL, 0, lp->layout);
+    }
+    
+    // the restore is done once all its transfers completed
+    __atomic_store_n(&lp->restoring, (size + MAX_TRANSFER_SIZE - 1) / MAX_TRANSFER_SIZE, __ATOMIC_RELEASE);
+    for (i = 0; i < size; i += MAX_TRANSFER_SIZE) {
+	transmitted += lp_deliver(lp, burst + i, size - i < MAX_TRANSFER_SIZE ? size - i : MAX_TRANSFER_SIZE);
+    }
+    
+    return transmitted;
+}
+
+/* send everything waiting: pending led writes, as far as the rate allows,
+ * and lp->tdata */
+static int lp_transmit(struct launchpad* lp)
+{
+    int transmitted = 0;
+    int messages = 0;
+    unsigned long transfers = lp->stats.transfers;
+    unsigned long long now;
+    
+    // lp_set_rate may change it meanwhile, from another thread
+    int rate = __atomic_load_n(&lp->rate, __ATOMIC_RELAXED);
+    
+    // a device plugged back gets its leds first
+    if (__atomic_load_n(&lp->restore, __ATOMIC_ACQUIRE)) {
+	transmitted += lp_restore(lp);
+    }
+    
+    if (rate > 0) {
+	now = lp_now();
+	lp->credit = lp_credit(lp, rate, now);
+	lp->refilled = now;
+	messages = lp_flush_leds(lp, &transmitted, lp->credit > 0 ? lp->credit : 0);
     } else {
-        printf("launchpad found\n");
+	lp_flush_leds(lp, &transmitted, -1);
     }
+    lp->rated = rate;
+    lp->batch = 0;
     
-    //claim the device
-    if(libusb_claim_interface(lp->device, 0) != 0) {
-	fprintf(stderr,"Unable to claim the launchpad\n");
-	return NULL;
+    if (lp->tsize > 0) {
+	transmitted += lp_send(lp, lp->tsize);
+	lp->tsize = 0;
+    }
+    
+    // short transfers cost more than their messages, so that a burst of them
+    // still fits in flight
+    if (rate > 0) {
+	transfers = (lp->stats.transfers - transfers) * LP_TRANSFER_COST;
+	lp->credit -= messages > transfers ? messages : transfers;
+    }
+    
+    return transmitted;
+}
+
+static void lp_do_hide(struct launchpad* lp, int *transmitted);
+static void lp_do_swap(struct launchpad* lp, int *transmitted);
+
+/* handle a message on its way to the launchpad. led writes are kept pending,
+ * other messages are appended to lp->tdata after the pending writes */
+static void lp_execute(struct launchpad* lp, const unsigned char* message)
+{
+    int transmitted = 0;
+    int led = lp_led_of(lp, message[0], message[1]);
+    
+    if (led >= 0) {
+	lp_pend(lp, led, message[0] == NOTE_OFF ? 0 : message[2]);
+	return;
+    }
+    
+    // the messages keep their order, whatever the rate
+    lp_flush_leds(lp, &transmitted, -1);
+    
+    if (message[0] == CMD_HIDE) {
+	lp_do_hide(lp, &transmitted);
+    } else if (message[0] == CMD_SWAP) {
+	lp_do_swap(lp, &transmitted);
     } else {
-	printf("launchpad claimed\n");
+	lp_emit(lp, &transmitted, message[0], message[1], message[2]);
+    }
+}
+
+/* queue messages for the writer thread, all at once: the writer sees them
+ * together and is woken up once, so that they go out in the same batch. this
+ * never blocks: when the queue can't take them all, they are all dropped */
+static int lp_push_batch(struct launchpad* lp, const unsigned char (*messages)[3], int n)
+{
+    struct lp_slot* slot;
+    unsigned long pos, seq, last, depth, high;
+    int i;
+    
+    // claim the slots. the writer frees them in order, so the last one being
+    // free means they all are
+    pos = __atomic_load_n(&lp->queue_tail, __ATOMIC_RELAXED);
+    for (;;) {
+	last = pos + n - 1;
+	seq = __atomic_load_n(&lp->queue[last % LP_QUEUE_SIZE].sequence, __ATOMIC_ACQUIRE);
+	
+	if (seq == last) {
+	    if (__atomic_compare_exchange_n(&lp->queue_tail, &pos, pos + n, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		break;
+	    }
+	} else if ((long) (seq - last) < 0) {
+	    // the writer did not read these slots yet: the queue is full
+	    __atomic_add_fetch(&lp->stats.dropped, n, __ATOMIC_RELAXED);
+	    return false;
+	} else {
+	    pos = __atomic_load_n(&lp->queue_tail, __ATOMIC_RELAXED);
+	}
+    }
+    
+    // keep track of the high-water mark
+    depth = pos + n - __atomic_load_n(&lp->queue_head, __ATOMIC_RELAXED);
+    high = __atomic_load_n(&lp->stats.queue_high, __ATOMIC_RELAXED);
+    while (depth > high
+	   && !__atomic_compare_exchange_n(&lp->stats.queue_high, &high, depth, true,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    
+    // fill them, and hand them to the writer first slot last, so that it
+    // finds none of them until it can read them all
+    for (i = 0; i < n; i++) {
+	memcpy(lp->queue[(pos + i) % LP_QUEUE_SIZE].message, messages[i], 3);
+    }
+    for (i = n - 1; i >= 0; i--) {
+	slot = &lp->queue[(pos + i) % LP_QUEUE_SIZE];
+	__atomic_store_n(&slot->sequence, pos + i + 1, __ATOMIC_RELEASE);
+    }
+    sem_post(&lp->queued);
+    
+    return true;
+}
+
+/* queue a message for the writer thread, see lp_push_batch */
+static int lp_push(struct launchpad* lp, unsigned int data0, unsigned int data1, unsigned int data2)
+{
+    unsigned char message[1][3];
+    
+    message[0][0] = data0;
+    message[0][1] = data1;
+    message[0][2] = data2;
+    return lp_push_batch(lp, (const unsigned char (*)[3]) message, 1);
+}
+
+/* take the oldest message from the queue. only the writer thread calls this */
+static int lp_pop(struct launchpad* lp, unsigned char* message)
+{
+    struct lp_slot* slot = &lp->queue[lp->queue_head % LP_QUEUE_SIZE];
+    
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != lp->queue_head + 1) {
+	return false;
+    }
+    
+    memcpy(message, slot->message, 3);
+    __atomic_store_n(&slot->sequence, lp->queue_head + LP_QUEUE_SIZE, __ATOMIC_RELEASE);
+    __atomic_store_n(&lp->queue_head, lp->queue_head + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* the writer thread: drain the queue in batches, each batch being sent in as
+ * few transfers as possible */
+static void* lp_writer(void* data)
+{
+    struct launchpad* lp = data;
+    unsigned char message[3];
+    struct timespec until;
+    int timeout;
+    
+    lp_rt_thread(lp_rt_output);
+    while (!lp->stopped) {
+	// wake up for the writes held back too
+	timeout = lp_backlog_timeout(lp, -1);
+	if (timeout < 0) {
+	    sem_wait(&lp->queued);
+	} else {
+	    clock_gettime(CLOCK_REALTIME, &until);
+	    until.tv_sec += timeout / 1000;
+	    until.tv_nsec += timeout % 1000 * 1000000L;
+	    if (until.tv_nsec >= 1000000000L) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	    }
+	    sem_timedwait(&lp->queued, &until);
+	}
+	
+	// the messages pushed so far are all visible, drain them at once
+	while (sem_trywait(&lp->queued) == 0);
+	while (lp_pop(lp, message)) {
+	    lp_execute(lp, message);
+	}
+	
+	lp_transmit(lp);
+    }
+    
+    return NULL;
+}
+
+const struct lp_transport* lp_default_transport()
+{
+    const char* transport = getenv("LP_TRANSPORT");
+    
+    if (transport != NULL && strcmp(transport, lp_virtual.name) == 0) {
+	return &lp_virtual;
+    }
+    
+    return &lp_usb;
+}
+
+int lp_count()
+{
+    return lp_default_transport()->count();
+}
+
+struct launchpad* lp_register()
+{
+    return lp_register_with(lp_default_transport(), 0);
+}
+
+struct launchpad* lp_register_with(const struct lp_transport* transport, int index)
+{
+    struct launchpad *lp;
+    const char* env;
+    int i;
+    
+    //build the struct
+    lp = malloc(sizeof(struct launchpad));
+    if (lp == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
     }
   
     //allocate input buffer
@@ -72,17 +625,61 @@ struct launchpad* lp_register()
     }
     
     //allocate output buffer
-    lp->tdata = malloc(sizeof(unsigned char)*MAX_PACKET_SIZE);
+    lp->tdata = malloc(sizeof(unsigned char)*MAX_TRANSFER_SIZE);
   
     if (lp->tdata == NULL) {
 	fprintf(stderr,"could not allocate output buffer\n");
 	return NULL;
     }
-        
-    // initialize the protocol's state
+    
+    pthread_mutex_init(&lp->lock, NULL);
+    lp->stopped = false;
+    lp->attached = true;
+    lp->restore = false;
+    lp->restoring = 0;
+    lp->packet_head = 0;
+    lp->packet_count = 0;
+    memset(&lp->stats, 0, sizeof(lp->stats));
+    
+    //initialize the output queue, the writer thread is started on demand
+    for (i = 0; i < LP_QUEUE_SIZE; i++) {
+	lp->queue[i].sequence = i;
+    }
+    lp->queue_head = 0;
+    lp->queue_tail = 0;
+    sem_init(&lp->queued, 0, 0);
+    lp->writing = false;
+    memset(lp->dirty, false, sizeof(lp->dirty));
+    lp->ndirty = 0;
+    lp->tsize = 0;
+    lp->batch = 0;
+    lp->backlog = 0;
+    lp->flush_at = 0;
+    lp->rated = 0;
+    env = getenv("LP_RATE");
+    lp_set_rate(lp, env != NULL ? atoi(env) : 0);
+    
+    // initialize the protocol's state, the device may deliver input as soon as it is open
     lp->event[0] = NOTE;
     lp->parse_at = 0;
     lp->received = 0;
+    lp->status = 0;
+    lp->count = 0;
+    lp->tracing = false;
+    lp->capturing = false;
+    
+    //open the device
+    lp->transport = transport;
+    lp->index = index;
+    if (transport->open(lp) != 0) {
+	return NULL;
+    }
+        
+    // the state of the leds is known once the reset is sent
+    lp_invalidate(lp);
+    lp->layout = 1;
+    lp->updating = buffer0;
+    lp->hidden = false;
 
     // reset launchpad
     lp_reset(lp);
@@ -90,65 +687,335 @@ struct launchpad* lp_register()
     return lp;
 }
 
-void lp_deregister(struct launchpad *lp)
+void lp_stop(struct launchpad *lp)
 {
-    //declaim the device
-    libusb_release_interface(lp->device,0);
+    pthread_mutex_lock(&lp->lock);
+    lp->stopped = true;
+    pthread_mutex_unlock(&lp->lock);
     
-    //close the device
-    libusb_close(lp->device);
+    // wake the writer up
+    sem_post(&lp->queued);
+    
+    lp->transport->stop(lp);
+}
+
+void lp_deregister(struct launchpad *lp)
+{
+    //wait for the writer, then for the transfers in flight
+    lp_stop(lp);
+    if (lp->writing) {
+	pthread_join(lp->writer, NULL);
+    }
+    lp->transport->close(lp);
     
     //free allocated memory
     free(lp->rdata);
     free(lp->tdata);
+    pthread_mutex_destroy(&lp->lock);
+    sem_destroy(&lp->queued);
+}
+
+int lp_pollfds(struct launchpad* lp, struct pollfd* fds, int max)
+{
+    return lp->transport->pollfds(lp, fds, max);
+}
+
+int lp_handle(struct launchpad* lp, int timeout)
+{
+    return lp->transport->handle(lp, timeout);
+}
+
+void lp_packet(struct launchpad* lp, const unsigned char* data, int size)
+{
+    int slot;
+    unsigned long long now = lp_now();
+    
+    // captured even when lost, as the device sent it
+    if (lp->capturing) {
+	lp_capture(lp, lp_inbound, data, size, now);
+    }
     
-    //close usb
-    libusb_exit(NULL);    
+    pthread_mutex_lock(&lp->lock);
+    
+    if (lp->packet_count == LP_PACKETS) {
+	lp->stats.lost++;
+    } else {
+	slot = (lp->packet_head + lp->packet_count) % LP_PACKETS;
+	memcpy(lp->packets[slot], data, size);
+	lp->packet_size[slot] = size;
+	lp->packet_time[slot] = now;
+	lp->packet_count++;
+    }
+    
+    pthread_mutex_unlock(&lp->lock);
+}
+
+void lp_completed(struct launchpad* lp)
+{
+    unsigned long long took;
+    
+    if (__atomic_load_n(&lp->restoring, __ATOMIC_ACQUIRE) == 0
+	|| __atomic_sub_fetch(&lp->restoring, 1, __ATOMIC_ACQ_REL) != 0
+	|| !lp->attached) {
+	return;
+    }
+    
+    took = lp_now() - lp->attached_at;
+    lp->stats.restore_time = took;
+    if (took > lp->stats.restore_max) {
+	lp->stats.restore_max = took;
+    }
+    __atomic_add_fetch(&lp->stats.restored, 1, __ATOMIC_RELEASE);
+}
+
+void lp_detach(struct launchpad* lp)
+{
+    pthread_mutex_lock(&lp->lock);
+    if (lp->attached) {
+	lp->attached = false;
+	lp->stats.detached++;
+	
+	// a restore going on is over too
+	__atomic_store_n(&lp->restore, false, __ATOMIC_RELAXED);
+	__atomic_store_n(&lp->restoring, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&lp->lock);
+}
+
+void lp_attach(struct launchpad* lp)
+{
+    pthread_mutex_lock(&lp->lock);
+    if (!lp->attached) {
+	lp->attached = true;
+	lp->attached_at = lp_now();
+	__atomic_store_n(&lp->restore, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lp->lock);
+    
+    // the writer restores the leds right away
+    sem_post(&lp->queued);
 }
 
-void lp_receive(struct launchpad* lp)
+unsigned long long lp_now()
 {
-    if (lp->parse_at == lp->received) {
-	// there is no data to parse. wait for some
-	lp->parse_at = 0;
-	lp->received = 0;
-	libusb_interrupt_transfer(lp->device,
-				  EP_IN,
-				  lp->rdata,
-				  MAX_PACKET_SIZE,
-				  &lp->received,
-				  0);
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* take the next received packet into rdata. returns false if there is none */
+static int lp_take(struct launchpad* lp)
+{
+    pthread_mutex_lock(&lp->lock);
+    
+    if (lp->packet_count == 0) {
+	pthread_mutex_unlock(&lp->lock);
+	return false;
     }
+    
+    lp->received = lp->packet_size[lp->packet_head];
+    lp->rtime = lp->packet_time[lp->packet_head];
+    memcpy(lp->rdata, lp->packets[lp->packet_head], lp->received);
+    lp->packet_head = (lp->packet_head + 1) % LP_PACKETS;
+    lp->packet_count--;
+    lp->parse_at = 0;
+    
+    pthread_mutex_unlock(&lp->lock);
+    return true;
+}
 
-    // check if the first byte is a prefix byte
-    if (lp->rdata[lp->parse_at] == NOTE || lp->rdata[lp->parse_at] == CTRL) {
-		lp->event[0] = lp->rdata[lp->parse_at++];
+/* feed a byte to the midi parser. returns true when it completes an event */
+static int lp_parse(struct launchpad* lp, int byte, struct lp_event* event)
+{
+    if (byte >= 0xF8) {
+	// real time messages may show up anywhere and change nothing
+	return false;
     }
-	lp->event[1] = lp->rdata[lp->parse_at++];
-	lp->event[2] = lp->rdata[lp->parse_at++];
+    
+    if (byte >= 0x80) {
+	// a new status. system messages cancel the running status, a system
+	// exclusive message is skipped until its end
+	lp->status = byte <= 0xF0 ? byte : 0;
+	lp->count = 0;
+	return false;
+    }
+    
+    if (lp->status == 0 || lp->status == 0xF0) {
+	// data without any status
+	return false;
+    }
+    
+    lp->data[lp->count++] = byte;
+    
+    // program change and channel pressure have a single data byte
+    if (lp->count < ((lp->status & 0xE0) == 0xC0 ? 1 : 2)) {
+	return false;
+    }
+    
+    event->status = lp->status;
+    event->data1 = lp->data[0];
+    event->data2 = lp->count == 2 ? lp->data[1] : 0;
+    event->time = lp->rtime;
+    event->device = lp->index;
+    if (lp->tracing) {
+	event->parsed = lp_now();
+    }
+    lp->count = 0;
+    return true;
+}
+
+int lp_events(struct launchpad* lp, struct lp_event* events, int max, enum bool wait)
+{
+    int n = 0;
+    
+    while (n < max) {
+	if (lp->parse_at == lp->received && !lp_take(lp)) {
+	    if (n > 0 || !wait || lp->stopped) {
+		break;
+	    }
+	    
+	    // wait for some data
+	    lp->transport->handle(lp, -1);
+	    continue;
+	}
+	
+	n += lp_parse(lp, lp->rdata[lp->parse_at++], &events[n]);
+    }
+    
+    return n;
+}
+
+int lp_next(struct launchpad* lp)
+{
+    struct lp_event event;
+    
+    if (!lp_events(lp, &event, 1, false)) {
+	return false;
+    }
+    
+    lp->event[0] = event.status;
+    lp->event[1] = event.data1;
+    lp->event[2] = event.data2;
+    return true;
+}
+
+int lp_receive(struct launchpad* lp)
+{
+    struct lp_event event;
+    
+    if (!lp_events(lp, &event, 1, true)) {
+	// the launchpad is stopped, no data will ever arrive
+	return false;
+    }
+    
+    lp->event[0] = event.status;
+    lp->event[1] = event.data1;
+    lp->event[2] = event.data2;
+    return true;
 }
 
 int lp_send(struct launchpad* lp, int size)
 {
-    int transmitted;
+    int transmitted = 0;
+    
+    // nothing goes to a device plugged back before its leds
+    if (__atomic_load_n(&lp->restore, __ATOMIC_ACQUIRE)) {
+	transmitted = lp_restore(lp);
+    }
+    return transmitted + lp_deliver(lp, lp->tdata, size);
+}
+
+int lp_stage3(struct launchpad* lp, unsigned int data0, unsigned int data1, unsigned int data2)
+{
+    unsigned char message[3];
     
-    // send the data
-    libusb_interrupt_transfer(lp->device,
-			      EP_OUT,
-			      lp->tdata,
-			      size,
-			      &transmitted,
-			      0);
+    if (lp->writing) {
+	return lp_push(lp, data0, data1, data2) ? 3 : 0;
+    }
     
-    return transmitted;
+    message[0] = data0;
+    message[1] = data1;
+    message[2] = data2;
+    lp_execute(lp, message);
+    
+    return lp->stopped ? 0 : 3;
 }
 
 int lp_send3(struct launchpad* lp, unsigned int data0, unsigned int data1, unsigned int data2)
 {
-    lp->tdata[0] = data0;
-    lp->tdata[1] = data1;
-    lp->tdata[2] = data2;
-    return lp_send(lp,3);
+    int handled = lp_stage3(lp, data0, data1, data2);
+    
+    lp_flush(lp);
+    return lp->stopped ? 0 : handled;
+}
+
+int lp_flush(struct launchpad* lp)
+{
+    // the writer thread flushes by itself
+    if (lp->writing) {
+	return 0;
+    }
+    
+    return lp_transmit(lp);
+}
+
+int lp_start_writer(struct launchpad* lp)
+{
+    int err;
+    
+    lp->writing = true;
+    err = pthread_create(&lp->writer, NULL, lp_writer, lp);
+    if (err) {
+	fprintf(stderr, "failed to start the writer thread, with error %d\n", err);
+	lp->writing = false;
+    }
+    
+    return err;
+}
+
+int lp_queue_depth(struct launchpad* lp)
+{
+    return __atomic_load_n(&lp->queue_tail, __ATOMIC_RELAXED)
+	- __atomic_load_n(&lp->queue_head, __ATOMIC_RELAXED);
+}
+
+void lp_set_rate(struct launchpad* lp, int rate)
+{
+    // the thread flushing sees the new rate, and gives it a whole burst
+    __atomic_store_n(&lp->rate, rate > 0 ? rate : 0, __ATOMIC_RELAXED);
+}
+
+unsigned long long lp_backlog_age(struct launchpad* lp)
+{
+    unsigned long long backlog = lp->backlog;
+    
+    if (__atomic_load_n(&lp->restore, __ATOMIC_ACQUIRE)) {
+	backlog = lp->attached_at;
+    }
+    
+    return backlog != 0 ? lp_now() - backlog : 0;
+}
+
+int lp_backlog_timeout(struct launchpad* lp, int max)
+{
+    int rate = __atomic_load_n(&lp->rate, __ATOMIC_RELAXED);
+    double wanted;
+    int timeout;
+    
+    if (__atomic_load_n(&lp->restore, __ATOMIC_ACQUIRE)) {
+	return 0;
+    }
+    if (rate == 0 || lp->ndirty == 0) {
+	return max;
+    }
+    
+    // wait for enough credit to send the backlog, or a whole burst of it
+    wanted = lp->ndirty < LP_BURST ? lp->ndirty : LP_BURST;
+    wanted -= lp_credit(lp, rate, lp_now());
+    timeout = wanted > 0 ? wanted * 1000 / rate + 1 : 0;
+    
+    return max >= 0 && max < timeout ? max : timeout;
 }
 
 int lp_check(struct launchpad* lp, int intensity)
@@ -171,17 +1038,7 @@ int lp_reset(struct launchpad* lp)
 
 int lp_setmode(struct launchpad* lp, enum buffer displaying, enum buffer updating, enum bool flashing, enum bool copy)
 {
-    int v = 32;
-    // displaying buffer
-    v += displaying;
-    // updating buffer
-    v += updating * 4;
-    // flashing
-    v += flashing * 8;
-    // copying the new displaying buffer to the new updating buffer
-    v += copy * 16;
-    
-    return lp_send3(lp,CTRL,0,v);
+    return lp_send3(lp,CTRL,0,lp_mode(displaying, updating, flashing, copy));
 }
 
 int lp_matrix(struct launchpad *lp, int row, int col, int velocity)
@@ -207,3 +1064,85 @@ int lp_ctrl(struct launchpad *lp, int col, int velocity)
 	
 	return lp_send3(lp, CTRL, 104+col, velocity);
 }
+
+int lp_frame(struct launchpad *lp, const unsigned char *frame)
+{
+	int i;
+	unsigned char messages[LP_LEDS][3];
+
+	if (!lp->writing) {
+		for (i = 0; i < LP_LEDS; i++) {
+			lp_pend(lp, i, frame[i]);
+		}
+		return lp_transmit(lp);
+	}
+
+	// the whole frame reaches the writer at once, so that it goes out in
+	// a single batch
+	for (i = 0; i < LP_LEDS; i++) {
+		if (i < 64) {
+			messages[i][0] = NOTE;
+			messages[i][1] = i/8*16 + i%8;
+		} else if (i < 72) {
+			messages[i][0] = NOTE;
+			messages[i][1] = (i-64)*16 + 8;
+		} else {
+			messages[i][0] = CTRL;
+			messages[i][1] = 104 + i-72;
+		}
+		messages[i][2] = frame[i];
+	}
+
+	return lp_push_batch(lp, (const unsigned char (*)[3]) messages, LP_LEDS) ? 3 * LP_LEDS : 0;
+}
+
+static void lp_do_hide(struct launchpad *lp, int *transmitted)
+{
+	if (lp->displaying == lp->updating || lp->flashing) {
+		lp_emit(lp, transmitted, CTRL, 0, lp_mode(lp->displaying, 1 - lp->displaying, false, true));
+	}
+
+	lp->hidden = true;
+}
+
+static void lp_do_swap(struct launchpad *lp, int *transmitted)
+{
+	if (!lp->hidden) {
+		lp_do_hide(lp, transmitted);
+		return;
+	}
+
+	// display the updating buffer and copy it into the other one
+	lp_emit(lp, transmitted, CTRL, 0, lp_mode(lp->updating, lp->displaying, false, true));
+}
+
+int lp_hide(struct launchpad *lp)
+{
+	return lp_send3(lp, CMD_HIDE, 0, 0);
+}
+
+int lp_swap(struct launchpad *lp)
+{
+	return lp_send3(lp, CMD_SWAP, 0, 0);
+}
+
+int lp_present(struct launchpad *lp, const unsigned char *frame)
+{
+	int i;
+	int transmitted = 0;
+
+	if (lp->writing) {
+		transmitted = lp_hide(lp);
+		transmitted += lp_frame(lp, frame);
+		return transmitted + lp_swap(lp);
+	}
+
+	// hide, draw and swap in the same transfers
+	lp_do_hide(lp, &transmitted);
+	for (i = 0; i < LP_LEDS; i++) {
+		lp_pend(lp, i, frame[i]);
+	}
+	lp_flush_leds(lp, &transmitted, -1);
+	lp_do_swap(lp, &transmitted);
+	return transmitted + lp_transmit(lp);
+}
@@ -24,9 +24,16 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef LIBLAUNCHPAD_H
+#define LIBLAUNCHPAD_H
+
 #include <stdio.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
 #include <libusb-1.0/libusb.h>
 
 // launchpad identifiers
@@ -36,6 +43,40 @@
 // size to use for buffers
 #define MAX_PACKET_SIZE 8
 
+// biggest amount of data sent in a single transfer. it holds a whole number of
+// three bytes messages
+#define MAX_TRANSFER_SIZE 48
+
+// amount of input transfers kept in flight
+#define LP_IN_TRANSFERS 4
+
+// amount of output transfers which can be in flight at once
+#define LP_OUT_TRANSFERS 16
+
+// amount of received packets waiting to be parsed
+#define LP_PACKETS 64
+
+// time after which an output transfer is given up, in milliseconds
+#define LP_OUT_TIMEOUT 1000
+
+// amount of events read at once by the programs
+#define LP_EVENTS 32
+
+// amount of messages the output queue holds, a power of two
+#define LP_QUEUE_SIZE 1024
+
+// most messages sent at once when the message rate is limited: a whole frame
+// with rapid updates
+#define LP_BURST 42
+
+// least messages a transfer counts as when the rate is limited, so that a
+// burst of short transfers fits in flight
+#define LP_TRANSFER_COST 3
+
+// largest burst restoring the leds of a launchpad plugged back: a reset, then
+// each buffer selected and rewritten with rapid updates, then the mode
+#define LP_RESTORE_SIZE (3 * (3 + 2 * (2 + LP_LEDS / 2)))
+
 // usb endpoints
 #define EP_IN      ( LIBUSB_ENDPOINT_IN  | 1)
 #define EP_OUT     ( LIBUSB_ENDPOINT_OUT | 2)
@@ -45,19 +86,157 @@
 #define NOTE 0x90 // note on, channel 1
 #define NOTE_ON 0x90 // note on, channel 1
 #define NOTE_OFF 0x80 // note off, channel 1
+#define RAPID 0x92 // note on, channel 3, used for rapid led updates
+
+// amount of leds: 64 in the matrix, then 8 scenes and 8 controls
+#define LP_LEDS 80
+
+// position of each led inside a frame. this is the order in which the rapid
+// led update walks through the leds
+#define LP_MATRIX_LED(row, col) ((row)*8 + (col))
+#define LP_SCENE_LED(row) (64 + (row))
+#define LP_CTRL_LED(col) (72 + (col))
+
+// value stored for a led whose state is not known
+#define LED_UNKNOWN 0xFF
+
+/**
+ * counters about the traffic sent to the launchpad
+ */
+struct lp_stats {
+    unsigned long sent;		//! led writes sent to the launchpad
+    unsigned long suppressed;	//! led writes dropped because the led already had this value
+    unsigned long coalesced;	//! led writes replaced by a newer one before being sent
+    unsigned long failed;	//! output transfers which failed or timed out
+    unsigned long lost;		//! input packets dropped because nobody read them
+    unsigned long dropped;	//! messages dropped because the output queue was full
+    unsigned long queue_high;	//! highest amount of messages seen in the output queue
+    unsigned long transfers;	//! output transfers sent
+    unsigned long bytes;	//! data sent
+    unsigned long detached;	//! times the device went away
+    unsigned long restored;	//! times the device came back and its leds were restored
+    unsigned long long restore_time;	//! time the last restore took, from the device coming back to the end of the burst, in ns
+    unsigned long long restore_max;	//! longest restore
+};
+
+struct launchpad;
+
+/**
+ * the way data goes to and from the launchpad
+ */
+struct lp_transport {
+    const char* name;	//! name, as given in the LP_TRANSPORT environment variable
+    
+    //! open the device and start receiving data. returns 0 on success
+    int (*open)(struct launchpad* lp);
+    //! wait for the data in flight and close the device
+    void (*close)(struct launchpad* lp);
+    //! stop receiving data, from any thread
+    void (*stop)(struct launchpad* lp);
+    //! send data without waiting for it to arrive. returns the amount sent
+    int (*send)(struct launchpad* lp, const unsigned char* data, int size);
+    //! process what happened, waiting up to timeout milliseconds, or for some data if negative
+    int (*handle)(struct launchpad* lp, int timeout);
+    //! file descriptors to watch, see lp_pollfds
+    int (*pollfds)(struct launchpad* lp, struct pollfd* fds, int max);
+    //! amount of launchpads which can be opened
+    int (*count)();
+};
+
+/**
+ * a real launchpad, through libusb
+ */
+extern const struct lp_transport lp_usb;
+
+/**
+ * a simulated launchpad, see lpvirtual.h
+ */
+extern const struct lp_transport lp_virtual;
+
+/**
+ * an event received from the launchpad
+ */
+struct lp_event {
+    int status;			//! midi status byte, NOTE or CTRL
+    int data1;			//! key or controller
+    int data2;			//! velocity or value
+    unsigned long long time;	//! when the packet arrived, see lp_now
+    unsigned long long parsed;	//! when the event was parsed, only when tracing
+    int device;			//! index of the launchpad it comes from
+};
+
+/**
+ * a slot of the output queue
+ */
+struct lp_slot {
+    unsigned long sequence;	//! position of the message in the queue, tells who owns the slot
+    unsigned char message[3];	//! the message
+};
 
 /**
  * the principal struct to handle the launchpad
  */
 struct launchpad {
-    struct libusb_device_handle* device;	//! usb device
+    const struct lp_transport* transport;	//! the way data goes to and from the launchpad
+    void* transport_data;			//! state of the transport
+    int index;					//! which of the connected launchpads it is
     unsigned char* rdata;			//! buffer to store incoming data
     unsigned char* tdata;			//! buffer to store outgoing data
+    
+    // received packets, shared with the transport under lock
+    pthread_mutex_t lock;			//! protects the packets and the transport
+    unsigned char packets[LP_PACKETS][MAX_PACKET_SIZE];	//! received packets, waiting to be parsed
+    int packet_size[LP_PACKETS];		//! size of each received packet
+    unsigned long long packet_time[LP_PACKETS];	//! when each packet arrived
+    int packet_head;				//! oldest received packet
+    int packet_count;				//! amount of received packets
+    int stopped;				//! whether the launchpad is stopped
+    int attached;				//! whether the device is there, see lp_detach
+    unsigned long long attached_at;		//! when the device came back
+    int restore;				//! whether the leds have to be restored before anything else is sent
+    int restoring;				//! transfers of the restore burst not completed yet
+    
+    // output queue, written by any thread and read by the writer thread
+    struct lp_slot queue[LP_QUEUE_SIZE];	//! queued messages
+    unsigned long queue_head;			//! position of the next message to read
+    unsigned long queue_tail;			//! position of the next message to write
+    sem_t queued;				//! posted for each queued message
+    pthread_t writer;				//! the writer thread
+    int writing;				//! whether the writer thread runs
+    
+    // output waiting to be sent
+    unsigned char pending[LP_LEDS];		//! newest velocity written to each led
+    unsigned char dirty[LP_LEDS];		//! whether each led has a pending write
+    int ndirty;					//! amount of leds with a pending write
+    int tsize;					//! amount of data waiting in tdata
+    unsigned long long since[LP_LEDS];		//! when the pending write of each led was made
+    unsigned long long batch;			//! when the first write since the last flush was made
+    unsigned long long backlog;			//! when the oldest pending write was made, 0 for none
+    int flush_at;				//! led the next flush starts from when the rate is limited
+    int rate;					//! most messages sent each second, 0 for no limit
+    double credit;				//! messages which can be sent right away
+    int rated;					//! rate the credit was counted at, a new one starts a burst again
+    unsigned long long refilled;		//! when the credit was last updated
 	
     // handling the protocol's state
     int received;				//! amount of data currently stored in rdata
     int parse_at;				//! where to read in rdata to get the next event
+    unsigned long long rtime;			//! when the data in rdata arrived
+    int status;					//! running status, 0 when there is none
+    int count;					//! amount of data bytes of the current message
+    int data[2];				//! data bytes of the current message
 	int event[3]; //! store the parsed midi event
+    int tracing;				//! whether events are stamped when parsed, see lptrace.h
+    int capturing;				//! whether the traffic is captured, see lpcapture.h
+
+    // state of the launchpad, as far as we know from what we sent
+    unsigned char leds[2][LP_LEDS];		//! colour of each led in both buffers
+    int layout;					//! selected layout, 1 for x-y
+    int displaying;				//! buffer currently displayed
+    int updating;				//! buffer currently updated
+    int flashing;				//! whether both buffers are displayed alternatively
+    int hidden;					//! whether leds are drawn in the hidden buffer, see lp_swap
+    struct lp_stats stats;			//! traffic counters
 };
 
 /**
@@ -102,40 +281,210 @@ enum led_mode {
 
 /** 
  * register the launchpad 
+ *
+ * the launchpad is found on usb, unless the LP_TRANSPORT environment variable
+ * asks for the "virtual" one. a launchpad unplugged is detached and attached
+ * again when plugged back, see lp_detach. with LP_WAIT=1, a launchpad which
+ * is not plugged yet is registered detached instead of failing.
  */
 struct launchpad *lp_register();
 
+/**
+ * register a launchpad reached through the given transport
+ *
+ * \param index which of the connected launchpads to open, from 0 to the
+ * transport's count
+ */
+struct launchpad *lp_register_with(const struct lp_transport* transport, int index);
+
+/**
+ * the transport used by lp_register: usb, or the one named by the
+ * LP_TRANSPORT environment variable
+ */
+const struct lp_transport* lp_default_transport();
+
+/**
+ * amount of launchpads connected through the default transport
+ */
+int lp_count();
+
 /**
  * deregister the launchpad
  */
 void lp_deregister(struct launchpad* lp);
 
+/**
+ * stop the launchpad
+ *
+ * the input transfers are cancelled, so that lp_receive returns, and nothing
+ * is sent anymore. this can be called from any thread.
+ */
+void lp_stop(struct launchpad* lp);
+
+/** get the file descriptors to watch
+ *
+ * for programs running their own poll loop: when one of these descriptors is
+ * ready, call lp_handle, then lp_events until it returns 0.
+ * \param fds where to store the descriptors
+ * \param max the size of fds
+ * \return the amount of descriptors stored
+ */
+int lp_pollfds(struct launchpad* lp, struct pollfd* fds, int max);
+
+/** handle the usb events
+ *
+ * completed transfers are processed: received packets are queued for lp_events
+ * and output transfers are given back to the pool.
+ * \param timeout how long to wait for events, in milliseconds
+ */
+int lp_handle(struct launchpad* lp, int timeout);
+
+/**
+ * current time of the monotonic clock, in nanoseconds
+ */
+unsigned long long lp_now();
+
+/** queue a received packet
+ *
+ * this is called by the transports, from any thread.
+ */
+void lp_packet(struct launchpad* lp, const unsigned char* data, int size);
+
+/** tell that an output transfer completed, whether it succeeded or not
+ *
+ * this is called by the transports, from any thread.
+ */
+void lp_completed(struct launchpad* lp);
+
+/** tell that the device went away
+ *
+ * the launchpad is not stopped: the writes go on updating the known state of
+ * the leds, and are dropped. this is called by the transports, from any
+ * thread.
+ */
+void lp_detach(struct launchpad* lp);
+
+/** tell that the device is back
+ *
+ * the device starts blank. before anything else, the next flush sends it the
+ * known state of both buffers in a single burst, then the writes pending. the
+ * time from here to the end of the burst is kept in lp->stats.restore_time.
+ * this is called by the transports, from any thread.
+ */
+void lp_attach(struct launchpad* lp);
+
+/** parse the received events
+ *
+ * the received data is parsed as a stream of midi messages, following the
+ * running status, so that a message may span several packets. all the events
+ * received so far are stored in events, up to max; the following ones are
+ * kept for the next call.
+ * \param events where to store the events
+ * \param max the size of events
+ * \param wait whether to wait for an event when none was received
+ * \return the amount of events stored, 0 when none was received or when the
+ * launchpad was stopped
+ */
+int lp_events(struct launchpad* lp, struct lp_event* events, int max, enum bool wait);
+
+/** parse the next received event, without waiting
+ *
+ * the event is parsed with lp_events and stored in launchpad->event.
+ * \return false if no event was received
+ */
+int lp_next(struct launchpad* lp);
+
 /** receive data from the launchpad 
  * 
- * this is a blocking function waiting for some data to arrive to the
- * launchpad. Received data is stored inside launchpad->rdata, then parsed as a
- * midi event in launchpad->event. Sometimes, several events are received at
- * once. In such a case, only the first event is parsed. Next time the function
- * is called, the next event in the buffer is parsed until the buffer is empty.
+ * this is a blocking function waiting for an event from the launchpad, which
+ * is stored in launchpad->event.
+ * \return false if the launchpad was stopped
  */
-void lp_receive(struct launchpad* lp);
+int lp_receive(struct launchpad* lp);
 
 /** send data to the launchpad
  *
- * the data has to be written to lp->tdata before calling this function.
- * \param size the amount of data to send
+ * the data has to be written to lp->tdata before calling this function. it is
+ * copied to a free output transfer and submitted without waiting for its
+ * completion. when all the output transfers are in flight, this waits for one
+ * of them to complete or to time out.
+ * \param size the amount of data to send, at most MAX_TRANSFER_SIZE
+ * \return the amount of data submitted
  */
 int lp_send(struct launchpad* lp, int size);
 
 /** send a standard three bytes message
  * 
- * all messages sent to the launchpad are three bytes long.
+ * all messages sent to the launchpad are three bytes long. the message is
+ * checked against the known state of the leds: a message which would not
+ * change anything is not sent and counts as suppressed.
+ *
+ * once the writer thread runs, the message is only queued, and this can be
+ * called from any thread without ever blocking.
  * \param data0 first byte
  * \param data1 second byte
  * \param data2 third byte
+ * \return 3 when the message was handled, 0 when it was lost
  */
 int lp_send3(struct launchpad* lp, unsigned int data0, unsigned int data1, unsigned int data2);
 
+/** handle a message without sending it yet
+ *
+ * the message goes out with the next lp_flush, along with the other staged
+ * messages. a caller driving several launchpads can stage messages to all of
+ * them, then flush them one after the other so that their transfers are in
+ * flight at the same time. once the writer thread runs, this is lp_send3.
+ * \return 3 when the message was handled, 0 when it was lost
+ */
+int lp_stage3(struct launchpad* lp, unsigned int data0, unsigned int data1, unsigned int data2);
+
+/** send the staged messages
+ *
+ * \return the amount of data transmitted
+ */
+int lp_flush(struct launchpad* lp);
+
+/** start the writer thread
+ *
+ * from then on, every function sending data to the launchpad only queues
+ * messages in a lock-free queue. the writer thread drains the queue in batches
+ * and sends each batch in as few transfers as possible, keeping only the
+ * newest write to each led. when the queue is full, messages are dropped and
+ * counted in lp->stats.dropped.
+ * \return 0, or the error from pthread_create
+ */
+int lp_start_writer(struct launchpad* lp);
+
+/** amount of messages waiting in the output queue
+ */
+int lp_queue_depth(struct launchpad* lp);
+
+/** limit the messages sent to the launchpad
+ *
+ * led writes beyond the rate stay pending, where a newer write to the same led
+ * replaces the older one, so that the backlog never holds more than one write
+ * per led and flushing never waits for the device. the writes held back go out
+ * with the next flushes, which a caller without writer thread makes when
+ * lp_backlog_timeout tells. other messages are never held back. the
+ * LP_RATE environment variable sets the rate of new launchpads.
+ * \param rate most messages sent each second, 0 for no limit
+ */
+void lp_set_rate(struct launchpad* lp, int rate);
+
+/** how long the oldest led write held back has been waiting
+ *
+ * \return the age in nanoseconds, 0 when nothing is held back
+ */
+unsigned long long lp_backlog_age(struct launchpad* lp);
+
+/** time until more of the held back led writes can be sent
+ *
+ * this is 0 when the device came back and its leds have to be restored.
+ * \param max longest time to return, or -1 for no limit
+ * \return a time in milliseconds, at most max
+ */
+int lp_backlog_timeout(struct launchpad* lp, int max);
+
 /**
  * turn on all the leds
  * \param intensity the leds' intensity, between 1 and 3
@@ -167,3 +516,42 @@ int lp_scene(struct launchpad *lp, int row, int velocity);
 /** turn on/off the control
  */
 int lp_ctrl(struct launchpad *lp, int col, int velocity);
+
+/** set all the leds at once
+ *
+ * the frame is compared to the known state of the updating buffer and only the
+ * difference is sent. when few leds change, they are sent as single messages,
+ * otherwise all the leds are sent two by two with rapid led update messages.
+ * either way, messages are packed into as few transfers as possible: a whole
+ * frame takes 3 transfers instead of 80.
+ * \param frame LP_LEDS velocities, indexed with LP_MATRIX_LED, LP_SCENE_LED
+ * and LP_CTRL_LED
+ * \return the amount of data transmitted, or queued when the writer runs
+ */
+int lp_frame(struct launchpad *lp, const unsigned char *frame);
+
+/** draw in the hidden buffer
+ *
+ * the launchpad displays one buffer while the other one is updated. the hidden
+ * buffer starts as a copy of the displayed one, and velocities lose their copy
+ * and clear bits so that led writes never reach the displayed buffer.
+ */
+int lp_hide(struct launchpad *lp);
+
+/** display the hidden buffer
+ *
+ * the buffers are flipped with a single message, so that everything drawn
+ * since the last swap shows up at once. the newly displayed buffer is copied
+ * into the new hidden buffer, in which drawing goes on. the first call only
+ * starts drawing in the hidden buffer, see lp_hide.
+ */
+int lp_swap(struct launchpad *lp);
+
+/** display a whole frame at once
+ *
+ * the frame is drawn with lp_frame in the hidden buffer, then displayed with
+ * lp_swap.
+ */
+int lp_present(struct launchpad *lp, const unsigned char *frame);
+
+#endif
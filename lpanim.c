@@ -0,0 +1,629 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpanim.h"
+#include "lprt.h"
+#include <errno.h>
+#include <string.h>
+
+#define NS 1000000000ULL
+
+/* 5x7 font for ascii 32 to 126, a byte per column, the top row in bit 0 */
+static const unsigned char lp_font[95][5] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00}, {0x00, 0x07, 0x00, 0x07, 0x00},
+    {0x14, 0x7F, 0x14, 0x7F, 0x14}, {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+    {0x36, 0x49, 0x55, 0x22, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00}, {0x00, 0x1C, 0x22, 0x41, 0x00},
+    {0x00, 0x41, 0x22, 0x1C, 0x00}, {0x08, 0x2A, 0x1C, 0x2A, 0x08}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+    {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08}, {0x00, 0x60, 0x60, 0x00, 0x00},
+    {0x20, 0x10, 0x08, 0x04, 0x02}, {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+    {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31}, {0x18, 0x14, 0x12, 0x7F, 0x10},
+    {0x27, 0x45, 0x45, 0x45, 0x39}, {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E}, {0x00, 0x36, 0x36, 0x00, 0x00},
+    {0x00, 0x56, 0x36, 0x00, 0x00}, {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+    {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06}, {0x32, 0x49, 0x79, 0x41, 0x3E},
+    {0x7E, 0x11, 0x11, 0x11, 0x7E}, {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+    {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41}, {0x7F, 0x09, 0x09, 0x01, 0x01},
+    {0x3E, 0x41, 0x41, 0x51, 0x32}, {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+    {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41}, {0x7F, 0x40, 0x40, 0x40, 0x40},
+    {0x7F, 0x02, 0x04, 0x02, 0x7F}, {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+    {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E}, {0x7F, 0x09, 0x19, 0x29, 0x46},
+    {0x46, 0x49, 0x49, 0x49, 0x31}, {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+    {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x7F, 0x20, 0x18, 0x20, 0x7F}, {0x63, 0x14, 0x08, 0x14, 0x63},
+    {0x03, 0x04, 0x78, 0x04, 0x03}, {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x00, 0x7F, 0x41, 0x41},
+    {0x02, 0x04, 0x08, 0x10, 0x20}, {0x41, 0x41, 0x7F, 0x00, 0x00}, {0x04, 0x02, 0x01, 0x02, 0x04},
+    {0x40, 0x40, 0x40, 0x40, 0x40}, {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},
+    {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20}, {0x38, 0x44, 0x44, 0x48, 0x7F},
+    {0x38, 0x54, 0x54, 0x54, 0x18}, {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x08, 0x14, 0x54, 0x54, 0x3C},
+    {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00}, {0x20, 0x40, 0x44, 0x3D, 0x00},
+    {0x00, 0x7F, 0x10, 0x28, 0x44}, {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78},
+    {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38}, {0x7C, 0x14, 0x14, 0x14, 0x08},
+    {0x08, 0x14, 0x14, 0x18, 0x7C}, {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+    {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C}, {0x1C, 0x20, 0x40, 0x20, 0x1C},
+    {0x3C, 0x40, 0x30, 0x40, 0x3C}, {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C},
+    {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00}, {0x00, 0x00, 0x7F, 0x00, 0x00},
+    {0x00, 0x41, 0x36, 0x08, 0x00}, {0x08, 0x04, 0x08, 0x10, 0x08}
+};
+
+// columns taken by a character, with the space after it
+#define LP_FONT_WIDTH 6
+
+/* whether an effect reached its end */
+static int lp_anim_ended(const struct lp_effect* effect, unsigned long long now)
+{
+    return effect->duration && now - effect->start >= effect->duration;
+}
+
+/* time an effect has been running, capped to its duration */
+static unsigned long long lp_anim_elapsed(const struct lp_effect* effect, unsigned long long now)
+{
+    unsigned long long elapsed = now - effect->start;
+    
+    if (effect->duration && elapsed > effect->duration) {
+	elapsed = effect->duration;
+    }
+    return elapsed;
+}
+
+/* leds moved since the start, rounding towards minus infinity */
+static int lp_anim_moved(int speed, unsigned long long elapsed)
+{
+    long long moved = (long long) speed * (long long) elapsed;
+    
+    if (moved < 0) {
+	return -(int) ((-moved + NS - 1) / NS);
+    }
+    return (int) (moved / NS);
+}
+
+/* draw a led of the frame, ignoring those out of the grid */
+static void lp_anim_draw(struct lp_anim* anim, int x, int y, int velocity)
+{
+    if (x < 0 || y < 0 || x >= anim->grid->width || y >= anim->grid->height) {
+	return;
+    }
+    anim->frame[y * anim->grid->width + x] = velocity;
+}
+
+/* fill the area of an effect */
+static void lp_anim_fill(struct lp_anim* anim, const struct lp_effect* effect, int velocity)
+{
+    int x, y;
+    
+    for (y = effect->y; y < effect->y + effect->height; y++) {
+	for (x = effect->x; x < effect->x + effect->width; x++) {
+	    lp_anim_draw(anim, x, y, velocity);
+	}
+    }
+}
+
+/* a level of a fade, red and green going from 0 to 3 */
+static int lp_anim_level(int from, int to, unsigned long long elapsed, unsigned long long duration)
+{
+    if (duration == 0) {
+	return to;
+    }
+    return from + (int) (((long long) (to - from) * (long long) elapsed + (long long) duration / 2) / (long long) duration);
+}
+
+static void lp_anim_draw_fade(struct lp_anim* anim, const struct lp_effect* effect, unsigned long long now)
+{
+    unsigned long long elapsed = lp_anim_elapsed(effect, now);
+    int red = lp_anim_level(effect->from & 0x03, effect->to & 0x03, elapsed, effect->duration);
+    int green = lp_anim_level((effect->from >> 4) & 0x03, (effect->to >> 4) & 0x03, elapsed, effect->duration);
+    
+    lp_anim_fill(anim, effect, green << 4 | red | led_copy);
+}
+
+static void lp_anim_draw_blink(struct lp_anim* anim, const struct lp_effect* effect, unsigned long long now)
+{
+    // while blinking, the colour only goes to the updating buffer and the
+    // other one is cleared, so that flashing alternates the colour and black
+    lp_anim_fill(anim, effect, (effect->to & 0x33) | (lp_anim_ended(effect, now) ? led_copy : led_clear));
+}
+
+static void lp_anim_draw_sprite(struct lp_anim* anim, const struct lp_effect* effect, unsigned long long now)
+{
+    unsigned long long elapsed = lp_anim_elapsed(effect, now);
+    int left = effect->x + lp_anim_moved(effect->dx, elapsed);
+    int top = effect->y + lp_anim_moved(effect->dy, elapsed);
+    int x, y, velocity;
+    
+    for (y = 0; y < effect->height; y++) {
+	for (x = 0; x < effect->width; x++) {
+	    velocity = effect->sprite[y * effect->width + x];
+	    if (velocity != LP_ANIM_TRANSPARENT) {
+		lp_anim_draw(anim, left + x, top + y, (velocity & 0x33) | led_copy);
+	    }
+	}
+    }
+}
+
+static void lp_anim_draw_text(struct lp_anim* anim, const struct lp_effect* effect, unsigned long long now)
+{
+    int length = strlen(effect->text) * LP_FONT_WIDTH;
+    int scrolled = lp_anim_moved(effect->speed, lp_anim_elapsed(effect, now));
+    int velocity = (effect->to & 0x33) | led_copy;
+    int x, y, column, c;
+    
+    if (effect->loop) {
+	scrolled %= effect->width + length;
+    }
+    
+    // the text comes in from the right edge of the area
+    for (x = 0; x < effect->width; x++) {
+	column = x - effect->width + scrolled;
+	for (y = 0; y < effect->height; y++) {
+	    lp_anim_draw(anim, effect->x + x, effect->y + y, led_copy);
+	}
+	if (column < 0 || column >= length || column % LP_FONT_WIDTH == LP_FONT_WIDTH - 1) {
+	    continue;
+	}
+	c = (unsigned char) effect->text[column / LP_FONT_WIDTH];
+	if (c < 32 || c > 126) {
+	    c = '?';
+	}
+	for (y = 0; y < effect->height && y < 7; y++) {
+	    if (lp_font[c - 32][column % LP_FONT_WIDTH] & (1 << y)) {
+		lp_anim_draw(anim, effect->x + x, effect->y + y, velocity);
+	    }
+	}
+    }
+}
+
+/* forget the leds of an effect once it ended, so that they are left as they are */
+static void lp_anim_release(struct lp_anim* anim, const struct lp_effect* effect, unsigned long long now)
+{
+    unsigned long long elapsed = lp_anim_elapsed(effect, now);
+    int left = effect->x;
+    int top = effect->y;
+    int x, y;
+    
+    if (effect->kind == lp_effect_sprite) {
+	left += lp_anim_moved(effect->dx, elapsed);
+	top += lp_anim_moved(effect->dy, elapsed);
+    }
+    
+    for (y = top; y < top + effect->height; y++) {
+	for (x = left; x < left + effect->width; x++) {
+	    if (x >= 0 && y >= 0 && x < anim->grid->width && y < anim->grid->height) {
+		anim->shown[y * anim->grid->width + x] = LED_UNKNOWN;
+	    }
+	}
+    }
+}
+
+/* render the effects into the frame, and note which launchpads flash. the lock is held */
+static int lp_anim_render(struct lp_anim* anim, unsigned long long now, int* flashing)
+{
+    struct lp_effect* effect;
+    int active = 0;
+    int x, y, device;
+    
+    memset(anim->frame, LED_UNKNOWN, sizeof(anim->frame));
+    memset(flashing, 0, LP_GRID_DEVICES * sizeof(int));
+    
+    for (effect = anim->effects; effect < anim->effects + LP_ANIM_EFFECTS; effect++) {
+	if (!effect->active) {
+	    continue;
+	}
+	active++;
+	
+	switch (effect->kind) {
+	case lp_effect_fade:
+	    lp_anim_draw_fade(anim, effect, now);
+	    break;
+	case lp_effect_blink:
+	    lp_anim_draw_blink(anim, effect, now);
+	    if (lp_anim_ended(effect, now)) {
+		break;
+	    }
+	    for (y = effect->y; y < effect->y + effect->height; y++) {
+		for (x = effect->x; x < effect->x + effect->width; x++) {
+		    if (lp_grid_address(anim->grid, x, y, &device) >= 0) {
+			flashing[device] = true;
+		    }
+		}
+	    }
+	    break;
+	case lp_effect_sprite:
+	    lp_anim_draw_sprite(anim, effect, now);
+	    break;
+	case lp_effect_text:
+	    lp_anim_draw_text(anim, effect, now);
+	    break;
+	}
+    }
+    
+    return active;
+}
+
+/* write the leds which changed, and turn flashing on and off. the grid's lock is held */
+static void lp_anim_push(struct lp_anim* anim, const int* flashing)
+{
+    struct lp_grid* grid = anim->grid;
+    int i, velocity;
+    
+    for (i = 0; i < grid->width * grid->height; i++) {
+	velocity = anim->frame[i];
+	
+	// a led no effect draws any more, like the trail of a sprite, goes off
+	if (velocity == LED_UNKNOWN) {
+	    if (anim->shown[i] == LED_UNKNOWN) {
+		continue;
+	    }
+	    velocity = led_copy;
+	}
+	
+	if (velocity != anim->shown[i]) {
+	    lp_grid_led(grid, i % grid->width, i / grid->width, velocity);
+	}
+	anim->shown[i] = anim->frame[i];
+    }
+    lp_grid_flush(grid);
+    
+    for (i = 0; i < grid->count; i++) {
+	if (flashing[i] != anim->flashing[i]) {
+	    lp_setmode(grid->lps[i], buffer0, buffer0, flashing[i], false);
+	    anim->flashing[i] = flashing[i];
+	}
+    }
+}
+
+static void* lp_anim_run(void* data)
+{
+    struct lp_anim* anim = data;
+    struct lp_effect* effect;
+    int flashing[LP_GRID_DEVICES];
+    unsigned long long next = lp_now();
+    unsigned long long now;
+    struct timespec until;
+    
+    lp_rt_thread(lp_rt_timer);
+    pthread_mutex_lock(&anim->lock);
+    
+    while (anim->running) {
+	now = lp_now();
+	if (lp_anim_render(anim, now, flashing) == 0 && memcmp(flashing, anim->flashing, sizeof(flashing)) == 0) {
+	    // nothing to animate, the clock starts again with the next effect
+	    pthread_cond_wait(&anim->started, &anim->lock);
+	    next = lp_now();
+	    continue;
+	}
+	anim->frames++;
+	
+	// rendering is done under the engine's lock, writing under the grid's
+	pthread_mutex_unlock(&anim->lock);
+	lp_grid_lock(anim->grid);
+	lp_anim_push(anim, flashing);
+	lp_grid_unlock(anim->grid);
+	pthread_mutex_lock(&anim->lock);
+	
+	for (effect = anim->effects; effect < anim->effects + LP_ANIM_EFFECTS; effect++) {
+	    if (effect->active && lp_anim_ended(effect, now)) {
+		lp_anim_release(anim, effect, now);
+		effect->active = false;
+	    }
+	}
+	
+	// frames follow a fixed clock, skipping those already missed
+	next += anim->period;
+	now = lp_now();
+	if (next < now) {
+	    anim->skipped += (now - next) / anim->period + 1;
+	    next += ((now - next) / anim->period + 1) * anim->period;
+	}
+	pthread_mutex_unlock(&anim->lock);
+	until.tv_sec = next / NS;
+	until.tv_nsec = next % NS;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+	pthread_mutex_lock(&anim->lock);
+    }
+    
+    pthread_mutex_unlock(&anim->lock);
+    return NULL;
+}
+
+struct lp_anim* lp_anim_start(struct lp_grid* grid, int rate)
+{
+    struct lp_anim* anim;
+    int err;
+    
+    if (rate <= 0) {
+	rate = LP_ANIM_RATE;
+    }
+    if (grid->width * grid->height > LP_GRID_LEDS) {
+	fprintf(stderr, "the grid is too large to animate\n");
+	return NULL;
+    }
+    
+    anim = calloc(1, sizeof(struct lp_anim));
+    if (anim == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    anim->grid = grid;
+    anim->period = NS / rate;
+    anim->running = true;
+    memset(anim->shown, LED_UNKNOWN, sizeof(anim->shown));
+    
+    pthread_mutex_init(&anim->lock, NULL);
+    pthread_cond_init(&anim->started, NULL);
+    
+    err = pthread_create(&anim->thread, NULL, lp_anim_run, anim);
+    if (err) {
+	fprintf(stderr, "failed to start the animation thread, with error %d\n", err);
+	free(anim);
+	return NULL;
+    }
+    
+    return anim;
+}
+
+void lp_anim_stop(struct lp_anim* anim)
+{
+    pthread_mutex_lock(&anim->lock);
+    anim->running = false;
+    pthread_cond_signal(&anim->started);
+    pthread_mutex_unlock(&anim->lock);
+    
+    pthread_join(anim->thread, NULL);
+    pthread_cond_destroy(&anim->started);
+    pthread_mutex_destroy(&anim->lock);
+    free(anim);
+}
+
+/* clip an area to the grid. returns false when none of it is on the grid */
+static int lp_anim_clip(const struct lp_grid* grid, int* x, int* y, int* width, int* height)
+{
+    long long right = (long long) *x + *width;
+    long long bottom = (long long) *y + *height;
+    
+    if (right > grid->width) {
+	right = grid->width;
+    }
+    if (bottom > grid->height) {
+	bottom = grid->height;
+    }
+    if (*x < 0) {
+	*x = 0;
+    }
+    if (*y < 0) {
+	*y = 0;
+    }
+    if (*x >= right || *y >= bottom) {
+	return false;
+    }
+    *width = right - *x;
+    *height = bottom - *y;
+    
+    return true;
+}
+
+/* take a free effect, and lock the engine. returns NULL, unlocked, when none is free */
+static struct lp_effect* lp_anim_new(struct lp_anim* anim, enum lp_effect_kind kind,
+				     int x, int y, int width, int height, int duration)
+{
+    struct lp_effect* effect;
+    int top = y, rows = height;
+    
+    if (width <= 0 || height <= 0) {
+	return NULL;
+    }
+    
+    // sprites move in and out of the grid, the other effects stay where
+    // they are. text keeps its rows, so that the letters stay whole
+    if (kind != lp_effect_sprite) {
+	if (!lp_anim_clip(anim->grid, &x, &top, &width, &rows)) {
+	    return NULL;
+	}
+	if (kind != lp_effect_text) {
+	    y = top;
+	    height = rows;
+	}
+    }
+    
+    pthread_mutex_lock(&anim->lock);
+    for (effect = anim->effects; effect < anim->effects + LP_ANIM_EFFECTS; effect++) {
+	if (!effect->active) {
+	    memset(effect, 0, sizeof(struct lp_effect));
+	    effect->kind = kind;
+	    effect->x = x;
+	    effect->y = y;
+	    effect->width = width;
+	    effect->height = height;
+	    effect->start = lp_now();
+	    effect->duration = duration > 0 ? duration * 1000000ULL : 0;
+	    return effect;
+	}
+    }
+    pthread_mutex_unlock(&anim->lock);
+    
+    return NULL;
+}
+
+/* run a new effect, and unlock the engine */
+static int lp_anim_run_effect(struct lp_anim* anim, struct lp_effect* effect)
+{
+    effect->active = true;
+    pthread_cond_signal(&anim->started);
+    pthread_mutex_unlock(&anim->lock);
+    
+    return effect - anim->effects;
+}
+
+int lp_anim_fade(struct lp_anim* anim, int x, int y, int width, int height, int from, int to, int duration)
+{
+    struct lp_effect* effect = lp_anim_new(anim, lp_effect_fade, x, y, width, height, duration > 0 ? duration : 1);
+    
+    if (effect == NULL) {
+	return -1;
+    }
+    effect->from = from;
+    effect->to = to;
+    return lp_anim_run_effect(anim, effect);
+}
+
+int lp_anim_blink(struct lp_anim* anim, int x, int y, int width, int height, int velocity, int duration)
+{
+    struct lp_effect* effect = lp_anim_new(anim, lp_effect_blink, x, y, width, height, duration);
+    
+    if (effect == NULL) {
+	return -1;
+    }
+    effect->to = velocity;
+    return lp_anim_run_effect(anim, effect);
+}
+
+int lp_anim_sprite(struct lp_anim* anim, int x, int y, int width, int height,
+		   const unsigned char* velocities, int dx, int dy, int duration)
+{
+    struct lp_effect* effect;
+    
+    if (width <= 0 || height <= 0 || width > LP_ANIM_SPRITE || height > LP_ANIM_SPRITE / width) {
+	return -1;
+    }
+    
+    effect = lp_anim_new(anim, lp_effect_sprite, x, y, width, height, duration);
+    if (effect == NULL) {
+	return -1;
+    }
+    memcpy(effect->sprite, velocities, width * height);
+    effect->dx = dx;
+    effect->dy = dy;
+    return lp_anim_run_effect(anim, effect);
+}
+
+int lp_anim_text(struct lp_anim* anim, int x, int y, int width, const char* text,
+		 int velocity, int speed, enum bool loop)
+{
+    struct lp_effect* effect;
+    int length = strlen(text);
+    
+    if (speed <= 0 || length >= LP_ANIM_TEXT) {
+	return -1;
+    }
+    
+    effect = lp_anim_new(anim, lp_effect_text, x, y, width, 8, 0);
+    if (effect == NULL) {
+	return -1;
+    }
+    strcpy(effect->text, text);
+    effect->to = velocity;
+    effect->speed = speed;
+    effect->loop = loop;
+    
+    // once through, the text is gone from the area
+    if (!loop) {
+	effect->duration = ((unsigned long long) (effect->width + length * LP_FONT_WIDTH) * NS + speed - 1) / speed;
+    }
+    return lp_anim_run_effect(anim, effect);
+}
+
+void lp_anim_cancel(struct lp_anim* anim, int x, int y)
+{
+    struct lp_effect* effect;
+    unsigned long long now;
+    
+    pthread_mutex_lock(&anim->lock);
+    now = lp_now();
+    for (effect = anim->effects; effect < anim->effects + LP_ANIM_EFFECTS; effect++) {
+	if (!effect->active) {
+	    continue;
+	}
+	if (x >= 0 && (x < effect->x || x >= effect->x + effect->width ||
+		       y < effect->y || y >= effect->y + effect->height)) {
+	    continue;
+	}
+	
+	// the effect ends with the next frame, which draws its final state
+	if (!lp_anim_ended(effect, now)) {
+	    effect->duration = now - effect->start > 0 ? now - effect->start : 1;
+	}
+    }
+    pthread_mutex_unlock(&anim->lock);
+}
+
+/* a duration of a sysex message, in milliseconds */
+static int lp_anim_duration(const unsigned char* data)
+{
+    return ((data[0] & 0x7F) << 7 | (data[1] & 0x7F)) * 10;
+}
+
+/* a speed of a sysex message, signed on 7 bits */
+static int lp_anim_speed(unsigned char data)
+{
+    return data & 0x40 ? (int) (data & 0x7F) - 0x80 : data & 0x7F;
+}
+
+int lp_anim_sysex(struct lp_anim* anim, const unsigned char* data, int size)
+{
+    char text[LP_ANIM_TEXT];
+    int length;
+    
+    // F0 7D command ... F7
+    if (size < 4 || data[0] != 0xF0 || data[1] != LP_ANIM_SYSEX_ID || data[size - 1] != 0xF7) {
+	return -1;
+    }
+    length = size - 4;
+    data += 3;
+    
+    switch (data[-1]) {
+    case 0x01:
+	if (length != 8) {
+	    return -1;
+	}
+	return lp_anim_fade(anim, data[0], data[1], data[2], data[3], data[4], data[5], lp_anim_duration(data + 6));
+    case 0x02:
+	if (length != 7) {
+	    return -1;
+	}
+	return lp_anim_blink(anim, data[0], data[1], data[2], data[3], data[4], lp_anim_duration(data + 5));
+    case 0x03:
+	if (length < 8 || length - 8 != data[2] * data[3]) {
+	    return -1;
+	}
+	return lp_anim_sprite(anim, data[0], data[1], data[2], data[3], data + 8,
+			      lp_anim_speed(data[4]), lp_anim_speed(data[5]), lp_anim_duration(data + 6));
+    case 0x04:
+	if (length < 6 || length - 6 >= LP_ANIM_TEXT) {
+	    return -1;
+	}
+	memcpy(text, data + 6, length - 6);
+	text[length - 6] = 0;
+	return lp_anim_text(anim, data[0], data[1], data[2], text, data[3], lp_anim_speed(data[4]), data[5] != 0);
+    case 0x05:
+	if (length == 2) {
+	    lp_anim_cancel(anim, data[0], data[1]);
+	} else if (length == 0) {
+	    lp_anim_cancel(anim, -1, -1);
+	} else {
+	    return -1;
+	}
+	return 0;
+    }
+    
+    return -1;
+}
@@ -0,0 +1,165 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPANIM_H
+#define LPANIM_H
+
+#include "lpgrid.h"
+
+// most effects running at once
+#define LP_ANIM_EFFECTS 32
+
+// frames rendered each second by default
+#define LP_ANIM_RATE 50
+
+// most leds in a sprite
+#define LP_ANIM_SPRITE 256
+
+// longest text
+#define LP_ANIM_TEXT 128
+
+// velocity of the transparent leds of a sprite
+#define LP_ANIM_TRANSPARENT 0x40
+
+// manufacturer id of the animation sysex messages, the one for non commercial use
+#define LP_ANIM_SYSEX_ID 0x7D
+
+/**
+ * the kinds of effects
+ */
+enum lp_effect_kind {
+    lp_effect_fade,	//! the colour of an area goes from one velocity to another
+    lp_effect_blink,	//! an area blinks, with the launchpad's own flashing
+    lp_effect_sprite,	//! a picture, possibly moving
+    lp_effect_text	//! text scrolling from right to left
+};
+
+/**
+ * an effect running on an area of the grid
+ */
+struct lp_effect {
+    enum lp_effect_kind kind;			//! what it does
+    int active;					//! whether it runs
+    int x, y, width, height;			//! area of the grid it draws on
+    unsigned long long start;			//! when it started, see lp_now
+    unsigned long long duration;		//! how long it runs in ns, 0 for ever
+    int from, to;				//! velocities of a fade, to is also the one of a blink or a text
+    int dx, dy;					//! speed of a sprite, in leds per second
+    int speed;					//! speed of a text, in leds per second
+    int loop;					//! whether a text starts again once gone
+    unsigned char sprite[LP_ANIM_SPRITE];	//! velocities of a sprite, row after row
+    char text[LP_ANIM_TEXT];			//! text, in ascii
+};
+
+/**
+ * the animation engine: a thread rendering the effects at a fixed rate and
+ * writing only the leds which changed since the previous frame.
+ *
+ * the engine stages its leds on the grid while holding the grid's lock, see
+ * lp_grid_lock. the effects take a whole area: the leds of the area are
+ * rewritten whenever the rendering changes them. blinking uses the
+ * launchpad's two buffers, so it does not mix with lp_hide and lp_swap.
+ */
+struct lp_anim {
+    struct lp_grid* grid;				//! where the effects are drawn
+    pthread_mutex_t lock;				//! protects the effects
+    pthread_cond_t started;				//! signalled when an effect starts
+    pthread_t thread;					//! thread rendering the frames
+    int running;					//! whether the thread runs
+    unsigned long long period;				//! time between frames, in ns
+    struct lp_effect effects[LP_ANIM_EFFECTS];		//! effects, drawn in order
+    unsigned char frame[LP_GRID_LEDS];			//! rendered frame
+    unsigned char shown[LP_GRID_LEDS];			//! frame written to the grid
+    int flashing[LP_GRID_DEVICES];			//! whether each launchpad flashes
+    unsigned long frames;				//! frames rendered
+    unsigned long skipped;				//! frames skipped because the engine was late
+};
+
+/** start the engine
+ *
+ * \param rate frames rendered each second
+ * \return the engine, or NULL when it could not start
+ */
+struct lp_anim* lp_anim_start(struct lp_grid* grid, int rate);
+
+/** stop the engine, leaving the leds as they are
+ */
+void lp_anim_stop(struct lp_anim* anim);
+
+/** fade an area from a velocity to another
+ *
+ * red and green go from one level to the other separately. like blinking and
+ * text, the area is clipped to the grid, and the effect refused when none of
+ * it is on the grid.
+ * \param duration in milliseconds
+ * \return the index of the effect, or -1 when too many run
+ */
+int lp_anim_fade(struct lp_anim* anim, int x, int y, int width, int height, int from, int to, int duration);
+
+/** blink an area
+ *
+ * \param duration in milliseconds, 0 for ever
+ */
+int lp_anim_blink(struct lp_anim* anim, int x, int y, int width, int height, int velocity, int duration);
+
+/** draw a sprite, moving dx and dy leds each second
+ *
+ * \param velocities width * height velocities, LP_ANIM_TRANSPARENT for none,
+ *                   no more than LP_ANIM_SPRITE
+ * \param duration in milliseconds, 0 for ever
+ */
+int lp_anim_sprite(struct lp_anim* anim, int x, int y, int width, int height,
+		   const unsigned char* velocities, int dx, int dy, int duration);
+
+/** scroll text through an area 8 leds high
+ *
+ * \param speed in leds per second
+ * \param loop whether the text starts again once gone
+ */
+int lp_anim_text(struct lp_anim* anim, int x, int y, int width, const char* text,
+		 int velocity, int speed, enum bool loop);
+
+/** stop the effects drawing on a led, or all of them if x is negative
+ */
+void lp_anim_cancel(struct lp_anim* anim, int x, int y);
+
+/** start an effect described by a sysex message
+ *
+ * the message is F0 7D, a command, its arguments and F7. durations take two
+ * bytes, in hundredths of a second, the most significant first. speeds are
+ * signed on 7 bits.
+ *
+ *     01 x y width height from to duration -- fade
+ *     02 x y width height velocity duration -- blink
+ *     03 x y width height dx dy duration velocities... -- sprite
+ *     04 x y width velocity speed loop text... -- text
+ *     05 [x y] -- cancel
+ *
+ * \return the index of the effect, or -1 when the message is not understood
+ */
+int lp_anim_sysex(struct lp_anim* anim, const unsigned char* data, int size);
+
+#endif
@@ -0,0 +1,1344 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * benchmarks of the library and of the bridges, run against the virtual
+ * launchpad so that no device is needed.
+ */
+
+#include "lpvirtual.h"
+#include "lpgrid.h"
+#include "lpsched.h"
+#include "lptrace.h"
+#include "lpgesture.h"
+#include "lpshm.h"
+#include "lpring.h"
+#include "lpdither.h"
+#include "lpnet.h"
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <lo/lo.h>
+#include <alsa/asoundlib.h>
+
+// port of the osc bridge, the replies come on the next one
+#define BENCH_PORT "7770"
+#define BENCH_REPLY_PORT "7771"
+
+// the other sockets lposc serves, and the size of their buffers
+#define BENCH_SOCKETS 4
+#define BENCH_BUFFERS ",262144"
+static const char* bench_sockets[BENCH_SOCKETS] = {
+    "udp:7772", "unix:/tmp/lpbench.sock", "tcp:7773", "slip:7774"
+};
+
+// how long to wait for a reply, in milliseconds
+#define BENCH_TIMEOUT 1000
+
+// amount of round trips measured through the bridges
+#define BENCH_ROUND_TRIPS 2000
+
+// amount of frames sent through the bridges
+#define BENCH_FRAMES 200
+
+// how long a client floods the launchpad, and how many times faster than the
+// device takes the messages
+#define BENCH_FLOOD 500000000ULL
+#define BENCH_OVERLOAD 4
+
+// times the launchpad is unplugged and plugged back, and how long it stays
+// unplugged, in microseconds
+#define BENCH_RECONNECTS 50
+#define BENCH_UNPLUGGED 5000
+
+// how long the leds are dithered, in nanoseconds
+#define BENCH_DITHER 1000000000ULL
+
+// beats of the jitter benchmark: their period, the network jitter added to
+// each, and how far ahead scheduled updates are sent, in nanoseconds
+#define BENCH_BEATS 1000
+#define BENCH_PERIOD 2000000ULL
+#define BENCH_JITTER 1000000ULL
+#define BENCH_AHEAD 2000000ULL
+
+// random streams parsed by the parsing check, and their size
+#define BENCH_STREAMS 2000
+#define BENCH_STREAM 512
+
+unsigned long long latency = 125000;
+int count = 100000;
+
+/* a launchpad with no latency, for measuring the library alone */
+struct launchpad* bench_open(unsigned long long device_latency)
+{
+    struct launchpad* lp = lp_register_with(&lp_virtual, 0);
+    
+    if (lp == NULL) {
+	exit(1);
+    }
+    lp_virtual_loopback(lp, false);
+    lp_virtual_latency(lp, device_latency);
+    lp_virtual_drain(lp);
+    memset(&lp->stats, 0, sizeof(lp->stats));
+    return lp;
+}
+
+/* velocity of a led at a step, so that every write changes the led */
+int bench_velocity(int step)
+{
+    return step % 2 ? 0x3C : 0x0F;
+}
+
+void bench_rate(const char* name, double amount, const char* unit, unsigned long long elapsed)
+{
+    printf("%-28s %12.0f %s/s\n", name, amount * 1e9 / elapsed, unit);
+}
+
+void bench_stats(const struct launchpad* lp, double frames)
+{
+    printf("%-28s %12.1f transfers/frame %8.1f bytes/frame\n", "",
+	   lp->stats.transfers / frames, lp->stats.bytes / frames);
+}
+
+/* single led writes, sent right away */
+void bench_direct()
+{
+    struct launchpad* lp = bench_open(0);
+    struct lp_histogram calls = { "lp_send3" };
+    unsigned long long start, before, after;
+    int i;
+    
+    start = lp_now();
+    for (i = 0; i < count; i++) {
+	before = lp_now();
+	lp_send3(lp, NOTE_ON, i % 64 / 8 * 16 + i % 8, bench_velocity(i / 64));
+	after = lp_now();
+	lp_histogram_record(&calls, after - before);
+    }
+    lp_virtual_drain(lp);
+    
+    bench_rate("direct", count, "msg", lp_now() - start);
+    lp_histogram_print(stdout, &calls);
+    lp_deregister(lp);
+}
+
+/* single led writes, queued for the writer thread */
+void bench_queued()
+{
+    struct launchpad* lp = bench_open(latency);
+    struct lp_histogram calls = { "lp_send3" };
+    unsigned long long start, before, after;
+    int i;
+    
+    lp_start_writer(lp);
+    
+    start = lp_now();
+    for (i = 0; i < count; i++) {
+	// leave room in the queue rather than measure drops
+	while (lp_queue_depth(lp) >= LP_QUEUE_SIZE / 2) {
+	    usleep(10);
+	}
+	
+	before = lp_now();
+	lp_send3(lp, NOTE_ON, i % 64 / 8 * 16 + i % 8, bench_velocity(i / 64));
+	after = lp_now();
+	lp_histogram_record(&calls, after - before);
+    }
+    while (lp_queue_depth(lp) > 0) {
+	usleep(100);
+    }
+    lp_virtual_drain(lp);
+    
+    bench_rate("queued", count, "msg", lp_now() - start);
+    lp_histogram_print(stdout, &calls);
+    printf("%-28s %12lu sent %8lu coalesced %8lu suppressed %8lu transfers\n", "",
+	   lp->stats.sent, lp->stats.coalesced, lp->stats.suppressed, lp->stats.transfers);
+    lp_deregister(lp);
+}
+
+/* whole frames, drawn led by led or at once */
+void bench_frames(enum bool at_once)
+{
+    struct launchpad* lp = bench_open(latency);
+    unsigned char frame[LP_LEDS];
+    unsigned long long start;
+    int frames = count / LP_LEDS;
+    int i, j;
+    
+    start = lp_now();
+    for (i = 0; i < frames; i++) {
+	for (j = 0; j < LP_LEDS; j++) {
+	    frame[j] = bench_velocity(i);
+	}
+	
+	if (at_once) {
+	    lp_frame(lp, frame);
+	} else {
+	    for (j = 0; j < 64; j++) {
+		lp_matrix(lp, j / 8, j % 8, frame[j]);
+	    }
+	    for (j = 0; j < 8; j++) {
+		lp_scene(lp, j, frame[LP_SCENE_LED(j)]);
+		lp_ctrl(lp, j, frame[LP_CTRL_LED(j)]);
+	    }
+	}
+    }
+    lp_virtual_drain(lp);
+    
+    bench_rate(at_once ? "frame, lp_frame" : "frame, led by led", frames, "frame", lp_now() - start);
+    bench_stats(lp, frames);
+    lp_deregister(lp);
+}
+
+/* a client writing leds faster than the device takes them, flushing after
+ * each write like the bridges do. without a rate, each flush waits for the
+ * device and the client falls further and further behind. with the rate of
+ * the device, the writes held back are coalesced instead */
+void bench_flood(enum bool limited)
+{
+    struct launchpad* lp = bench_open(latency);
+    struct lp_histogram late = { limited ? "flood, limited rate" : "flood, no limit" };
+    unsigned long long start, due, now, age, oldest = 0;
+    int capacity, writes, i, timeout;
+    
+    // a message in each transfer, a packet each
+    capacity = 1000000000ULL / latency;
+    writes = BENCH_FLOOD / 1000000000.0 * capacity * BENCH_OVERLOAD;
+    if (limited) {
+	// under the capacity, so that transfers do not pile up in the device
+	lp_set_rate(lp, capacity * 3 / 4);
+    }
+    
+    start = lp_now();
+    for (i = 0; i < writes; i++) {
+	due = start + (unsigned long long) i * 1000000000ULL / (capacity * BENCH_OVERLOAD);
+	while ((now = lp_now()) < due);
+	lp_histogram_record(&late, now - due);
+	
+	lp_send3(lp, NOTE_ON, i * 7 % 64 / 8 * 16 + i * 7 % 8, bench_velocity(i / 64));
+	age = lp_backlog_age(lp);
+	if (age > oldest) {
+	    oldest = age;
+	}
+    }
+    
+    // then what was held back
+    while ((timeout = lp_backlog_timeout(lp, 100)) < 100 && lp->ndirty > 0) {
+	usleep(timeout * 1000);
+	lp_flush(lp);
+    }
+    lp_virtual_drain(lp);
+    
+    lp_histogram_print(stdout, &late);
+    printf("%-28s %12lu sent %8lu coalesced %8.1f ms backlog at most\n", "",
+	   lp->stats.sent, lp->stats.coalesced, oldest / 1e6);
+    lp_deregister(lp);
+}
+
+/* follow the leds of both buffers through the output sent to a launchpad */
+void bench_decode(const unsigned char* data, int size, unsigned char leds[2][LP_LEDS])
+{
+    int updating = 0, displaying = 0, cursor = 0;
+    int i, j, led, velocity;
+    
+    for (i = 0; i + 3 <= size; i += 3) {
+	for (j = 1; j < 3; j++) {
+	    led = -1;
+	    velocity = data[i + 2];
+	    if (data[i] == RAPID) {
+		led = cursor++;
+		velocity = data[i + j];
+	    } else if (j == 2) {
+		break;
+	    } else if (data[i] == NOTE) {
+		led = data[i + 1] % 16 == 8 ? LP_SCENE_LED(data[i + 1] / 16) : LP_MATRIX_LED(data[i + 1] / 16, data[i + 1] % 16);
+	    } else if (data[i] == CTRL && data[i + 1] >= 104) {
+		led = LP_CTRL_LED(data[i + 1] - 104);
+	    } else if (data[i] == CTRL && data[i + 2] == 0) {
+		memset(leds, 0, 2 * LP_LEDS);
+		updating = displaying = 0;
+	    } else if (data[i] == CTRL && data[i + 2] >= 32) {
+		displaying = data[i + 2] & 1;
+		updating = (data[i + 2] >> 2) & 1;
+		if (data[i + 2] & 16) {
+		    memcpy(leds[updating], leds[displaying], LP_LEDS);
+		}
+	    }
+	    if (data[i] != RAPID) {
+		cursor = 0;
+	    }
+	    
+	    if (led >= 0 && led < LP_LEDS) {
+		leds[updating][led] = velocity & 0x33;
+		if (velocity & 0x04) {
+		    leds[1 - updating][led] = velocity & 0x33;
+		} else if (velocity & 0x08) {
+		    leds[1 - updating][led] = 0;
+		}
+	    }
+	}
+    }
+}
+
+/* the launchpad unplugged while the client goes on drawing, then plugged back:
+ * how long it takes from the device coming back to its leds restored, and
+ * whether the device ends up with what was drawn */
+void bench_reconnect()
+{
+    struct launchpad* lp = bench_open(latency);
+    struct lp_histogram restores = { "reconnect to restored" };
+    unsigned char frame[LP_LEDS], leds[2][LP_LEDS], output[LP_VIRTUAL_OUTPUT];
+    unsigned long restored;
+    int mismatches = 0, lost = 0;
+    long bytes = 0;
+    int i, j, size;
+    
+    lp_start_writer(lp);
+    
+    // the buffers differ: the displayed one has a frame, the hidden one another
+    for (j = 0; j < LP_LEDS; j++) {
+	frame[j] = bench_velocity(j);
+    }
+    lp_frame(lp, frame);
+    lp_hide(lp);
+    
+    for (i = 0; i < BENCH_RECONNECTS; i++) {
+	lp_virtual_unplug(lp);
+	for (j = 0; j < LP_LEDS; j++) {
+	    frame[j] = bench_velocity(i + j / 8);
+	}
+	lp_frame(lp, frame);
+	if (i % 2) {
+	    lp_swap(lp);
+	}
+	usleep(BENCH_UNPLUGGED);
+	while (lp_virtual_output(lp, output, sizeof(output)) > 0);
+	
+	restored = lp->stats.restored;
+	lp_virtual_plug(lp);
+	for (j = 0; j < BENCH_TIMEOUT && __atomic_load_n(&lp->stats.restored, __ATOMIC_ACQUIRE) == restored; j++) {
+	    usleep(1000);
+	}
+	if (j == BENCH_TIMEOUT) {
+	    lost++;
+	    continue;
+	}
+	lp_histogram_record(&restores, lp->stats.restore_time);
+	
+	// the device shows what was drawn while it was away
+	lp_virtual_drain(lp);
+	size = lp_virtual_output(lp, output, sizeof(output));
+	bytes += size;
+	bench_decode(output, size, leds);
+	mismatches += memcmp(leds, lp->leds, sizeof(leds)) != 0;
+    }
+    
+    lp_histogram_print(stdout, &restores);
+    printf("%-28s %12d reconnects %5d not restored %5d mismatches %8.1f bytes/restore\n", "",
+	   BENCH_RECONNECTS, lost, mismatches, (double) bytes / (BENCH_RECONNECTS - lost));
+    lp_deregister(lp);
+}
+
+/* a gradient dithered on four launchpads, measuring how steadily the
+ * subframes go out */
+void bench_dither(int rate)
+{
+    struct lp_grid* grid;
+    struct lp_dither* dither;
+    char name[32];
+    unsigned long transfers = 0;
+    int x, y, j;
+    
+    setenv("LP_TRANSPORT", lp_virtual.name, 1);
+    setenv("LP_DEVICES", "4", 1);
+    grid = lp_grid_open(4, 2);
+    if (grid == NULL) {
+	exit(1);
+    }
+    for (j = 0; j < grid->count; j++) {
+	lp_virtual_latency(grid->lps[j], latency);
+	lp_virtual_drain(grid->lps[j]);
+	memset(&grid->lps[j]->stats, 0, sizeof(grid->lps[j]->stats));
+    }
+    
+    // every level of red across, of green down
+    dither = lp_dither_start(grid, rate);
+    if (dither == NULL) {
+	exit(1);
+    }
+    for (y = 0; y < grid->height; y++) {
+	for (x = 0; x < grid->width; x++) {
+	    lp_dither_led(dither, x, y, x * LP_DITHER_MAX / (grid->width - 1),
+			  y * LP_DITHER_MAX / (grid->height - 1));
+	}
+    }
+    usleep(BENCH_DITHER / 1000);
+    lp_dither_clear(dither, -1, -1);
+    usleep(100000);
+    
+    for (j = 0; j < grid->count; j++) {
+	transfers += grid->lps[j]->stats.transfers;
+    }
+    snprintf(name, sizeof(name), "dither, %d/s", rate);
+    dither->jitter.name = name;
+    lp_histogram_print(stdout, &dither->jitter);
+    printf("%-28s %12lu subframes %5lu skipped %8.1f leds/subframe %5.1f transfers/subframe\n", "",
+	   dither->subframes, dither->skipped, (double) dither->writes / dither->subframes,
+	   (double) transfers / dither->subframes);
+    lp_dither_stop(dither);
+    lp_grid_close(grid);
+}
+
+/* whole frames of four launchpads tiled in a 16x16 grid */
+void bench_grid()
+{
+    struct lp_grid* grid;
+    unsigned char frame[4 * LP_GRID_SIDE * LP_GRID_SIDE];
+    unsigned long long start;
+    int frames = count / LP_LEDS;
+    int i, j;
+    
+    setenv("LP_TRANSPORT", lp_virtual.name, 1);
+    setenv("LP_DEVICES", "4", 1);
+    grid = lp_grid_open(4, 2);
+    if (grid == NULL) {
+	exit(1);
+    }
+    for (j = 0; j < grid->count; j++) {
+	lp_virtual_latency(grid->lps[j], latency);
+	lp_virtual_drain(grid->lps[j]);
+    }
+    
+    start = lp_now();
+    for (i = 0; i < frames; i++) {
+	memset(frame, bench_velocity(i), sizeof(frame));
+	lp_grid_frame(grid, frame);
+    }
+    for (j = 0; j < grid->count; j++) {
+	lp_virtual_drain(grid->lps[j]);
+    }
+    
+    bench_rate("frame, 16x16 grid", frames, "frame", lp_now() - start);
+    lp_grid_close(grid);
+}
+
+/* whole frames written to the shared memory, each waited for until flushed */
+void bench_shm()
+{
+    struct lp_grid* grid;
+    struct lp_shm *server, *client;
+    unsigned long long start;
+    int frames = count / LP_LEDS;
+    int i;
+    
+    setenv("LP_TRANSPORT", lp_virtual.name, 1);
+    setenv("LP_DEVICES", "1", 1);
+    grid = lp_grid_open(1, 0);
+    if (grid == NULL) {
+	exit(1);
+    }
+    lp_virtual_latency(grid->lps[0], latency);
+    server = lp_shm_serve(grid, "/lpbench");
+    client = server != NULL ? lp_shm_attach("/lpbench") : NULL;
+    if (client == NULL) {
+	exit(1);
+    }
+    
+    start = lp_now();
+    for (i = 0; i < frames; i++) {
+	lp_shm_begin(client);
+	memset(client->frame->leds[0], bench_velocity(i), LP_LEDS);
+	lp_shm_commit(client);
+	while (__atomic_load_n(&server->flushed, __ATOMIC_ACQUIRE) != i + 1) {
+	    sched_yield();
+	}
+    }
+    lp_virtual_drain(grid->lps[0]);
+    
+    bench_rate("frame, shared memory", frames, "frame", lp_now() - start);
+    bench_stats(grid->lps[0], frames);
+    lp_shm_detach(client);
+    lp_shm_stop(server);
+    lp_grid_close(grid);
+}
+
+unsigned long long intended[BENCH_BEATS];
+
+/* sleep until a time of lp_now */
+void bench_sleep(unsigned long long until)
+{
+    struct timespec time;
+    
+    time.tv_sec = until / 1000000000ULL;
+    time.tv_nsec = until % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, NULL);
+}
+
+/* leds meant for regular beats arrive with some network jitter. they are
+ * either applied when they arrive, or sent ahead and scheduled for their beat */
+void bench_jitter(enum bool scheduled)
+{
+    struct lp_histogram error = { scheduled ? "scheduled" : "immediate" };
+    struct lp_event events[LP_EVENTS];
+    struct lp_grid* grid;
+    struct lp_sched* sched = NULL;
+    unsigned long long start, arrival, beat;
+    int sent, received, i, n;
+    
+    setenv("LP_TRANSPORT", lp_virtual.name, 1);
+    setenv("LP_DEVICES", "1", 1);
+    grid = lp_grid_open(1, 1);
+    if (grid == NULL) {
+	exit(1);
+    }
+    lp_virtual_drain(grid->lps[0]);
+    lp_virtual_loopback(grid->lps[0], true);
+    if (scheduled) {
+	sched = lp_sched_start(grid, lp_late_merge, 0);
+    }
+    
+    srand(1);
+    start = lp_now() + BENCH_AHEAD;
+    sent = received = 0;
+    while (received < BENCH_BEATS) {
+	// send the next update when it arrives from the network
+	if (sent < BENCH_BEATS) {
+	    beat = start + sent * BENCH_PERIOD;
+	    arrival = beat + rand() % BENCH_JITTER - (scheduled ? BENCH_AHEAD : 0);
+	    
+	    if (lp_now() >= arrival) {
+		intended[sent] = beat;
+		if (scheduled) {
+		    lp_sched_send3(sched, beat, 0, NOTE, sent % 64 / 8 * 16 + sent % 8, bench_velocity(sent / 64));
+		} else {
+		    lp_grid_lock(grid);
+		    lp_grid_send3(grid, 0, NOTE, sent % 64 / 8 * 16 + sent % 8, bench_velocity(sent / 64));
+		    lp_grid_flush(grid);
+		    lp_grid_unlock(grid);
+		}
+		sent++;
+		continue;
+	    }
+	}
+	
+	// the leds come back in the order they were sent
+	lp_grid_handle(grid, 0);
+	n = lp_grid_events(grid, events, LP_EVENTS);
+	for (i = 0; i < n && received < BENCH_BEATS; i++, received++) {
+	    lp_histogram_record(&error, events[i].time > intended[received]
+				? events[i].time - intended[received]
+				: intended[received] - events[i].time);
+	}
+	if (n == 0) {
+	    bench_sleep(lp_now() + 20000);
+	}
+    }
+    
+    lp_histogram_print(stdout, &error);
+    if (sched != NULL) {
+	lp_sched_stop(sched);
+    }
+    lp_grid_close(grid);
+}
+
+/* parsing of running status messages split across packets */
+void bench_parse()
+{
+    struct launchpad* lp = bench_open(0);
+    struct lp_event events[LP_EVENTS];
+    unsigned char stream[MAX_PACKET_SIZE * LP_PACKETS];
+    unsigned long long start;
+    int size, i, at, n;
+    int parsed = 0;
+    int rounds = count / 100;
+    
+    // a full packet queue of note messages with running status
+    stream[0] = NOTE;
+    size = 1;
+    while (size + 2 <= sizeof(stream)) {
+	stream[size] = size % 120;
+	stream[size + 1] = bench_velocity(size);
+	size += 2;
+    }
+    
+    start = lp_now();
+    for (i = 0; i < rounds; i++) {
+	for (at = 0; at < size; at += MAX_PACKET_SIZE) {
+	    lp_packet(lp, stream + at, size - at < MAX_PACKET_SIZE ? size - at : MAX_PACKET_SIZE);
+	}
+	while ((n = lp_events(lp, events, LP_EVENTS, false)) > 0) {
+	    parsed += n;
+	}
+    }
+    
+    bench_rate("parse", parsed, "event", lp_now() - start);
+    lp_deregister(lp);
+}
+
+struct lp_histogram wakes = { "ring wake" };
+
+/* a reader of the ring, recording how long each event took to reach it */
+void* bench_ring_reader(void* data)
+{
+    struct lp_ring* ring = lp_ring_attach("/lpbench-input");
+    struct lp_event events[LP_EVENTS];
+    int* expected = data;
+    int received = 0;
+    int i, n;
+    
+    while (ring != NULL && received < *expected) {
+	if (!lp_ring_wait(ring, BENCH_TIMEOUT)) {
+	    break;
+	}
+	n = lp_ring_read(ring, events, LP_EVENTS);
+	for (i = 0; i < n; i++) {
+	    lp_histogram_record(&wakes, lp_now() - events[i].time);
+	}
+	received += n;
+    }
+    
+    if (ring != NULL) {
+	lp_ring_close(ring);
+    }
+    return NULL;
+}
+
+/* events published to the shared memory ring: read back by a second cursor,
+ * then woken one by one */
+void bench_ring()
+{
+    struct lp_ring *ring, *reader;
+    struct lp_event events[LP_EVENTS];
+    unsigned long long start;
+    pthread_t thread;
+    int sleepers = count / 100;
+    int i, read = 0;
+    
+    ring = lp_ring_create("/lpbench-input");
+    reader = ring != NULL ? lp_ring_attach("/lpbench-input") : NULL;
+    if (reader == NULL) {
+	exit(1);
+    }
+    memset(events, 0, sizeof(events));
+    
+    start = lp_now();
+    for (i = 0; i < count; i += LP_EVENTS) {
+	lp_ring_publish(ring, events, LP_EVENTS);
+	read += lp_ring_read(reader, events, LP_EVENTS);
+    }
+    bench_rate("ring", read, "event", lp_now() - start);
+    lp_ring_close(reader);
+    
+    // a reader sleeping until each event comes
+    pthread_create(&thread, NULL, bench_ring_reader, &sleepers);
+    usleep(10000);
+    for (i = 0; i < sleepers; i++) {
+	events[0].time = lp_now();
+	lp_ring_publish(ring, events, 1);
+	usleep(200);
+    }
+    pthread_join(thread, NULL);
+    lp_histogram_print(stdout, &wakes);
+    lp_ring_close(ring);
+}
+
+/* add a pad event of a synthetic script, at a time in ms from the start */
+int bench_pad(struct lp_event* script, int n, int x, int y, int press, unsigned long long ms)
+{
+    memset(&script[n], 0, sizeof(struct lp_event));
+    script[n].status = NOTE;
+    script[n].data1 = y * 16 + x;
+    script[n].data2 = press ? 127 : 0;
+    script[n].time = 1000000000ULL + ms * 1000000ULL;
+    return n + 1;
+}
+
+/* replay of timestamped input through the gesture detector. each round holds
+ * a long press, a double tap, a chord of 3 pads and a swipe of 4, so that the
+ * detected gestures can be checked */
+void bench_gestures()
+{
+    struct lp_grid* grid;
+    struct lp_gestures* gestures;
+    struct lp_gesture detected[LP_GESTURE_QUEUE];
+    struct lp_event script[LP_EVENTS];
+    unsigned long long start, t;
+    int kinds[4] = {0, 0, 0, 0};
+    int rounds = count / 20;
+    int i, j, n, events = 0;
+    
+    setenv("LP_TRANSPORT", lp_virtual.name, 1);
+    setenv("LP_DEVICES", "1", 1);
+    grid = lp_grid_open(1, 0);
+    if (grid == NULL) {
+	exit(1);
+    }
+    gestures = lp_gestures_new(grid, NULL);
+    
+    start = lp_now();
+    for (i = 0; i < rounds; i++) {
+	t = i * 2000ULL;
+	n = 0;
+	n = bench_pad(script, n, 0, 0, true, t);
+	n = bench_pad(script, n, 0, 0, false, t + 600);
+	n = bench_pad(script, n, 1, 1, true, t + 700);
+	n = bench_pad(script, n, 1, 1, false, t + 720);
+	n = bench_pad(script, n, 1, 1, true, t + 800);
+	n = bench_pad(script, n, 1, 1, false, t + 820);
+	for (j = 0; j < 3; j++) {
+	    n = bench_pad(script, n, 2 + j, 2 + j, true, t + 1000 + 10 * j);
+	}
+	for (j = 0; j < 3; j++) {
+	    n = bench_pad(script, n, 2 + j, 2 + j, false, t + 1200);
+	}
+	for (j = 0; j < 4; j++) {
+	    n = bench_pad(script, n, j, 5, true, t + 1400 + 60 * j);
+	    n = bench_pad(script, n, j, 5, false, t + 1430 + 60 * j);
+	}
+	
+	lp_gestures_feed(gestures, script, n);
+	lp_gestures_advance(gestures, script[0].time + 1999000000ULL);
+	events += n;
+	
+	while ((n = lp_gestures_read(gestures, detected, LP_GESTURE_QUEUE)) > 0) {
+	    for (j = 0; j < n; j++) {
+		kinds[detected[j].kind]++;
+	    }
+	}
+    }
+    
+    bench_rate("gestures", events, "event", lp_now() - start);
+    printf("%-28s %12d long, %d double, %d chord, %d swipe, of %d each%s\n", "",
+	   kinds[lp_gesture_long], kinds[lp_gesture_double], kinds[lp_gesture_chord],
+	   kinds[lp_gesture_swipe], rounds,
+	   kinds[0] == rounds && kinds[1] == rounds && kinds[2] == rounds && kinds[3] == rounds ? "" : " MISMATCH");
+    
+    lp_gestures_free(gestures);
+    lp_grid_close(grid);
+}
+
+/* add a byte to a stream, sometimes after a real time byte */
+void bench_put(unsigned char* stream, int* size, int byte)
+{
+    if (rand() % 8 == 0) {
+	stream[(*size)++] = 0xF8 + rand() % 8;
+    }
+    stream[(*size)++] = byte;
+}
+
+/* a random stream of input: channel messages with and without running
+ * status, some of them cut short, system exclusive and system common messages,
+ * stray data, and real time bytes anywhere. it starts with a tune request,
+ * which cancels whatever the previous stream left */
+int bench_stream(unsigned char* stream, int max)
+{
+    int size = 0;
+    int n;
+    
+    bench_put(stream, &size, 0xF6);
+    while (size < max - 32) {
+	switch (rand() % 8) {
+	case 0:
+	    bench_put(stream, &size, 0xF0);
+	    for (n = rand() % 8; n > 0; n--) {
+		bench_put(stream, &size, rand() % 128);
+	    }
+	    bench_put(stream, &size, 0xF7);
+	    break;
+	case 1:
+	    bench_put(stream, &size, 0xF1 + rand() % 6);
+	    bench_put(stream, &size, rand() % 128);
+	    break;
+	case 2:
+	    bench_put(stream, &size, rand() % 128);
+	    break;
+	default:
+	    if (rand() % 2 == 0) {
+		bench_put(stream, &size, 0x80 + rand() % 0x70);
+	    }
+	    for (n = 1 + rand() % 2; n > 0; n--) {
+		bench_put(stream, &size, rand() % 128);
+	    }
+	}
+    }
+    
+    return size;
+}
+
+/* the events of a whole stream, decoded as the midi spec reads it */
+int bench_reference(const unsigned char* stream, int size, struct lp_event* events)
+{
+    int status = 0, have = 0, needed, i, n = 0;
+    int data[2];
+    
+    for (i = 0; i < size; i++) {
+	if (stream[i] >= 0xF8) {
+	    // real time bytes go unnoticed
+	    continue;
+	} else if (stream[i] >= 0xF0) {
+	    // the system messages have no running status, their data is ignored
+	    status = 0;
+	} else if (stream[i] >= 0x80) {
+	    status = stream[i];
+	    have = 0;
+	} else if (status != 0) {
+	    data[have++] = stream[i];
+	    needed = (status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0 ? 1 : 2;
+	    if (have == needed) {
+		events[n].status = status;
+		events[n].data1 = data[0];
+		events[n].data2 = needed == 2 ? data[1] : 0;
+		n++;
+		have = 0;
+	    }
+	}
+    }
+    
+    return n;
+}
+
+/* random streams, split into packets at random and read a random amount of
+ * events at a time, give the same events as when decoded whole */
+void bench_parse_check()
+{
+    struct launchpad* lp = bench_open(0);
+    unsigned char stream[BENCH_STREAM];
+    struct lp_event expected[BENCH_STREAM];
+    struct lp_event parsed[BENCH_STREAM + LP_EVENTS];
+    int size, at, packet, packets, wanted, n, i, j;
+    int events = 0, mismatches = 0;
+    
+    srand(1);
+    for (i = 0; i < BENCH_STREAMS; i++) {
+	size = bench_stream(stream, BENCH_STREAM);
+	wanted = bench_reference(stream, size, expected);
+	
+	// read before the packet queue fills up
+	n = packets = 0;
+	for (at = 0; at < size; at += packet) {
+	    packet = 1 + rand() % MAX_PACKET_SIZE;
+	    if (packet > size - at) {
+		packet = size - at;
+	    }
+	    lp_packet(lp, stream + at, packet);
+	    if (++packets == LP_PACKETS || rand() % 4 == 0) {
+		n += lp_events(lp, parsed + n, 1 + rand() % LP_EVENTS, false);
+		packets = 0;
+	    }
+	}
+	while ((j = lp_events(lp, parsed + n, 1 + rand() % LP_EVENTS, false)) > 0) {
+	    n += j;
+	}
+	
+	events += wanted;
+	for (j = 0; j < n || j < wanted; j++) {
+	    if (j >= n || j >= wanted
+		|| parsed[j].status != expected[j].status
+		|| parsed[j].data1 != expected[j].data1
+		|| parsed[j].data2 != expected[j].data2) {
+		mismatches++;
+		break;
+	    }
+	}
+    }
+    
+    printf("%-28s %12d streams, %d events, %d mismatches, %lu lost%s\n", "parse, split at random",
+	   BENCH_STREAMS, events, mismatches, lp->stats.lost,
+	   mismatches == 0 && lp->stats.lost == 0 ? "" : " MISMATCH");
+    lp_deregister(lp);
+}
+
+/* start a bridge on the virtual launchpad, in loopback mode */
+pid_t bench_spawn(char* const argv[])
+{
+    pid_t pid = fork();
+    
+    if (pid == 0) {
+	setenv("LP_TRANSPORT", "virtual", 1);
+	setenv("LP_LOOPBACK", "1", 1);
+	freopen("/dev/null", "w", stdout);
+	execv(argv[0], argv);
+	perror(argv[0]);
+	_exit(1);
+    }
+    
+    return pid;
+}
+
+void bench_kill(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+int replied = 0;
+
+int reply_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+    replied++;
+    return 0;
+}
+
+/* wait for replies from lposc */
+int bench_replies(lo_server server, int replies)
+{
+    while (replied < replies && lo_server_recv_noblock(server, BENCH_TIMEOUT) > 0);
+    return replied >= replies;
+}
+
+/* whole frames sent to lposc led by led, in a bundle, or with /lp/frame. each
+ * frame is done once all its leds came back */
+void bench_osc_frames(lo_server server, lo_address bridge, const char* name, int how)
+{
+    unsigned char frame[64];
+    unsigned long long start;
+    lo_bundle bundle;
+    lo_message message;
+    lo_blob blob;
+    int i, j;
+    
+    start = lp_now();
+    for (i = 0; i < BENCH_FRAMES; i++) {
+	replied = 0;
+	memset(frame, bench_velocity(i), sizeof(frame));
+	
+	if (how == 0) {
+	    for (j = 0; j < 64; j++) {
+		lo_send(bridge, "/lp/matrix", "iii", j / 8, j % 8, frame[j]);
+	    }
+	} else if (how == 1) {
+	    bundle = lo_bundle_new(LO_TT_IMMEDIATE);
+	    for (j = 0; j < 64; j++) {
+		message = lo_message_new();
+		lo_message_add_int32(message, j / 8);
+		lo_message_add_int32(message, j % 8);
+		lo_message_add_int32(message, frame[j]);
+		lo_bundle_add_message(bundle, "/lp/matrix", message);
+	    }
+	    lo_send_bundle(bridge, bundle);
+	    lo_bundle_free_recursive(bundle);
+	} else {
+	    blob = lo_blob_new(sizeof(frame), frame);
+	    lo_send(bridge, "/lp/frame", "b", blob);
+	    lo_blob_free(blob);
+	}
+	
+	if (!bench_replies(server, 64)) {
+	    printf("%-28s lost a reply\n", name);
+	    break;
+	}
+    }
+    
+    bench_rate(name, i, "frame", lp_now() - start);
+}
+
+/* the osc time tag of a time to come, see lp_now */
+lo_timetag bench_timetag(unsigned long long at)
+{
+    lo_timetag tag;
+    unsigned long long now = lp_now();
+    double seconds;
+    
+    lo_timetag_now(&tag);
+    seconds = tag.frac / 4294967296.0 + (at > now ? at - now : 0) / 1e9;
+    tag.sec += (unsigned int) seconds;
+    tag.frac = (seconds - (unsigned int) seconds) * 4294967296.0;
+    return tag;
+}
+
+/* leds sent ahead in bundles time tagged with their beat, which lposc holds
+ * in its scheduler until then. each comes back as a press */
+void bench_osc_scheduled(lo_server server, lo_address bridge)
+{
+    struct lp_histogram error = { "osc scheduled" };
+    unsigned long long beat, now;
+    lo_bundle bundle;
+    lo_message message;
+    int i;
+    
+    beat = lp_now() + BENCH_AHEAD;
+    for (i = 0; i < BENCH_BEATS; i++) {
+	replied = 0;
+	bundle = lo_bundle_new(bench_timetag(beat));
+	message = lo_message_new();
+	lo_message_add_int32(message, 0);
+	lo_message_add_int32(message, 0);
+	lo_message_add_int32(message, bench_velocity(i));
+	lo_bundle_add_message(bundle, "/lp/matrix", message);
+	lo_send_bundle(bridge, bundle);
+	lo_bundle_free_recursive(bundle);
+	
+	if (!bench_replies(server, 1)) {
+	    printf("%-28s lost a reply\n", "osc scheduled");
+	    break;
+	}
+	now = lp_now();
+	lp_histogram_record(&error, now > beat ? now - beat : beat - now);
+	
+	// the next one is sent ahead of its beat too
+	beat += BENCH_PERIOD;
+	if (beat < now + BENCH_AHEAD) {
+	    beat = now + BENCH_AHEAD;
+	}
+    }
+    
+    lp_histogram_print(stdout, &error);
+}
+
+/* wait for lposc to answer */
+int bench_osc_ready(lo_server server, lo_address bridge)
+{
+    int tries;
+    
+    replied = 0;
+    for (tries = 0; tries < 50 && !replied; tries++) {
+	lo_send(bridge, "/lp/dest", "s", "osc.udp://localhost:" BENCH_REPLY_PORT "/");
+	lo_send(bridge, "/lp/matrix", "iii", 0, 0, bench_velocity(tries));
+	lo_server_recv_noblock(server, 100);
+    }
+    while (lo_server_recv_noblock(server, 100) > 0);
+    
+    return replied;
+}
+
+/* led writes sent to lposc as fast as it answers, with every message logged
+ * or with the default quiet logging */
+void bench_osc_log(enum bool logging)
+{
+    char* const argv[] = { "./lposc", "-p", BENCH_PORT, logging ? "-vv" : NULL, NULL };
+    const char* name = logging ? "osc, logging every message" : "osc, quiet";
+    unsigned long long start;
+    lo_server server;
+    lo_address bridge;
+    pid_t pid;
+    int i, j;
+    
+    server = lo_server_new(BENCH_REPLY_PORT, NULL);
+    if (server == NULL) {
+	printf("%-28s skipped, port %s is busy\n", name, BENCH_REPLY_PORT);
+	return;
+    }
+    lo_server_add_method(server, "/lp/matrix", "iii", reply_handler, NULL);
+    bridge = lo_address_new("localhost", BENCH_PORT);
+    pid = bench_spawn(argv);
+    
+    if (!bench_osc_ready(server, bridge)) {
+	printf("%-28s skipped, lposc does not answer\n", name);
+    } else {
+	// a frame of messages at a time, so that none is lost
+	start = lp_now();
+	for (i = 0; i < BENCH_FRAMES; i++) {
+	    replied = 0;
+	    for (j = 0; j < 64; j++) {
+		lo_send(bridge, "/lp/matrix", "iii", j / 8, j % 8, bench_velocity(i));
+	    }
+	    if (!bench_replies(server, 64)) {
+		printf("%-28s lost a reply\n", name);
+		break;
+	    }
+	}
+	bench_rate(name, i * 64, "msg", lp_now() - start);
+    }
+    
+    bench_kill(pid);
+    lo_address_free(bridge);
+    lo_server_free(server);
+}
+
+/* send a led write to lposc on a socket, framed for it */
+int bench_net_send(int fd, enum lp_net_kind kind, int row, int col, int velocity)
+{
+    unsigned char packet[64], framed[2 * sizeof(packet) + 2];
+    size_t size = sizeof(packet);
+    lo_message message;
+    
+    message = lo_message_new();
+    lo_message_add_int32(message, row);
+    lo_message_add_int32(message, col);
+    lo_message_add_int32(message, velocity);
+    lo_message_serialise(message, "/lp/matrix", packet, &size);
+    lo_message_free(message);
+    
+    size = lp_net_frame(kind, packet, size, framed);
+    return write(fd, framed, size) == size ? 0 : -1;
+}
+
+/* the same round trips and led writes through each socket lposc serves, the
+ * events coming back over udp */
+void bench_net()
+{
+    char listens[BENCH_SOCKETS][64];
+    char* argv[4 + 2 * BENCH_SOCKETS] = { "./lposc", "-p", BENCH_PORT };
+    struct lp_histogram trips;
+    unsigned long long start, before;
+    char name[32];
+    lo_server server;
+    lo_address bridge;
+    pid_t pid;
+    int kind, fd, ready, i, j;
+    
+    for (i = 0; i < BENCH_SOCKETS; i++) {
+	snprintf(listens[i], sizeof(listens[i]), "%s" BENCH_BUFFERS, bench_sockets[i]);
+	argv[3 + 2*i] = "-l";
+	argv[4 + 2*i] = listens[i];
+    }
+    
+    server = lo_server_new(BENCH_REPLY_PORT, NULL);
+    if (server == NULL) {
+	printf("%-28s skipped, port %s is busy\n", "sockets", BENCH_REPLY_PORT);
+	return;
+    }
+    lo_server_add_method(server, "/lp/matrix", "iii", reply_handler, NULL);
+    bridge = lo_address_new("localhost", BENCH_PORT);
+    pid = bench_spawn(argv);
+    
+    ready = bench_osc_ready(server, bridge);
+    if (!ready) {
+	printf("%-28s skipped, lposc does not answer\n", "sockets");
+    }
+    for (kind = 0; kind < BENCH_SOCKETS && ready; kind++) {
+	fd = lp_net_connect(bench_sockets[kind]);
+	if (fd < 0) {
+	    continue;
+	}
+	
+	snprintf(name, sizeof(name), "%s round trip", bench_sockets[kind]);
+	memset(&trips, 0, sizeof(trips));
+	trips.name = name;
+	start = lp_now();
+	for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+	    replied = 0;
+	    before = lp_now();
+	    if (bench_net_send(fd, kind, 0, 0, bench_velocity(i)) < 0 || !bench_replies(server, 1)) {
+		printf("%-28s lost a reply\n", name);
+		break;
+	    }
+	    lp_histogram_record(&trips, lp_now() - before);
+	}
+	bench_rate(name, i, "round trip", lp_now() - start);
+	lp_histogram_print(stdout, &trips);
+	
+	// a frame of messages at a time, each sent on its own
+	snprintf(name, sizeof(name), "%s led writes", bench_sockets[kind]);
+	start = lp_now();
+	for (i = 0; i < BENCH_FRAMES; i++) {
+	    replied = 0;
+	    for (j = 0; j < 64; j++) {
+		bench_net_send(fd, kind, j / 8, j % 8, bench_velocity(i));
+	    }
+	    if (!bench_replies(server, 64)) {
+		printf("%-28s lost a reply\n", name);
+		break;
+	    }
+	}
+	bench_rate(name, i * 64, "msg", lp_now() - start);
+	close(fd);
+    }
+    
+    bench_kill(pid);
+    lo_address_free(bridge);
+    lo_server_free(server);
+}
+
+/* led writes sent to lposc, and back as button events */
+void bench_osc()
+{
+    char* const argv[] = { "./lposc", "-p", BENCH_PORT, NULL };
+    struct lp_histogram trips = { "osc round trip" };
+    unsigned long long start, before;
+    lo_server server;
+    lo_address bridge;
+    pid_t pid;
+    int i;
+    
+    server = lo_server_new(BENCH_REPLY_PORT, NULL);
+    if (server == NULL) {
+	printf("%-28s skipped, port %s is busy\n", "osc", BENCH_REPLY_PORT);
+	return;
+    }
+    lo_server_add_method(server, "/lp/matrix", "iii", reply_handler, NULL);
+    bridge = lo_address_new("localhost", BENCH_PORT);
+    pid = bench_spawn(argv);
+    
+    if (!bench_osc_ready(server, bridge)) {
+	printf("%-28s skipped, lposc does not answer\n", "osc");
+    } else {
+	start = lp_now();
+	for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+	    replied = 0;
+	    before = lp_now();
+	    lo_send(bridge, "/lp/matrix", "iii", 0, 0, bench_velocity(i));
+	    if (!bench_replies(server, 1)) {
+		printf("%-28s lost a reply\n", "osc");
+		break;
+	    }
+	    lp_histogram_record(&trips, lp_now() - before);
+	}
+	bench_rate("osc", i, "round trip", lp_now() - start);
+	lp_histogram_print(stdout, &trips);
+	
+	bench_osc_frames(server, bridge, "osc frame, led by led", 0);
+	bench_osc_frames(server, bridge, "osc frame, bundle", 1);
+	bench_osc_frames(server, bridge, "osc frame, /lp/frame", 2);
+	bench_osc_scheduled(server, bridge);
+    }
+    
+    bench_kill(pid);
+    lo_address_free(bridge);
+    lo_server_free(server);
+}
+
+/* led writes sent to lpmidi, and back as button events */
+void bench_alsa(const char* name, enum bool single)
+{
+    char* const argv[] = { "./lpmidi", single ? "-e" : NULL, NULL };
+    struct lp_histogram trips = { "alsa round trip" };
+    unsigned long long start, before;
+    snd_seq_t* seq;
+    snd_seq_addr_t out, in;
+    snd_seq_event_t event, *reply;
+    struct pollfd fds[4];
+    int port, nfds, i, tries, received;
+    pid_t pid;
+    
+    if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) < 0) {
+	printf("%-28s skipped, no alsa sequencer\n", name);
+	return;
+    }
+    snd_seq_set_client_name(seq, "lpbench");
+    port = snd_seq_create_simple_port(seq, "bench",
+				      SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_WRITE,
+				      SND_SEQ_PORT_TYPE_APPLICATION);
+    pid = bench_spawn(argv);
+    
+    // wait for the bridge's ports
+    for (tries = 0; tries < 50; tries++) {
+	if (snd_seq_parse_address(seq, &out, "Launchpad:0") == 0
+	    && snd_seq_parse_address(seq, &in, "Launchpad:1") == 0
+	    && snd_seq_connect_from(seq, port, out.client, out.port) == 0
+	    && snd_seq_connect_to(seq, port, in.client, in.port) == 0) {
+	    break;
+	}
+	usleep(100000);
+    }
+    
+    if (tries == 50) {
+	printf("%-28s skipped, lpmidi does not answer\n", name);
+    } else {
+	nfds = snd_seq_poll_descriptors(seq, fds, 4, POLLIN);
+	start = lp_now();
+	for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+	    snd_seq_ev_clear(&event);
+	    snd_seq_ev_set_source(&event, port);
+	    snd_seq_ev_set_subs(&event);
+	    snd_seq_ev_set_direct(&event);
+	    snd_seq_ev_set_noteon(&event, 0, 0, bench_velocity(i));
+	    
+	    before = lp_now();
+	    snd_seq_event_output_direct(seq, &event);
+	    
+	    received = false;
+	    while (!received && poll(fds, nfds, BENCH_TIMEOUT) > 0) {
+		while (snd_seq_event_input(seq, &reply) >= 0) {
+		    received |= reply->type == SND_SEQ_EVENT_NOTEON;
+		}
+	    }
+	    if (!received) {
+		printf("%-28s lost a reply\n", name);
+		break;
+	    }
+	    lp_histogram_record(&trips, lp_now() - before);
+	}
+	bench_rate(name, i, "round trip", lp_now() - start);
+	lp_histogram_print(stdout, &trips);
+    }
+    
+    bench_kill(pid);
+    snd_seq_close(seq);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "l:n:")) != -1) {
+	switch (opt) {
+	case 'l':
+	    latency = atoll(optarg) * 1000;
+	    break;
+	case 'n':
+	    count = atoi(optarg);
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-l latency in us] [-n messages]\n", argv[0]);
+	    return 1;
+	}
+    }
+    
+    // the virtual launchpad is chatty
+    freopen("/dev/null", "w", stderr);
+    
+    printf("device latency: %llu us per packet, %d messages\n\n", latency / 1000, count);
+    lp_histogram_header(stdout);
+    bench_direct();
+    bench_queued();
+    bench_frames(false);
+    bench_frames(true);
+    bench_grid();
+    bench_shm();
+    bench_parse();
+    bench_gestures();
+    bench_parse_check();
+    bench_ring();
+    if (latency > 0) {
+	printf("\nwrite time - due time, %d times more writes than the device takes\n", BENCH_OVERLOAD);
+	lp_histogram_header(stdout);
+	bench_flood(false);
+	bench_flood(true);
+    }
+    printf("\nled time - beat time, %d beats %llu ms apart, %llu ms of network jitter\n",
+	   BENCH_BEATS, BENCH_PERIOD / 1000000, BENCH_JITTER / 1000000);
+    lp_histogram_header(stdout);
+    bench_jitter(false);
+    bench_jitter(true);
+    printf("\nrestored time - plugged time, %d reconnects\n", BENCH_RECONNECTS);
+    lp_histogram_header(stdout);
+    bench_reconnect();
+    printf("\nsubframe time - due time, a 16x16 gradient with %d levels per colour\n", LP_DITHER_MAX + 1);
+    lp_histogram_header(stdout);
+    bench_dither(LP_DITHER_RATE);
+    bench_dither(2 * LP_DITHER_RATE);
+    printf("\n");
+    bench_osc();
+    bench_osc_log(false);
+    bench_osc_log(true);
+    bench_net();
+    bench_alsa("alsa, threads", false);
+    bench_alsa("alsa, single loop", true);
+    
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpcapture.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// size of a record holding some data
+#define LP_CAPTURE_RECORD(size) ((sizeof(struct lp_capture_record) + (size) + 7) & ~7)
+
+// the capture, shared by all the launchpads
+static FILE* capture_file = NULL;
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int lp_capture_start(struct launchpad* lp, const char* path)
+{
+    struct lp_capture_header header;
+    
+    pthread_mutex_lock(&capture_lock);
+    if (capture_file == NULL) {
+	capture_file = fopen(path, "wb");
+	if (capture_file == NULL) {
+	    fprintf(stderr, "could not create the capture %s\n", path);
+	    pthread_mutex_unlock(&capture_lock);
+	    return -1;
+	}
+	
+	memcpy(header.magic, LP_CAPTURE_MAGIC, sizeof(header.magic));
+	header.origin = lp_now();
+	fwrite(&header, sizeof(header), 1, capture_file);
+    }
+    pthread_mutex_unlock(&capture_lock);
+    
+    lp->capturing = true;
+    return 0;
+}
+
+void lp_capture_stop()
+{
+    pthread_mutex_lock(&capture_lock);
+    if (capture_file != NULL) {
+	fclose(capture_file);
+	capture_file = NULL;
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+void lp_capture(struct launchpad* lp, enum lp_direction direction, const unsigned char* data, int size, unsigned long long time)
+{
+    unsigned char buffer[LP_CAPTURE_RECORD(MAX_TRANSFER_SIZE)];
+    struct lp_capture_record* record = (struct lp_capture_record*) buffer;
+    int length;
+    
+    if (size > MAX_TRANSFER_SIZE) {
+	size = MAX_TRANSFER_SIZE;
+    }
+    length = LP_CAPTURE_RECORD(size);
+    
+    memset(buffer, 0, length);
+    record->time = time;
+    record->direction = direction;
+    record->device = lp->index;
+    record->size = size;
+    memcpy(record->data, data, size);
+    
+    // buffered, so that capturing costs a copy and not a system call
+    pthread_mutex_lock(&capture_lock);
+    if (capture_file != NULL) {
+	fwrite(buffer, length, 1, capture_file);
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+struct lp_replay* lp_replay_open(const char* path)
+{
+    struct lp_replay* replay;
+    struct stat status;
+    int fd;
+    
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &status) < 0 || status.st_size < sizeof(struct lp_capture_header)) {
+	fprintf(stderr, "could not read the capture %s\n", path);
+	if (fd >= 0) {
+	    close(fd);
+	}
+	return NULL;
+    }
+    
+    replay = calloc(1, sizeof(struct lp_replay));
+    if (replay == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	close(fd);
+	return NULL;
+    }
+    replay->size = status.st_size;
+    replay->map = mmap(NULL, replay->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    
+    if (replay->map == MAP_FAILED || memcmp(replay->map, LP_CAPTURE_MAGIC, 8) != 0) {
+	fprintf(stderr, "%s is not a launchpad capture\n", path);
+	if (replay->map != MAP_FAILED) {
+	    munmap((void*) replay->map, replay->size);
+	}
+	free(replay);
+	return NULL;
+    }
+    
+    replay->origin = ((const struct lp_capture_header*) replay->map)->origin;
+    replay->at = sizeof(struct lp_capture_header);
+    return replay;
+}
+
+const struct lp_capture_record* lp_replay_next(struct lp_replay* replay)
+{
+    const struct lp_capture_record* record;
+    
+    // a record cut short, by a capture still being written, ends it too
+    if (replay->at + sizeof(struct lp_capture_record) > replay->size) {
+	return NULL;
+    }
+    record = (const struct lp_capture_record*) (replay->map + replay->at);
+    if (replay->at + LP_CAPTURE_RECORD(record->size) > replay->size) {
+	return NULL;
+    }
+    
+    // so does one which could not have been captured: what reads it relies on
+    // the size fitting a packet or a transfer
+    if (record->direction == lp_inbound ? record->size > MAX_PACKET_SIZE
+	: record->direction != lp_outbound || record->size > MAX_TRANSFER_SIZE) {
+	return NULL;
+    }
+    
+    replay->at += LP_CAPTURE_RECORD(record->size);
+    return record;
+}
+
+void lp_replay_close(struct lp_replay* replay)
+{
+    munmap((void*) replay->map, replay->size);
+    free(replay);
+}
@@ -0,0 +1,108 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPCAPTURE_H
+#define LPCAPTURE_H
+
+#include "liblaunchpad.h"
+#include <stdint.h>
+
+// first bytes of a capture
+#define LP_CAPTURE_MAGIC "LPCAPT01"
+
+/**
+ * which way captured data went
+ */
+enum lp_direction {
+    lp_inbound,		//! a packet received from a launchpad
+    lp_outbound		//! a transfer sent to a launchpad
+};
+
+/**
+ * the start of a capture
+ */
+struct lp_capture_header {
+    char magic[8];		//! LP_CAPTURE_MAGIC
+    uint64_t origin;		//! when the capture started, see lp_now
+};
+
+/**
+ * a record of a capture, followed by its data and padded to 8 bytes, so that
+ * a mapped capture can be read in place
+ */
+struct lp_capture_record {
+    uint64_t time;		//! when the data went, see lp_now
+    uint8_t direction;		//! an lp_direction
+    uint8_t device;		//! index of the launchpad
+    uint8_t size;		//! amount of data
+    uint8_t padding[5];
+    unsigned char data[];	//! the data
+};
+
+/**
+ * a capture mapped for replay
+ */
+struct lp_replay {
+    const unsigned char* map;	//! the mapped file
+    size_t size;		//! its size
+    size_t at;			//! offset of the next record
+    uint64_t origin;		//! when the capture started
+};
+
+/** capture everything a launchpad receives and sends to a file. the
+ * launchpads captured share the file, opened on the first call
+ *
+ * \return 0, or -1 when the file could not be created
+ */
+int lp_capture_start(struct launchpad* lp, const char* path);
+
+/** stop capturing, and close the file
+ */
+void lp_capture_stop();
+
+/** append data to the capture. called by the library for the launchpads
+ * captured
+ */
+void lp_capture(struct launchpad* lp, enum lp_direction direction, const unsigned char* data, int size, unsigned long long time);
+
+/** map a capture
+ *
+ * \return the capture, or NULL when it could not be read
+ */
+struct lp_replay* lp_replay_open(const char* path);
+
+/** the next record of a capture, or NULL at its end
+ *
+ * a record cut short, of an unknown direction, or larger than a packet or a
+ * transfer ends the capture too.
+ */
+const struct lp_capture_record* lp_replay_next(struct lp_replay* replay);
+
+/** unmap a capture
+ */
+void lp_replay_close(struct lp_replay* replay);
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpdither.h"
+#include "lpanim.h"
+#include "lprt.h"
+#include <errno.h>
+#include <string.h>
+
+#define NS 1000000000ULL
+
+// order of the phases, spreading the subframes a led is lit on over the cycle
+static const int lp_dither_order[LP_DITHER_PHASES] = {0, 2, 1, 3};
+
+/* level of the launchpad shown for a channel on a phase */
+static int lp_dither_level(int level, int phase)
+{
+    return (level + lp_dither_order[phase]) / LP_DITHER_PHASES;
+}
+
+/* render the subframe of a phase. returns the amount of leds dithered */
+static int lp_dither_render(struct lp_dither* dither, int phase)
+{
+    struct lp_grid* grid = dither->grid;
+    int i, x, y, led;
+    
+    for (i = 0; i < grid->width * grid->height; i++) {
+	if (!dither->active[i]) {
+	    dither->frame[i] = LED_UNKNOWN;
+	    continue;
+	}
+	
+	// a phase apart from the leds around
+	x = i % grid->width;
+	y = i / grid->width;
+	led = (phase + x + 2 * y) % LP_DITHER_PHASES;
+	dither->frame[i] = lp_dither_level(dither->red[i], led)
+	    + 16 * lp_dither_level(dither->green[i], led);
+    }
+    
+    return dither->count;
+}
+
+/* draw the subframe in the hidden buffers and show it. the grid is locked */
+static void lp_dither_push(struct lp_dither* dither)
+{
+    struct lp_grid* grid = dither->grid;
+    int i, velocity;
+    int changed = 0;
+    
+    for (i = 0; i < grid->width * grid->height; i++) {
+	velocity = dither->frame[i];
+	
+	// a led not dithered any more goes off
+	if (velocity == LED_UNKNOWN) {
+	    if (dither->shown[i] == LED_UNKNOWN) {
+		continue;
+	    }
+	    velocity = 0;
+	}
+	
+	if (velocity != dither->shown[i]) {
+	    lp_grid_led(grid, i % grid->width, i / grid->width, velocity);
+	    changed++;
+	}
+	dither->shown[i] = dither->frame[i];
+    }
+    dither->writes += changed;
+    
+    if (changed > 0 || !dither->engaged) {
+	lp_grid_swap(grid);
+	dither->engaged = true;
+    }
+}
+
+/* draw in the displayed buffers again, once nothing is dithered. the grid is
+ * locked */
+static void lp_dither_release(struct lp_dither* dither)
+{
+    struct lp_grid* grid = dither->grid;
+    struct launchpad* lp;
+    int i;
+    
+    for (i = 0; i < grid->count; i++) {
+	lp = grid->lps[i];
+	lp_setmode(lp, lp->displaying, lp->displaying, false, false);
+    }
+    dither->engaged = false;
+}
+
+static void* lp_dither_run(void* data)
+{
+    struct lp_dither* dither = data;
+    unsigned long long next = lp_now();
+    unsigned long long now;
+    struct timespec until;
+    int dithered;
+    
+    lp_rt_thread(lp_rt_timer);
+    pthread_mutex_lock(&dither->lock);
+    
+    while (dither->running) {
+	dithered = lp_dither_render(dither, dither->phase);
+	if (dithered == 0 && !dither->engaged) {
+	    // nothing to dither, the clock starts again with the next led
+	    pthread_cond_wait(&dither->started, &dither->lock);
+	    next = lp_now();
+	    continue;
+	}
+	
+	// rendering is done under the engine's lock, writing under the grid's
+	pthread_mutex_unlock(&dither->lock);
+	lp_grid_lock(dither->grid);
+	lp_dither_push(dither);
+	if (dithered == 0) {
+	    lp_dither_release(dither);
+	}
+	lp_grid_unlock(dither->grid);
+	now = lp_now();
+	pthread_mutex_lock(&dither->lock);
+	
+	lp_histogram_record(&dither->jitter, now - next);
+	dither->subframes++;
+	dither->phase = (dither->phase + 1) % LP_DITHER_PHASES;
+	
+	// subframes follow a fixed clock, skipping those already missed
+	next += dither->period;
+	if (next < now) {
+	    dither->skipped += (now - next) / dither->period + 1;
+	    next += ((now - next) / dither->period + 1) * dither->period;
+	}
+	pthread_mutex_unlock(&dither->lock);
+	until.tv_sec = next / NS;
+	until.tv_nsec = next % NS;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+	pthread_mutex_lock(&dither->lock);
+    }
+    
+    pthread_mutex_unlock(&dither->lock);
+    return NULL;
+}
+
+struct lp_dither* lp_dither_start(struct lp_grid* grid, int rate)
+{
+    struct lp_dither* dither;
+    int err;
+    
+    if (rate <= 0) {
+	rate = LP_DITHER_RATE;
+    }
+    if (grid->width * grid->height > LP_GRID_LEDS) {
+	fprintf(stderr, "the grid is too large to dither\n");
+	return NULL;
+    }
+    
+    dither = calloc(1, sizeof(struct lp_dither));
+    if (dither == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    dither->grid = grid;
+    dither->period = NS / rate;
+    dither->running = true;
+    dither->jitter.name = "dither";
+    memset(dither->shown, LED_UNKNOWN, sizeof(dither->shown));
+    
+    pthread_mutex_init(&dither->lock, NULL);
+    pthread_cond_init(&dither->started, NULL);
+    
+    err = pthread_create(&dither->thread, NULL, lp_dither_run, dither);
+    if (err) {
+	fprintf(stderr, "failed to start the dithering thread, with error %d\n", err);
+	free(dither);
+	return NULL;
+    }
+    
+    return dither;
+}
+
+void lp_dither_stop(struct lp_dither* dither)
+{
+    pthread_mutex_lock(&dither->lock);
+    dither->running = false;
+    pthread_cond_signal(&dither->started);
+    pthread_mutex_unlock(&dither->lock);
+    
+    pthread_join(dither->thread, NULL);
+    pthread_cond_destroy(&dither->started);
+    pthread_mutex_destroy(&dither->lock);
+    free(dither);
+}
+
+/* clamp a level */
+static int lp_dither_clamp(int level)
+{
+    return level < 0 ? 0 : level > LP_DITHER_MAX ? LP_DITHER_MAX : level;
+}
+
+void lp_dither_led(struct lp_dither* dither, int x, int y, int red, int green)
+{
+    int i;
+    
+    if (x < 0 || y < 0 || x >= dither->grid->width || y >= dither->grid->height) {
+	return;
+    }
+    i = y * dither->grid->width + x;
+    
+    pthread_mutex_lock(&dither->lock);
+    dither->red[i] = lp_dither_clamp(red);
+    dither->green[i] = lp_dither_clamp(green);
+    if (!dither->active[i]) {
+	dither->active[i] = true;
+	if (dither->count++ == 0) {
+	    pthread_cond_signal(&dither->started);
+	}
+    }
+    pthread_mutex_unlock(&dither->lock);
+}
+
+void lp_dither_clear(struct lp_dither* dither, int x, int y)
+{
+    int i;
+    
+    pthread_mutex_lock(&dither->lock);
+    for (i = 0; i < dither->grid->width * dither->grid->height; i++) {
+	if (dither->active[i] && (x < 0 || (i % dither->grid->width == x && i / dither->grid->width == y))) {
+	    dither->active[i] = false;
+	    dither->count--;
+	}
+    }
+    pthread_mutex_unlock(&dither->lock);
+}
+
+int lp_dither_sysex(struct lp_dither* dither, const unsigned char* data, int size)
+{
+    // F0 7D command ... F7
+    if (size < 4 || data[0] != 0xF0 || data[1] != LP_ANIM_SYSEX_ID || data[size - 1] != 0xF7) {
+	return -1;
+    }
+    
+    switch (data[2]) {
+    case 0x06:
+	if (size != 8) {
+	    return -1;
+	}
+	lp_dither_led(dither, data[3], data[4], data[5], data[6]);
+	return 0;
+    case 0x07:
+	if (size == 6) {
+	    lp_dither_clear(dither, data[3], data[4]);
+	} else if (size == 4) {
+	    lp_dither_clear(dither, -1, -1);
+	} else {
+	    return -1;
+	}
+	return 0;
+    }
+    
+    return -1;
+}
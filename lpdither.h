@@ -0,0 +1,110 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPDITHER_H
+#define LPDITHER_H
+
+#include "lpgrid.h"
+#include "lptrace.h"
+
+// subframes of a dithering cycle
+#define LP_DITHER_PHASES 4
+
+// highest level of a colour channel: each of the launchpad's 4 levels is split
+// in LP_DITHER_PHASES steps
+#define LP_DITHER_MAX (3 * LP_DITHER_PHASES)
+
+// subframes shown each second by default
+#define LP_DITHER_RATE 200
+
+/**
+ * the dithering engine: leds with more levels of red and green than the
+ * launchpad has, shown by alternating between two of its levels.
+ *
+ * a thread renders a subframe at a fixed rate, where each led shows the level
+ * just below or just above its own so that it gets it on average over a
+ * cycle. the subframe is drawn in the hidden buffer, rewriting only the leds
+ * which differ from the shown one, then the buffers are swapped. neighbouring
+ * leds are a phase apart, so that they do not all change on the same
+ * subframe. the engine stages its leds on the grid while holding the grid's
+ * lock, see lp_grid_lock. while leds are dithered, the launchpads draw in their
+ * hidden buffer, so this does not mix with lp_hide, lp_swap and blinking.
+ */
+struct lp_dither {
+    struct lp_grid* grid;				//! where the leds are drawn
+    pthread_mutex_t lock;				//! protects the levels
+    pthread_cond_t started;				//! signalled when a led is dithered
+    pthread_t thread;					//! thread rendering the subframes
+    int running;					//! whether the thread runs
+    int engaged;					//! whether the launchpads draw in the hidden buffer
+    unsigned long long period;				//! time between subframes, in ns
+    int phase;						//! phase of the next subframe
+    unsigned char red[LP_GRID_LEDS];			//! level of red of each led, up to LP_DITHER_MAX
+    unsigned char green[LP_GRID_LEDS];			//! level of green of each led
+    unsigned char active[LP_GRID_LEDS];			//! whether each led is dithered
+    int count;						//! amount of leds dithered
+    unsigned char frame[LP_GRID_LEDS];			//! rendered subframe
+    unsigned char shown[LP_GRID_LEDS];			//! subframe written to the grid
+    unsigned long subframes;				//! subframes shown
+    unsigned long skipped;				//! subframes skipped because the engine was late
+    unsigned long writes;				//! led writes staged
+    struct lp_histogram jitter;				//! from when a subframe is due to when it is sent
+};
+
+/** start the engine
+ *
+ * \param rate subframes shown each second
+ * \return the engine, or NULL when it could not start
+ */
+struct lp_dither* lp_dither_start(struct lp_grid* grid, int rate);
+
+/** stop the engine, leaving the leds as they are
+ */
+void lp_dither_stop(struct lp_dither* dither);
+
+/** dither a led of the grid
+ *
+ * \param red level of red, from 0 to LP_DITHER_MAX
+ * \param green level of green, from 0 to LP_DITHER_MAX
+ */
+void lp_dither_led(struct lp_dither* dither, int x, int y, int red, int green);
+
+/** turn a led off and stop dithering it, or all of them if x is negative
+ */
+void lp_dither_clear(struct lp_dither* dither, int x, int y);
+
+/** dither leds as described by a sysex message
+ *
+ * the message is F0 7D, a command, its arguments and F7, see lp_anim_sysex.
+ *
+ *     06 x y red green -- dither a led
+ *     07 [x y] -- clear
+ *
+ * \return 0, or -1 when the message is not understood
+ */
+int lp_dither_sysex(struct lp_dither* dither, const unsigned char* data, int size);
+
+#endif
@@ -0,0 +1,390 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpgesture.h"
+#include <string.h>
+
+void lp_gestures_defaults(struct lp_gesture_config* config)
+{
+    config->hold = 500000000ULL;
+    config->twice = 300000000ULL;
+    config->chord = 50000000ULL;
+    config->chord_pads = 2;
+    config->step = 150000000ULL;
+    config->swipe_pads = 3;
+    config->tick = 10000000ULL;
+}
+
+int lp_gestures_configure(struct lp_gesture_config* config, const char* list)
+{
+    char copy[256];
+    char *name, *value, *save;
+    
+    strncpy(copy, list, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = 0;
+    
+    for (name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+	value = strchr(name, '=');
+	if (value == NULL) {
+	    return -1;
+	}
+	*value++ = 0;
+	
+	if (strcmp(name, "hold") == 0) {
+	    config->hold = atof(value) * 1000000;
+	} else if (strcmp(name, "twice") == 0) {
+	    config->twice = atof(value) * 1000000;
+	} else if (strcmp(name, "chord") == 0) {
+	    config->chord = atof(value) * 1000000;
+	} else if (strcmp(name, "step") == 0) {
+	    config->step = atof(value) * 1000000;
+	} else if (strcmp(name, "tick") == 0 && atof(value) > 0) {
+	    config->tick = atof(value) * 1000000;
+	} else if (strcmp(name, "chord_pads") == 0) {
+	    config->chord_pads = atoi(value);
+	} else if (strcmp(name, "swipe_pads") == 0) {
+	    config->swipe_pads = atoi(value);
+	} else {
+	    return -1;
+	}
+    }
+    
+    return 0;
+}
+
+struct lp_gestures* lp_gestures_new(struct lp_grid* grid, const struct lp_gesture_config* config)
+{
+    struct lp_gestures* gestures;
+    int i;
+    
+    if (grid->width * grid->height > LP_GRID_LEDS) {
+	fprintf(stderr, "the grid is too large to follow gestures on\n");
+	return NULL;
+    }
+    gestures = calloc(1, sizeof(struct lp_gestures));
+    if (gestures == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    gestures->grid = grid;
+    if (config != NULL) {
+	gestures->config = *config;
+    } else {
+	lp_gestures_defaults(&gestures->config);
+    }
+    
+    // all the timers are free, and the slots empty
+    for (i = 0; i < LP_GESTURE_TIMERS; i++) {
+	gestures->timers[i].next = i + 1 < LP_GESTURE_TIMERS ? i + 1 : -1;
+    }
+    for (i = 0; i < LP_GESTURE_SLOTS; i++) {
+	gestures->slots[i] = -1;
+    }
+    
+    return gestures;
+}
+
+void lp_gestures_free(struct lp_gestures* gestures)
+{
+    free(gestures);
+}
+
+/* queue a gesture for the reader */
+static void lp_gestures_emit(struct lp_gestures* gestures, const struct lp_gesture* gesture)
+{
+    if (gestures->count == LP_GESTURE_QUEUE) {
+	gestures->lost++;
+	return;
+    }
+    
+    gestures->queue[(gestures->head + gestures->count++) % LP_GESTURE_QUEUE] = *gesture;
+    gestures->detected++;
+}
+
+/* queue a gesture on a single pad */
+static void lp_gestures_pad(struct lp_gestures* gestures, enum lp_gesture_kind kind, int pad, unsigned long long time)
+{
+    struct lp_gesture gesture;
+    
+    memset(&gesture, 0, sizeof(gesture));
+    gesture.kind = kind;
+    gesture.x = pad % gestures->grid->width;
+    gesture.y = pad / gestures->grid->width;
+    gesture.count = 1;
+    gesture.time = time;
+    lp_gestures_emit(gestures, &gesture);
+}
+
+/* start a timer, for the press at stamp. the timer is lost when none is free */
+static void lp_gestures_start(struct lp_gestures* gestures, enum lp_gesture_kind kind, int pad,
+			      unsigned long long stamp, unsigned long long due)
+{
+    struct lp_gesture_timer* timer;
+    unsigned long long tick = due / gestures->config.tick;
+    int* last;
+    int i = gestures->free;
+    
+    if (i < 0) {
+	gestures->lost++;
+	return;
+    }
+    timer = &gestures->timers[i];
+    gestures->free = timer->next;
+    
+    timer->due = due;
+    timer->stamp = stamp;
+    timer->kind = kind;
+    timer->pad = pad;
+    timer->next = -1;
+    
+    // a timer already due goes in the current slot. timers of a slot fire in
+    // the order they were started
+    if (tick < gestures->ticks) {
+	tick = gestures->ticks;
+    }
+    for (last = &gestures->slots[tick % LP_GESTURE_SLOTS]; *last >= 0; last = &gestures->timers[*last].next);
+    *last = i;
+}
+
+/* end the chord being pressed, keeping the pads still held */
+static void lp_gestures_chord(struct lp_gestures* gestures, unsigned long long time)
+{
+    struct lp_gesture* chord = &gestures->chord;
+    int i, held = 0;
+    
+    for (i = 0; i < chord->count; i++) {
+	if (gestures->held[chord->ys[i] * gestures->grid->width + chord->xs[i]]) {
+	    chord->xs[held] = chord->xs[i];
+	    chord->ys[held] = chord->ys[i];
+	    held++;
+	}
+    }
+    
+    if (held >= gestures->config.chord_pads) {
+	chord->count = held;
+	chord->x = chord->xs[0];
+	chord->y = chord->ys[0];
+	chord->time = time;
+	lp_gestures_emit(gestures, chord);
+    }
+    gestures->chord_start = 0;
+}
+
+/* end the swipe going on */
+static void lp_gestures_swipe(struct lp_gestures* gestures, unsigned long long time)
+{
+    if (gestures->swipe.count >= gestures->config.swipe_pads) {
+	gestures->swipe.time = time;
+	lp_gestures_emit(gestures, &gestures->swipe);
+    }
+    gestures->swipe_last = 0;
+}
+
+/* a timer fired. it is stale when what it was started for changed since */
+static void lp_gestures_fire(struct lp_gestures* gestures, const struct lp_gesture_timer* timer)
+{
+    switch (timer->kind) {
+    case lp_gesture_long:
+	if (gestures->held[timer->pad] == timer->stamp) {
+	    lp_gestures_pad(gestures, lp_gesture_long, timer->pad, timer->due);
+	}
+	break;
+    case lp_gesture_chord:
+	if (gestures->chord_start == timer->stamp) {
+	    lp_gestures_chord(gestures, timer->due);
+	}
+	break;
+    case lp_gesture_swipe:
+	if (gestures->swipe_last == timer->stamp) {
+	    lp_gestures_swipe(gestures, timer->due);
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+void lp_gestures_advance(struct lp_gestures* gestures, unsigned long long now)
+{
+    struct lp_gesture_timer timer;
+    unsigned long long last = now / gestures->config.tick;
+    unsigned long long tick;
+    int* slot;
+    int i;
+    
+    if (last < gestures->ticks) {
+	last = gestures->ticks;
+    }
+    
+    // each slot is visited once at most, however far the wheel turns
+    for (tick = gestures->ticks; tick <= last && tick < gestures->ticks + LP_GESTURE_SLOTS; tick++) {
+	slot = &gestures->slots[tick % LP_GESTURE_SLOTS];
+	while (*slot >= 0) {
+	    i = *slot;
+	    if (gestures->timers[i].due > now) {
+		slot = &gestures->timers[i].next;
+		continue;
+	    }
+	    
+	    // free the timer before firing it
+	    timer = gestures->timers[i];
+	    *slot = timer.next;
+	    gestures->timers[i].next = gestures->free;
+	    gestures->free = i;
+	    lp_gestures_fire(gestures, &timer);
+	}
+    }
+    
+    gestures->ticks = last;
+}
+
+unsigned long long lp_gestures_next(const struct lp_gestures* gestures)
+{
+    unsigned long long next = 0;
+    int i, t;
+    
+    for (i = 0; i < LP_GESTURE_SLOTS; i++) {
+	for (t = gestures->slots[i]; t >= 0; t = gestures->timers[t].next) {
+	    if (next == 0 || gestures->timers[t].due < next) {
+		next = gestures->timers[t].due;
+	    }
+	}
+    }
+    
+    return next;
+}
+
+int lp_gestures_timeout(const struct lp_gestures* gestures, int max)
+{
+    unsigned long long next = lp_gestures_next(gestures);
+    unsigned long long now = lp_now();
+    
+    if (next == 0) {
+	return max;
+    }
+    if (next <= now) {
+	return 0;
+    }
+    
+    // rounded up, so that the timer is due when the wait ends
+    return (next - now + 999999) / 1000000 < max ? (next - now + 999999) / 1000000 : max;
+}
+
+/* a pad was pressed */
+static void lp_gestures_press(struct lp_gestures* gestures, int x, int y, unsigned long long time)
+{
+    const struct lp_gesture_config* config = &gestures->config;
+    struct lp_gesture* chord = &gestures->chord;
+    struct lp_gesture* swipe = &gestures->swipe;
+    int pad = y * gestures->grid->width + x;
+    int dx, dy;
+    
+    // long press, unless released before the timer fires
+    gestures->held[pad] = time;
+    lp_gestures_start(gestures, lp_gesture_long, pad, time, time + config->hold);
+    
+    // double tap
+    if (gestures->tapped[pad] && time - gestures->tapped[pad] <= config->twice) {
+	lp_gestures_pad(gestures, lp_gesture_double, pad, time);
+	gestures->tapped[pad] = 0;
+    } else {
+	gestures->tapped[pad] = time;
+    }
+    
+    // chord: the pads pressed within the window of the first one
+    if (gestures->chord_start && time - gestures->chord_start <= config->chord) {
+	if (chord->count < LP_GESTURE_CHORD) {
+	    chord->xs[chord->count] = x;
+	    chord->ys[chord->count] = y;
+	    chord->count++;
+	}
+    } else {
+	memset(chord, 0, sizeof(struct lp_gesture));
+	chord->kind = lp_gesture_chord;
+	chord->xs[0] = x;
+	chord->ys[0] = y;
+	chord->count = 1;
+	gestures->chord_start = time;
+	lp_gestures_start(gestures, lp_gesture_chord, pad, time, time + config->chord);
+    }
+    
+    // swipe: each pad next to the previous one, in the same direction
+    if (gestures->swipe_last && time - gestures->swipe_last <= config->step) {
+	dx = x - (swipe->x + swipe->dx * (swipe->count - 1));
+	dy = y - (swipe->y + swipe->dy * (swipe->count - 1));
+	if (swipe->count == 1 ? abs(dx) + abs(dy) == 1 : dx == swipe->dx && dy == swipe->dy) {
+	    swipe->dx = dx;
+	    swipe->dy = dy;
+	    swipe->count++;
+	    gestures->swipe_last = time;
+	    lp_gestures_start(gestures, lp_gesture_swipe, pad, time, time + config->step);
+	    return;
+	}
+    }
+    if (gestures->swipe_last) {
+	lp_gestures_swipe(gestures, time);
+    }
+    memset(swipe, 0, sizeof(struct lp_gesture));
+    swipe->kind = lp_gesture_swipe;
+    swipe->x = x;
+    swipe->y = y;
+    swipe->count = 1;
+    gestures->swipe_last = time;
+    lp_gestures_start(gestures, lp_gesture_swipe, pad, time, time + config->step);
+}
+
+void lp_gestures_feed(struct lp_gestures* gestures, const struct lp_event* events, int n)
+{
+    int i, x, y;
+    
+    for (i = 0; i < n; i++) {
+	lp_gestures_advance(gestures, events[i].time);
+	
+	// only the pads of the matrix make gestures
+	if (!lp_grid_position(gestures->grid, &events[i], &x, &y)) {
+	    continue;
+	}
+	
+	if (events[i].data2) {
+	    lp_gestures_press(gestures, x, y, events[i].time);
+	} else {
+	    gestures->held[y * gestures->grid->width + x] = 0;
+	}
+    }
+}
+
+int lp_gestures_read(struct lp_gestures* gestures, struct lp_gesture* out, int max)
+{
+    int n;
+    
+    for (n = 0; n < max && gestures->count > 0; n++) {
+	out[n] = gestures->queue[gestures->head];
+	gestures->head = (gestures->head + 1) % LP_GESTURE_QUEUE;
+	gestures->count--;
+    }
+    
+    return n;
+}
@@ -0,0 +1,164 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPGESTURE_H
+#define LPGESTURE_H
+
+#include "lpgrid.h"
+
+// slots of the timing wheel
+#define LP_GESTURE_SLOTS 64
+
+// most timers running at once
+#define LP_GESTURE_TIMERS 256
+
+// most pads of a chord
+#define LP_GESTURE_CHORD 8
+
+// most gestures waiting to be read
+#define LP_GESTURE_QUEUE 64
+
+/**
+ * the gestures detected on the pads
+ */
+enum lp_gesture_kind {
+    lp_gesture_long,	//! a pad held long enough
+    lp_gesture_double,	//! a pad pressed twice quickly
+    lp_gesture_chord,	//! several pads pressed at once, and still held
+    lp_gesture_swipe	//! adjacent pads pressed one after the other, along a row or a column
+};
+
+/**
+ * a gesture, in grid coordinates
+ */
+struct lp_gesture {
+    enum lp_gesture_kind kind;		//! what was detected
+    int x, y;				//! the pad, the first of a chord or the start of a swipe
+    int count;				//! pads of a chord or of a swipe, 1 otherwise
+    int dx, dy;				//! direction of a swipe
+    int xs[LP_GESTURE_CHORD];		//! pads of a chord, in the order pressed
+    int ys[LP_GESTURE_CHORD];
+    unsigned long long time;		//! when it was detected, see lp_now
+};
+
+/**
+ * the thresholds, in ns
+ */
+struct lp_gesture_config {
+    unsigned long long hold;	//! how long a pad is held for a long press
+    unsigned long long twice;	//! most time between the presses of a double tap
+    unsigned long long chord;	//! most time between the first and the last press of a chord
+    int chord_pads;		//! fewest pads of a chord
+    unsigned long long step;	//! most time between two pads of a swipe
+    int swipe_pads;		//! fewest pads of a swipe
+    unsigned long long tick;	//! resolution of the timers
+};
+
+/**
+ * a timer of the timing wheel
+ */
+struct lp_gesture_timer {
+    unsigned long long due;		//! when it fires
+    unsigned long long stamp;		//! the time of the press it was started for
+    enum lp_gesture_kind kind;		//! the gesture it completes
+    int pad;				//! the pad it was started for
+    int next;				//! next timer of the slot or of the free list, -1 for none
+};
+
+/**
+ * the detector. it only depends on the times of the events and on the times
+ * it is advanced to, so that replaying timestamped events always gives the
+ * same gestures. it is not locked: feed it from the thread reading the events.
+ */
+struct lp_gestures {
+    struct lp_grid* grid;					//! the grid the events come from
+    struct lp_gesture_config config;				//! thresholds
+    unsigned long long ticks;					//! tick the wheel is at
+    int slots[LP_GESTURE_SLOTS];				//! first timer of each slot
+    struct lp_gesture_timer timers[LP_GESTURE_TIMERS];		//! the timers
+    int free;							//! first free timer
+    unsigned long long held[LP_GRID_LEDS];			//! when each pad was pressed, 0 when released
+    unsigned long long tapped[LP_GRID_LEDS];			//! when each pad was last pressed, 0 after a double tap
+    struct lp_gesture chord;					//! chord being pressed
+    unsigned long long chord_start;				//! when its first pad was pressed, 0 for none
+    struct lp_gesture swipe;					//! swipe going on
+    unsigned long long swipe_last;				//! when its last pad was pressed, 0 for none
+    struct lp_gesture queue[LP_GESTURE_QUEUE];			//! gestures detected and not read yet
+    int head, count;
+    unsigned long detected;					//! gestures detected
+    unsigned long lost;						//! gestures lost because the queue was full
+};
+
+/** fill the default thresholds: a long press after 500 ms, double taps within
+ * 300 ms, chords of 2 pads within 50 ms and swipes of 3 pads 150 ms apart, at
+ * most, with 10 ms timers
+ */
+void lp_gestures_defaults(struct lp_gesture_config* config);
+
+/** change thresholds from a list of name=ms, separated by commas. the names
+ * are hold, twice, chord, step and tick, and chord_pads and swipe_pads take a
+ * number of pads
+ *
+ * \return 0, or -1 when the list has an unknown name
+ */
+int lp_gestures_configure(struct lp_gesture_config* config, const char* list);
+
+/** create a detector
+ *
+ * \param config thresholds, or NULL for the default ones
+ */
+struct lp_gestures* lp_gestures_new(struct lp_grid* grid, const struct lp_gesture_config* config);
+
+/** free a detector
+ */
+void lp_gestures_free(struct lp_gestures* gestures);
+
+/** feed events, in the order of their times. the timers due before each
+ * event fire first
+ */
+void lp_gestures_feed(struct lp_gestures* gestures, const struct lp_event* events, int n);
+
+/** fire the timers due at a time, which never goes back
+ */
+void lp_gestures_advance(struct lp_gestures* gestures, unsigned long long now);
+
+/** when the next timer is due, 0 when none runs
+ */
+unsigned long long lp_gestures_next(const struct lp_gestures* gestures);
+
+/** how long a loop may wait for events before the next timer is due, in ms
+ *
+ * \param max the longest wait
+ */
+int lp_gestures_timeout(const struct lp_gestures* gestures, int max);
+
+/** read the gestures detected so far
+ *
+ * \return the amount of gestures read
+ */
+int lp_gestures_read(struct lp_gestures* gestures, struct lp_gesture* out, int max);
+
+#endif
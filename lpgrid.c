@@ -0,0 +1,336 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpgrid.h"
+#include <string.h>
+
+// most file descriptors watched by lp_grid_wait
+#define LP_GRID_FDS 64
+
+struct lp_grid* lp_grid_open(int count, int columns)
+{
+    struct lp_grid* grid;
+    
+    if (count <= 0) {
+	count = lp_count();
+    }
+    if (count > LP_GRID_DEVICES) {
+	count = LP_GRID_DEVICES;
+    }
+    if (count <= 0) {
+	fprintf(stderr,"Unable to find the launchpad\n");
+	return NULL;
+    }
+    
+    // the smallest square holding them all
+    if (columns <= 0) {
+	for (columns = 1; columns * columns < count; columns++);
+    }
+    if (columns > count) {
+	columns = count;
+    }
+    
+    // the last row is padded to the full width, the cells must fit the leds
+    // the modules keep for LP_GRID_DEVICES launchpads
+    while (columns * ((count + columns - 1) / columns) > LP_GRID_DEVICES) {
+	columns--;
+    }
+    
+    grid = calloc(1, sizeof(struct lp_grid));
+    if (grid == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    grid->columns = columns;
+    grid->width = columns * LP_GRID_SIDE;
+    grid->height = (count + columns - 1) / columns * LP_GRID_SIDE;
+    pthread_mutex_init(&grid->lock, NULL);
+    
+    for (grid->count = 0; grid->count < count; grid->count++) {
+	grid->lps[grid->count] = lp_register_with(lp_default_transport(), grid->count);
+	if (grid->lps[grid->count] == NULL) {
+	    lp_grid_close(grid);
+	    return NULL;
+	}
+    }
+    
+    return grid;
+}
+
+void lp_grid_close(struct lp_grid* grid)
+{
+    int i;
+    
+    for (i = 0; i < grid->count; i++) {
+	lp_deregister(grid->lps[i]);
+    }
+    pthread_mutex_destroy(&grid->lock);
+    free(grid);
+}
+
+void lp_grid_stop(struct lp_grid* grid)
+{
+    int i;
+    
+    for (i = 0; i < grid->count; i++) {
+	lp_stop(grid->lps[i]);
+    }
+}
+
+int lp_grid_stopped(struct lp_grid* grid)
+{
+    int i;
+    
+    for (i = 0; i < grid->count; i++) {
+	if (grid->lps[i]->stopped) {
+	    return true;
+	}
+    }
+    
+    return false;
+}
+
+int lp_grid_pollfds(struct lp_grid* grid, struct pollfd* fds, int max)
+{
+    int i, j, k, n;
+    int total = 0;
+    
+    for (i = 0; i < grid->count; i++) {
+	n = lp_pollfds(grid->lps[i], fds + total, max - total);
+	
+	// launchpads sharing a usb context share its descriptors
+	for (j = total; j < total + n; j++) {
+	    for (k = 0; k < total && fds[k].fd != fds[j].fd; k++);
+	    if (k == total) {
+		fds[total++] = fds[j];
+	    }
+	}
+    }
+    
+    return total;
+}
+
+int lp_grid_handle(struct lp_grid* grid, int timeout)
+{
+    int i;
+    int err = 0;
+    
+    for (i = 0; i < grid->count; i++) {
+	err |= lp_handle(grid->lps[i], i == 0 ? timeout : 0);
+    }
+    
+    return err;
+}
+
+int lp_grid_wait(struct lp_grid* grid, int timeout)
+{
+    struct pollfd fds[LP_GRID_FDS];
+    int n = lp_grid_pollfds(grid, fds, LP_GRID_FDS);
+    
+    if (poll(fds, n, timeout) < 0) {
+	return -1;
+    }
+    
+    return lp_grid_handle(grid, 0);
+}
+
+int lp_grid_events(struct lp_grid* grid, struct lp_event* events, int max)
+{
+    int i;
+    int n = 0;
+    
+    // start with a different launchpad each time, so that none is starved
+    for (i = 0; i < grid->count && n < max; i++) {
+	n += lp_events(grid->lps[(grid->next + i) % grid->count], events + n, max - n, false);
+    }
+    grid->next = (grid->next + 1) % grid->count;
+    
+    return n;
+}
+
+int lp_grid_position(const struct lp_grid* grid, const struct lp_event* event, int* x, int* y)
+{
+    int row = event->data1 / 16;
+    int col = event->data1 % 16;
+    
+    if (event->status != NOTE || row >= LP_GRID_SIDE || col >= LP_GRID_SIDE) {
+	return false;
+    }
+    
+    *x = event->device % grid->columns * LP_GRID_SIDE + col;
+    *y = event->device / grid->columns * LP_GRID_SIDE + row;
+    return true;
+}
+
+void lp_grid_lock(struct lp_grid* grid)
+{
+    pthread_mutex_lock(&grid->lock);
+}
+
+void lp_grid_unlock(struct lp_grid* grid)
+{
+    pthread_mutex_unlock(&grid->lock);
+}
+
+int lp_grid_address(const struct lp_grid* grid, int x, int y, int* device)
+{
+    if (x < 0 || x >= grid->width || y < 0 || y >= grid->height) {
+	return -1;
+    }
+    
+    *device = y / LP_GRID_SIDE * grid->columns + x / LP_GRID_SIDE;
+    return y % LP_GRID_SIDE * 16 + x % LP_GRID_SIDE;
+}
+
+int lp_grid_send3(struct lp_grid* grid, int device, unsigned int data0, unsigned int data1, unsigned int data2)
+{
+    if (device < 0 || device >= grid->count) {
+	return 0;
+    }
+    
+    grid->staged[device] = true;
+    return lp_stage3(grid->lps[device], data0, data1, data2);
+}
+
+int lp_grid_led(struct lp_grid* grid, int x, int y, int velocity)
+{
+    int device;
+    int key = lp_grid_address(grid, x, y, &device);
+    
+    if (key < 0) {
+	return 0;
+    }
+    
+    return lp_grid_send3(grid, device, NOTE, key, velocity);
+}
+
+int lp_grid_flush(struct lp_grid* grid)
+{
+    int i;
+    int transmitted = 0;
+    
+    for (i = 0; i < grid->count; i++) {
+	// a launchpad plugged back gets its leds restored
+	if (grid->staged[i] || grid->lps[i]->restore) {
+	    transmitted += lp_flush(grid->lps[i]);
+	    // the writes held back by the rate go with the next flush
+	    grid->staged[i] = grid->lps[i]->ndirty > 0;
+	}
+    }
+    
+    return transmitted;
+}
+
+int lp_grid_backlog(struct lp_grid* grid)
+{
+    int i;
+    int backlog = 0;
+    
+    for (i = 0; i < grid->count; i++) {
+	if (grid->staged[i]) {
+	    backlog += grid->lps[i]->ndirty;
+	}
+	backlog += grid->lps[i]->restore;
+    }
+    
+    return backlog;
+}
+
+int lp_grid_timeout(struct lp_grid* grid, int max)
+{
+    int i;
+    
+    for (i = 0; i < grid->count; i++) {
+	max = lp_backlog_timeout(grid->lps[i], max);
+    }
+    
+    return max;
+}
+
+void lp_grid_dump(struct lp_grid* grid, FILE* out)
+{
+    struct launchpad* lp;
+    int i;
+    
+    fprintf(out, "%-10s %10s %10s %10s %10s %10s %12s %10s %12s\n",
+	    "launchpad", "sent", "suppressed", "coalesced", "dropped", "transfers", "backlog (ms)",
+	    "detached", "restore (ms)");
+    for (i = 0; i < grid->count; i++) {
+	lp = grid->lps[i];
+	fprintf(out, "%-10d %10lu %10lu %10lu %10lu %10lu %12.1f %10lu %12.1f%s\n", i,
+		lp->stats.sent, lp->stats.suppressed, lp->stats.coalesced,
+		lp->stats.dropped, lp->stats.transfers, lp_backlog_age(lp) / 1e6,
+		lp->stats.detached, lp->stats.restore_time / 1e6, lp->attached ? "" : " unplugged");
+    }
+    fflush(out);
+}
+
+int lp_grid_rows(struct lp_grid* grid, int y, int rows, const unsigned char* velocities)
+{
+    int x, i;
+    int staged = 0;
+    
+    for (i = 0; i < rows && y + i < grid->height; i++) {
+	for (x = 0; x < grid->width; x++) {
+	    staged += lp_grid_led(grid, x, y + i, velocities[i * grid->width + x]) > 0;
+	}
+    }
+    
+    return staged;
+}
+
+int lp_grid_frame(struct lp_grid* grid, const unsigned char* frame)
+{
+    lp_grid_rows(grid, 0, grid->height, frame);
+    return lp_grid_flush(grid);
+}
+
+int lp_grid_reset(struct lp_grid* grid)
+{
+    int i;
+    int transmitted = 0;
+    
+    for (i = 0; i < grid->count; i++) {
+	transmitted += lp_reset(grid->lps[i]);
+	grid->staged[i] = false;
+    }
+    
+    return transmitted;
+}
+
+int lp_grid_swap(struct lp_grid* grid)
+{
+    int i;
+    int transmitted = lp_grid_flush(grid);
+    
+    // the swaps follow each other closely, so that all the launchpads show
+    // their frame at once
+    for (i = 0; i < grid->count; i++) {
+	transmitted += lp_swap(grid->lps[i]);
+    }
+    
+    return transmitted;
+}
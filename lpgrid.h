@@ -0,0 +1,177 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPGRID_H
+#define LPGRID_H
+
+#include "liblaunchpad.h"
+
+// most launchpads driven at once
+#define LP_GRID_DEVICES 16
+
+// leds on each side of a launchpad's matrix
+#define LP_GRID_SIDE 8
+
+// most leds in the matrix of a grid, width * height never goes beyond
+#define LP_GRID_LEDS (LP_GRID_DEVICES * LP_GRID_SIDE * LP_GRID_SIDE)
+
+/**
+ * several launchpads, with their matrices tiled into one larger grid.
+ *
+ * the launchpads are placed in reading order, columns of them on each row.
+ * four launchpads two by two make a 16x16 grid. everything is driven from a
+ * single thread: messages are staged on each launchpad, then all of them are
+ * flushed one after the other so that their transfers are in flight at the
+ * same time. when several threads stage messages, each holds the grid's lock
+ * while it stages and flushes a batch.
+ */
+struct lp_grid {
+    struct launchpad* lps[LP_GRID_DEVICES];	//! the launchpads, in reading order
+    int count;					//! amount of launchpads
+    int columns;				//! launchpads on each row of the grid
+    int width;					//! width of the grid, in leds
+    int height;					//! height of the grid, in leds
+    int staged[LP_GRID_DEVICES];		//! whether a launchpad has messages to flush
+    int next;					//! launchpad read first by lp_grid_events
+    pthread_mutex_t lock;			//! held by a thread staging and flushing, see lp_grid_lock
+};
+
+/** open launchpads and tile them
+ *
+ * \param count amount of launchpads to open, or 0 for all the connected ones
+ * \param columns launchpads on each row of the grid, or 0 for a square grid.
+ *                lowered until the grid has no more than LP_GRID_DEVICES cells
+ * \return the grid, or NULL when a launchpad could not be opened
+ */
+struct lp_grid* lp_grid_open(int count, int columns);
+
+/** stop and close all the launchpads
+ */
+void lp_grid_close(struct lp_grid* grid);
+
+/** stop all the launchpads, from any thread
+ */
+void lp_grid_stop(struct lp_grid* grid);
+
+/** whether any of the launchpads stopped
+ */
+int lp_grid_stopped(struct lp_grid* grid);
+
+/** get the file descriptors to watch for all the launchpads, see lp_pollfds
+ */
+int lp_grid_pollfds(struct lp_grid* grid, struct pollfd* fds, int max);
+
+/** handle the events of all the launchpads, see lp_handle
+ */
+int lp_grid_handle(struct lp_grid* grid, int timeout);
+
+/** wait for data from any launchpad, up to timeout milliseconds
+ */
+int lp_grid_wait(struct lp_grid* grid, int timeout);
+
+/** get the events received by all the launchpads, without waiting
+ *
+ * each event tells the launchpad it comes from in its device field.
+ * \return the amount of events stored
+ */
+int lp_grid_events(struct lp_grid* grid, struct lp_event* events, int max);
+
+/** position of a matrix event in the grid
+ *
+ * \return true for matrix events, false for the scene and control buttons
+ */
+int lp_grid_position(const struct lp_grid* grid, const struct lp_event* event, int* x, int* y);
+
+/** start staging a batch of messages from one of several threads
+ */
+void lp_grid_lock(struct lp_grid* grid);
+
+/** done staging and flushing a batch
+ */
+void lp_grid_unlock(struct lp_grid* grid);
+
+/** launchpad and key of a position of the grid
+ *
+ * \param device where to store the launchpad's index
+ * \return the key of the led, or -1 outside of the grid
+ */
+int lp_grid_address(const struct lp_grid* grid, int x, int y, int* device);
+
+/** stage a message for one of the launchpads, see lp_stage3
+ */
+int lp_grid_send3(struct lp_grid* grid, int device, unsigned int data0, unsigned int data1, unsigned int data2);
+
+/** stage a led write at a position of the grid
+ */
+int lp_grid_led(struct lp_grid* grid, int x, int y, int velocity);
+
+/** stage led writes for whole rows of the grid
+ *
+ * \param y first row
+ * \param rows amount of rows
+ * \param velocities rows * width velocities, row after row
+ * \return the amount of leds staged
+ */
+int lp_grid_rows(struct lp_grid* grid, int y, int rows, const unsigned char* velocities);
+
+/** send the staged messages of all the launchpads
+ *
+ * led writes held back by the rate of a launchpad stay staged. the leds of
+ * a launchpad plugged back are restored, see lp_attach.
+ * \return the amount of data transmitted
+ */
+int lp_grid_flush(struct lp_grid* grid);
+
+/** amount of led writes held back by the rate of the launchpads, see
+ * lp_set_rate, plus one for each launchpad plugged back whose leds are not
+ * restored yet. they go out with the next flushes
+ */
+int lp_grid_backlog(struct lp_grid* grid);
+
+/** time until more of the writes held back can be sent, see
+ * lp_backlog_timeout
+ */
+int lp_grid_timeout(struct lp_grid* grid, int max);
+
+/** print the output counters and the backlog age of each launchpad
+ */
+void lp_grid_dump(struct lp_grid* grid, FILE* out);
+
+/** set all the leds of the grid's matrices at once
+ *
+ * \param frame width * height velocities, row after row
+ */
+int lp_grid_frame(struct lp_grid* grid, const unsigned char* frame);
+
+/** reset all the launchpads
+ */
+int lp_grid_reset(struct lp_grid* grid);
+
+/** flush, then display the hidden buffer of all the launchpads, see lp_swap
+ */
+int lp_grid_swap(struct lp_grid* grid);
+
+#endif
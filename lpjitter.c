@@ -0,0 +1,253 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * measures the jitter of the bridges under cpu load, with and without
+ * real-time mode, see lprt.h. like cyclictest, a thread wakes up at a fixed
+ * interval and records how late it woke up. it then writes a led to a
+ * simulated launchpad in loopback, as the bridges do, and records when the led
+ * comes back as a press, from the time it was due.
+ *
+ *     lpjitter [-d seconds] [-i interval in us] [-l load threads]
+ *         [-L device latency in us] [-R real-time]
+ *
+ * the load threads run through memory at the default priority, one per cpu by
+ * default. real-time mode is configured as in lposc and lpmidi, and runs with
+ * the default priority on any cpu if -R isn't given.
+ */
+
+#include "lpvirtual.h"
+#include "lpgrid.h"
+#include "lptrace.h"
+#include "lprt.h"
+#include <string.h>
+#include <unistd.h>
+
+// how long each mode is measured, in seconds
+#define JITTER_DURATION 10
+
+// time between two wake ups, in microseconds
+#define JITTER_INTERVAL 1000
+
+// memory each load thread runs through, in bytes
+#define JITTER_MEMORY (4 * 1024 * 1024)
+
+// longest wait for a led to come back, in milliseconds
+#define JITTER_TIMEOUT 100
+
+// most load threads
+#define JITTER_LOADS 256
+
+/**
+ * a measured mode
+ */
+struct jitter_run {
+    struct lp_grid* grid;		//! the simulated launchpad
+    struct lp_histogram wakeup;		//! wake up time - due time
+    struct lp_histogram roundtrip;	//! press time - due time
+    unsigned long lost;			//! leds which didn't come back in time
+};
+
+unsigned long long duration = JITTER_DURATION * 1000000000ULL;
+unsigned long long interval = JITTER_INTERVAL * 1000ULL;
+unsigned long long latency = 0;
+volatile int loading;
+
+/* keep a cpu busy, along with its caches */
+void* jitter_load(void* data)
+{
+    unsigned char* memory = data;
+    unsigned long i = 0;
+    
+    while (loading) {
+	memory[i] += i;
+	i = (i + 64) % JITTER_MEMORY;
+    }
+    
+    return NULL;
+}
+
+void jitter_sleep(unsigned long long until)
+{
+    struct timespec time;
+    
+    time.tv_sec = until / 1000000000ULL;
+    time.tv_nsec = until % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, NULL);
+}
+
+/* the measuring thread, which runs as the loop of a bridge */
+void* jitter_measure(void* data)
+{
+    struct jitter_run* run = data;
+    struct lp_event events[LP_EVENTS];
+    unsigned long long due, end, now;
+    int step, n;
+    
+    lp_rt_thread(lp_rt_input);
+    
+    due = lp_now() + interval;
+    end = due + duration;
+    for (step = 0; due < end; step++, due += interval) {
+	jitter_sleep(due);
+	now = lp_now();
+	lp_histogram_record(&run->wakeup, now - due);
+	
+	// every write changes the led, so that it is sent
+	lp_grid_lock(run->grid);
+	lp_grid_send3(run->grid, 0, NOTE, step % 64 / 8 * 16 + step % 8, step / 64 % 2 ? 0x3C : 0x0F);
+	lp_grid_flush(run->grid);
+	lp_grid_unlock(run->grid);
+	
+	n = 0;
+	while (n == 0 && lp_now() < now + JITTER_TIMEOUT * 1000000ULL) {
+	    lp_grid_wait(run->grid, JITTER_TIMEOUT);
+	    n = lp_grid_events(run->grid, events, LP_EVENTS);
+	}
+	if (n > 0) {
+	    lp_histogram_record(&run->roundtrip, lp_now() - due);
+	} else {
+	    run->lost++;
+	}
+    }
+    
+    return NULL;
+}
+
+/* measure a mode, under load */
+void jitter_run(const char* title, int loads, unsigned char** memory)
+{
+    struct jitter_run run;
+    pthread_t loaders[JITTER_LOADS];
+    pthread_t measurer;
+    int i;
+    
+    memset(&run, 0, sizeof(run));
+    run.wakeup.name = "wake up";
+    run.roundtrip.name = "end to end";
+    
+    run.grid = lp_grid_open(1, 1);
+    if (run.grid == NULL) {
+	exit(1);
+    }
+    lp_virtual_latency(run.grid->lps[0], latency);
+    lp_virtual_loopback(run.grid->lps[0], true);
+    lp_virtual_drain(run.grid->lps[0]);
+    
+    loading = true;
+    for (i = 0; i < loads; i++) {
+	if (pthread_create(&loaders[i], NULL, jitter_load, memory[i]) != 0) {
+	    fprintf(stderr, "could not start the load threads\n");
+	    exit(1);
+	}
+    }
+    if (pthread_create(&measurer, NULL, jitter_measure, &run) != 0) {
+	fprintf(stderr, "could not start the measuring thread\n");
+	exit(1);
+    }
+    pthread_join(measurer, NULL);
+    loading = false;
+    for (i = 0; i < loads; i++) {
+	pthread_join(loaders[i], NULL);
+    }
+    
+    printf("\n%s\n", title);
+    lp_histogram_header(stdout);
+    lp_histogram_print(stdout, &run.wakeup);
+    lp_histogram_print(stdout, &run.roundtrip);
+    if (run.lost > 0) {
+	printf("%lu leds did not come back\n", run.lost);
+    }
+    fflush(stdout);
+    
+    lp_grid_close(run.grid);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt, i;
+    int loads = sysconf(_SC_NPROCESSORS_ONLN);
+    char* spec = "";
+    unsigned char* memory[JITTER_LOADS];
+    
+    while ((opt = getopt(argc, argv, "d:i:l:L:R:")) != -1) {
+	switch (opt) {
+	case 'd':
+	    duration = atof(optarg) * 1000000000ULL;
+	    break;
+	case 'i':
+	    interval = atoll(optarg) * 1000;
+	    break;
+	case 'l':
+	    loads = atoi(optarg);
+	    break;
+	case 'L':
+	    latency = atoll(optarg) * 1000;
+	    break;
+	case 'R':
+	    spec = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-d seconds] [-i interval in us] [-l load threads] [-L device latency in us] [-R real-time]\n", argv[0]);
+	    return 1;
+	}
+    }
+    if (interval == 0 || loads < 0 || loads > JITTER_LOADS || lp_rt_configure(spec) != 0) {
+	fprintf(stderr, "usage: %s [-d seconds] [-i interval in us] [-l load threads] [-L device latency in us] [-R real-time]\n", argv[0]);
+	return 1;
+    }
+    
+    // the memory of the load is allocated once for both modes
+    for (i = 0; i < loads; i++) {
+	memory[i] = calloc(1, JITTER_MEMORY);
+	if (memory[i] == NULL) {
+	    fprintf(stderr,"Unable to allocate memory\n");
+	    return 1;
+	}
+    }
+    
+    setenv("LP_TRANSPORT", lp_virtual.name, 1);
+    setenv("LP_DEVICES", "1", 1);
+    printf("%d load threads, wake ups %llu us apart for %g s, device latency %llu us\n",
+	   loads, interval / 1000, duration / 1e9, latency / 1000);
+    
+    // the spec was checked with the options, real-time mode stays off for the
+    // first run
+    lp_rt_stop();
+    jitter_run("default scheduling", loads, memory);
+    
+    lp_rt_configure(spec);
+    lp_rt_start();
+    jitter_run("real-time mode", loads, memory);
+    lp_rt_dump(stdout);
+    lp_rt_stop();
+    
+    for (i = 0; i < loads; i++) {
+	free(memory[i]);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,353 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lplog.h"
+#include "liblaunchpad.h"
+#include <stdarg.h>
+#include <string.h>
+
+#define NS 1000000000ULL
+
+enum lp_log_level lp_log_threshold = lp_log_warning;
+
+static const char* lp_log_names[] = { "error", "warning", "info", "debug" };
+
+// the rings of the threads which logged, and the logging thread
+static struct lp_log_ring* log_rings[LP_LOG_THREADS];
+static int log_count = 0;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_stopped = PTHREAD_COND_INITIALIZER;
+static pthread_t log_thread;
+static int log_running = false;
+static FILE* log_out = NULL;
+
+// ring of the calling thread
+static __thread struct lp_log_ring* log_ring = NULL;
+static __thread int log_refused = false;
+
+/* the ring of the calling thread, registered on its first record. NULL when
+ * there are too many threads */
+static struct lp_log_ring* lp_log_ring()
+{
+    if (log_ring != NULL || log_refused) {
+	return log_ring;
+    }
+    
+    pthread_mutex_lock(&log_lock);
+    if (log_count < LP_LOG_THREADS) {
+	log_ring = calloc(1, sizeof(struct lp_log_ring));
+    }
+    if (log_ring != NULL) {
+	log_rings[log_count++] = log_ring;
+    }
+    pthread_mutex_unlock(&log_lock);
+    
+    log_refused = log_ring == NULL;
+    return log_ring;
+}
+
+/* store the arguments of a message, following its format */
+static void lp_log_capture(struct lp_log_record* record, const char* format, va_list ap)
+{
+    const char* c = format;
+    const char* s;
+    int n = 0, text = 0, longs, length;
+    
+    // the arguments are only known up to the first conversion not handled
+    record->count = 0;
+    while ((c = strchr(c, '%')) != NULL && n < LP_LOG_ARGS) {
+	c++;
+	if (*c == '%') {
+	    c++;
+	    continue;
+	}
+	
+	// flags, width, precision and size
+	longs = 0;
+	for (; *c && strchr("-+ #0123456789.hlz", *c); c++) {
+	    longs += *c == 'l' || *c == 'z';
+	}
+	
+	switch (*c) {
+	case 'd':
+	case 'i':
+	case 'c':
+	    record->args[n++].i = longs > 1 ? va_arg(ap, long long) : longs ? va_arg(ap, long) : va_arg(ap, int);
+	    break;
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	    record->args[n++].i = longs > 1 ? va_arg(ap, unsigned long long)
+		: longs ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+	    break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'g':
+	case 'G':
+	    record->args[n++].f = va_arg(ap, double);
+	    break;
+	case 'p':
+	    record->args[n++].p = va_arg(ap, void*);
+	    break;
+	case 's':
+	    s = va_arg(ap, const char*);
+	    length = strnlen(s, LP_LOG_TEXT - 1 - text);
+	    memcpy(record->text + text, s, length);
+	    record->text[text + length] = 0;
+	    record->args[n++].s = text;
+	    text += length < LP_LOG_TEXT - 1 - text ? length + 1 : length;
+	    break;
+	default:
+	    return;
+	}
+	record->count = n;
+	c++;
+    }
+}
+
+/* format a record */
+static void lp_log_write(FILE* out, const struct lp_log_record* record)
+{
+    const char* c = record->format;
+    const char* start;
+    char spec[16];
+    int n = 0, length;
+    
+    fprintf(out, "%llu.%06llu %s: ", record->time / NS, record->time % NS / 1000, lp_log_names[record->level]);
+    while (*c) {
+	start = strchr(c, '%');
+	if (start == NULL) {
+	    fputs(c, out);
+	    break;
+	}
+	fwrite(c, 1, start - c, out);
+	c = start + 1;
+	if (*c == '%') {
+	    fputc('%', out);
+	    c++;
+	    continue;
+	}
+	
+	// the flags, width and precision as they are, the size of the argument
+	// as it was stored
+	length = 1;
+	spec[0] = '%';
+	for (; *c && strchr("-+ #0123456789.hlz", *c); c++) {
+	    if (!strchr("hlz", *c) && length < sizeof(spec) - 4) {
+		spec[length++] = *c;
+	    }
+	}
+	if (*c == 0 || n == record->count) {
+	    break;
+	}
+	if (strchr("diuxXo", *c)) {
+	    spec[length++] = 'l';
+	    spec[length++] = 'l';
+	}
+	spec[length++] = *c;
+	spec[length] = 0;
+	
+	switch (*c) {
+	case 'd':
+	case 'i':
+	    fprintf(out, spec, record->args[n].i);
+	    break;
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	    fprintf(out, spec, (unsigned long long) record->args[n].i);
+	    break;
+	case 'c':
+	    fprintf(out, spec, (int) record->args[n].i);
+	    break;
+	case 'p':
+	    fprintf(out, spec, record->args[n].p);
+	    break;
+	case 's':
+	    fprintf(out, spec, record->text + record->args[n].s);
+	    break;
+	default:
+	    fprintf(out, spec, record->args[n].f);
+	    break;
+	}
+	n++;
+	c++;
+    }
+    fputc('\n', out);
+}
+
+/* write out the records of all the threads in the order they were logged.
+ * returns the amount written */
+static int lp_log_drain(FILE* out)
+{
+    struct lp_log_ring* ring;
+    struct lp_log_ring* oldest;
+    struct lp_log_record* record;
+    unsigned long tails[LP_LOG_THREADS];
+    unsigned long dropped;
+    int i, count, written = 0;
+    
+    pthread_mutex_lock(&log_lock);
+    count = log_count;
+    pthread_mutex_unlock(&log_lock);
+    
+    // the records logged so far
+    for (i = 0; i < count; i++) {
+	tails[i] = __atomic_load_n(&log_rings[i]->tail, __ATOMIC_ACQUIRE);
+    }
+    
+    for (;;) {
+	oldest = NULL;
+	for (i = 0; i < count; i++) {
+	    ring = log_rings[i];
+	    if (ring->head != tails[i] && (oldest == NULL
+		|| ring->records[ring->head % LP_LOG_RECORDS].time < oldest->records[oldest->head % LP_LOG_RECORDS].time)) {
+		oldest = ring;
+	    }
+	}
+	if (oldest == NULL) {
+	    break;
+	}
+	
+	record = &oldest->records[oldest->head % LP_LOG_RECORDS];
+	lp_log_write(out, record);
+	__atomic_store_n(&oldest->head, oldest->head + 1, __ATOMIC_RELEASE);
+	written++;
+    }
+    
+    for (i = 0; i < count; i++) {
+	dropped = __atomic_load_n(&log_rings[i]->dropped, __ATOMIC_RELAXED);
+	if (dropped != log_rings[i]->reported) {
+	    fprintf(out, "warning: %lu messages dropped\n", dropped - log_rings[i]->reported);
+	    log_rings[i]->reported = dropped;
+	    written++;
+	}
+    }
+    
+    if (written > 0) {
+	fflush(out);
+    }
+    return written;
+}
+
+/* the logging thread: write out the records every LP_LOG_PERIOD ms */
+static void* lp_log_run(void* data)
+{
+    struct timespec until;
+    
+    pthread_mutex_lock(&log_lock);
+    while (log_running) {
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_nsec += LP_LOG_PERIOD * 1000000L;
+	if (until.tv_nsec >= NS) {
+	    until.tv_sec++;
+	    until.tv_nsec -= NS;
+	}
+	pthread_cond_timedwait(&log_stopped, &log_lock, &until);
+	
+	pthread_mutex_unlock(&log_lock);
+	lp_log_drain(log_out);
+	pthread_mutex_lock(&log_lock);
+    }
+    pthread_mutex_unlock(&log_lock);
+    
+    // what was logged while stopping
+    lp_log_drain(log_out);
+    return NULL;
+}
+
+int lp_log_start(FILE* out, enum lp_log_level threshold)
+{
+    int err;
+    
+    lp_log_threshold = threshold;
+    log_out = out;
+    __atomic_store_n(&log_running, true, __ATOMIC_RELEASE);
+    
+    err = pthread_create(&log_thread, NULL, lp_log_run, NULL);
+    if (err) {
+	fprintf(stderr, "failed to start the logging thread, with error %d\n", err);
+	log_running = false;
+    }
+    return err;
+}
+
+void lp_log_stop()
+{
+    pthread_mutex_lock(&log_lock);
+    if (!log_running) {
+	pthread_mutex_unlock(&log_lock);
+	return;
+    }
+    __atomic_store_n(&log_running, false, __ATOMIC_RELEASE);
+    pthread_cond_signal(&log_stopped);
+    pthread_mutex_unlock(&log_lock);
+    
+    pthread_join(log_thread, NULL);
+}
+
+void lp_log(enum lp_log_level level, const char* format, ...)
+{
+    struct lp_log_ring* ring = NULL;
+    struct lp_log_record* record;
+    struct lp_log_record direct;
+    unsigned long tail = 0;
+    va_list ap;
+    
+    if (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+	ring = lp_log_ring();
+    }
+    if (ring == NULL) {
+	// no logging thread, written right away
+	record = &direct;
+    } else {
+	tail = ring->tail;
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == LP_LOG_RECORDS) {
+	    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+	    return;
+	}
+	record = &ring->records[tail % LP_LOG_RECORDS];
+    }
+    
+    record->time = lp_now();
+    record->level = level;
+    record->format = format;
+    va_start(ap, format);
+    lp_log_capture(record, format, ap);
+    va_end(ap);
+    
+    if (record == &direct) {
+	pthread_mutex_lock(&log_lock);
+	lp_log_write(log_out != NULL ? log_out : stderr, record);
+	fflush(log_out != NULL ? log_out : stderr);
+	pthread_mutex_unlock(&log_lock);
+	return;
+    }
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,122 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPLOG_H
+#define LPLOG_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+// records each thread can have waiting, a power of two
+#define LP_LOG_RECORDS 1024
+
+// most arguments of a record
+#define LP_LOG_ARGS 8
+
+// room for the strings of a record, copied as they are when logged
+#define LP_LOG_TEXT 64
+
+// most threads logging
+#define LP_LOG_THREADS 32
+
+// time between two writes of the records, in milliseconds
+#define LP_LOG_PERIOD 20
+
+/**
+ * how important a record is
+ */
+enum lp_log_level {
+    lp_log_error,	//! something failed
+    lp_log_warning,	//! something was refused or lost
+    lp_log_info,	//! what the program does
+    lp_log_debug	//! every message
+};
+
+/**
+ * an argument of a record
+ */
+union lp_log_arg {
+    long long i;	//! any integer
+    double f;		//! any floating point number
+    const void* p;	//! a pointer
+    int s;		//! a string, as an offset in the text of the record
+};
+
+/**
+ * a record: the format and arguments of a message, formatted later by the
+ * logging thread. the format has to stay valid, like a string literal
+ */
+struct lp_log_record {
+    unsigned long long time;			//! when it was logged, see lp_now
+    enum lp_log_level level;			//! how important it is
+    const char* format;				//! printf format
+    union lp_log_arg args[LP_LOG_ARGS];		//! the arguments
+    int count;					//! amount of arguments, the format is written up to the next one
+    char text[LP_LOG_TEXT];			//! the strings given as arguments
+};
+
+/**
+ * the records of a thread, in a single producer single consumer ring
+ */
+struct lp_log_ring {
+    struct lp_log_record records[LP_LOG_RECORDS];	//! the records
+    unsigned long head;					//! next record to write out, only moved by the logging thread
+    unsigned long tail;					//! next record to fill, only moved by the thread
+    unsigned long dropped;				//! records dropped because the ring was full
+    unsigned long reported;				//! dropped records already reported
+};
+
+// records below this level are logged
+extern enum lp_log_level lp_log_threshold;
+
+/** log a message, when its level is logged
+ *
+ * logging never waits: the record is copied to the ring of the thread, or
+ * dropped when it is full. the format is scanned for the types of the
+ * arguments, which may be %d, %i, %u, %x, %X, %o and %c with the h, l, ll
+ * and z modifiers, %e, %f and %g, %p and %s, with flags, width and precision
+ * but no *. strings are cut to fit in the record.
+ */
+#define LP_LOG(level, ...) do { if ((level) <= lp_log_threshold) lp_log((level), __VA_ARGS__); } while (0)
+
+/** start the logging thread
+ *
+ * until it starts, and once it stops, messages are written right away.
+ * \param out where to write the messages
+ * \param threshold most verbose level logged
+ * \return 0, or the error from pthread_create
+ */
+int lp_log_start(FILE* out, enum lp_log_level threshold);
+
+/** write the remaining records, and stop the logging thread
+ */
+void lp_log_stop();
+
+/** log a message, see LP_LOG
+ */
+void lp_log(enum lp_log_level level, const char* format, ...);
+
+#endif
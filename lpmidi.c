@@ -24,17 +24,58 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "liblaunchpad.h"
+#include "lpgrid.h"
+#include "lptrace.h"
+#include "lpanim.h"
+#include "lpdither.h"
+#include "lpreflex.h"
+#include "lpgesture.h"
+#include "lpshm.h"
+#include "lpring.h"
+#include "lpcapture.h"
+#include "lprt.h"
 #include <alsa/asoundlib.h>
 #include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
-// globals
-struct launchpad* lp;
+// how long the launchpad thread waits before checking whether to stop, in ms
+#define LOOP_TIMEOUT 100
+
+// most file descriptors watched by the single loop
+#define MAX_FDS 32
+
+// most traced events waiting for the midi output to be drained
+#define MAX_TRACED (4 * LP_EVENTS)
+
+// controllers of the gestures, on the channel of the launchpad of the pad.
+// their value is the note of the pad. a chord is its amount of pads, then
+// each pad, and a swipe its first pad then its last
+#define GESTURE_LONG 20
+#define GESTURE_DOUBLE 21
+#define GESTURE_CHORD 22
+#define GESTURE_CHORD_PAD 23
+#define GESTURE_SWIPE_FIRST 24
+#define GESTURE_SWIPE_LAST 25
+
+// globals. the midi channel of an event is the index of its launchpad
+struct lp_grid* grid;
+struct lp_anim* anim;
+struct lp_dither* dither;
+struct lp_reflex* reflex;
+struct lp_gestures* gestures;
+struct lp_shm* shm;
+struct lp_ring* ring;
 snd_seq_t* midi_client;
 
 int midi_in;
 int midi_out;
 
+// the traced events sent since the last drain, see lp2midi_drain
+struct lp_event traced[MAX_TRACED];
+int ntraced = 0;
+
 void midi_register()
 {
     //open a new alsa midi client
@@ -71,93 +112,455 @@ void midi_deregister()
     snd_seq_close(midi_client);
 }
 
-void* lp2midi(void* nothing)
+/* send a controller event for a pad of the grid */
+void midi_gesture(int param, int x, int y, int value)
 {
-    printf("waiting for launchpad events\n");
 	snd_seq_event_t event;
-    
-    while (1) {
-		// wait for an event
-		lp_receive(lp);
+	int device;
+	int key = lp_grid_address(grid, x, y, &device);
+	
+	if (key < 0) {
+		return;
+	}
+	
+	snd_seq_ev_clear(&event);
+	snd_seq_ev_set_source(&event, midi_out);
+	snd_seq_ev_set_subs(&event);
+	snd_seq_ev_set_controller(&event, device, param, value < 0 ? key : value);
+	snd_seq_ev_set_direct(&event);
+	snd_seq_event_output(midi_client, &event);
+}
 
+/* send the gestures detected, returning how many */
+int midi_gestures()
+{
+	struct lp_gesture detected[LP_GESTURE_QUEUE];
+	int i, j, n;
+	
+	n = lp_gestures_read(gestures, detected, LP_GESTURE_QUEUE);
+	for (i = 0; i < n; i++) {
+		switch (detected[i].kind) {
+		case lp_gesture_long:
+			midi_gesture(GESTURE_LONG, detected[i].x, detected[i].y, -1);
+			break;
+		case lp_gesture_double:
+			midi_gesture(GESTURE_DOUBLE, detected[i].x, detected[i].y, -1);
+			break;
+		case lp_gesture_chord:
+			midi_gesture(GESTURE_CHORD, detected[i].x, detected[i].y, detected[i].count);
+			for (j = 0; j < detected[i].count; j++) {
+				midi_gesture(GESTURE_CHORD_PAD, detected[i].xs[j], detected[i].ys[j], -1);
+			}
+			break;
+		case lp_gesture_swipe:
+			midi_gesture(GESTURE_SWIPE_FIRST, detected[i].x, detected[i].y, -1);
+			midi_gesture(GESTURE_SWIPE_LAST, detected[i].x + detected[i].dx * (detected[i].count - 1),
+				     detected[i].y + detected[i].dy * (detected[i].count - 1), -1);
+			break;
+		}
+	}
+	
+	return n;
+}
+
+/* drain the midi output, then record the latency of the traced events it
+ * sent: they are emitted once the drain returns */
+void lp2midi_drain()
+{
+	unsigned long long emitted;
+	int i;
+	
+	snd_seq_drain_output(midi_client);
+	
+	emitted = lp_now();
+	for (i = 0; i < ntraced; i++) {
+		lp_trace(&traced[i], emitted);
+	}
+	ntraced = 0;
+}
+
+/* send the events received from the launchpads to the midi port. the output
+ * is only drained by the caller, once for the whole batch, unless too many
+ * traced events wait for it */
+int lp2midi_events()
+{
+	snd_seq_event_t event;
+	struct lp_event events[LP_EVENTS];
+	int i, n;
+	
+	n = lp_grid_events(grid, events, LP_EVENTS);
+	if (ntraced + n > MAX_TRACED) {
+		lp2midi_drain();
+	}
+	
+	// local feedback first, in one write
+	lp_grid_lock(grid);
+	if (lp_reflex_apply(reflex, events, n) > 0) {
+		lp_grid_flush(grid);
+	}
+	lp_grid_unlock(grid);
+	
+	// local readers next
+	if (ring != NULL) {
+		lp_ring_publish(ring, events, n);
+	}
+	
+	for (i = 0; i < n; i++) {
 		// setup
 		snd_seq_ev_clear(&event);
 		snd_seq_ev_set_source(&event, midi_out);	// set the output port number
 		snd_seq_ev_set_subs(&event);		// broadcast to subscribers
 		
 		// fill the event
-		switch(lp->event[0]) {
+		switch(events[i].status) {
 		case NOTE:
-			snd_seq_ev_set_noteon(&event, 0, lp->event[1], lp->event[2]);
+			snd_seq_ev_set_noteon(&event, events[i].device, events[i].data1, events[i].data2);
 			break;
 		case CTRL:
-			snd_seq_ev_set_controller(&event, 0, lp->event[1], lp->event[2]);
+			snd_seq_ev_set_controller(&event, events[i].device, events[i].data1, events[i].data2);
 			break;
+		default:
+			continue;
 		}
 		
 		// send now
 		snd_seq_ev_set_direct(&event);		
 		snd_seq_event_output(midi_client, &event);
-		snd_seq_drain_output(midi_client);
+	}
+	
+	for (i = 0; i < n; i++) {
+		if (grid->lps[events[i].device]->tracing) {
+			traced[ntraced++] = events[i];
+		}
+	}
+	
+	// then the gestures they complete, and those completed by time alone
+	lp_gestures_feed(gestures, events, n);
+	lp_gestures_advance(gestures, lp_now());
+	return n + midi_gestures();
+}
+
+/* stage a midi event for the launchpads */
+void midi_stage(snd_seq_event_t *ev)
+{
+    // copy the data to send
+    switch (ev->type) {
+	
+    case SND_SEQ_EVENT_NOTEON:
+	lp_grid_send3(grid, ev->data.note.channel, NOTE_ON, ev->data.note.note, ev->data.note.velocity);
+	break;
+	
+    case SND_SEQ_EVENT_NOTEOFF:
+	lp_grid_send3(grid, ev->data.note.channel, NOTE_OFF, ev->data.note.note, ev->data.note.velocity);
+	break;
+	
+    case SND_SEQ_EVENT_CONTROLLER:
+	lp_grid_send3(grid, ev->data.control.channel, CTRL, ev->data.control.param, ev->data.control.value);
+	break;
+	
+    case SND_SEQ_EVENT_PGMCHANGE:
+	// commit the frame drawn so far, on all the launchpads
+	lp_grid_swap(grid);
+	break;
+	
+    case SND_SEQ_EVENT_SYSEX:
+	// starts or stops an animation, or dithers leds, see lp_anim_sysex
+	if (lp_anim_sysex(anim, ev->data.ext.ptr, ev->data.ext.len) < 0) {
+	    lp_dither_sysex(dither, ev->data.ext.ptr, ev->data.ext.len);
+	}
+	break;
     }
+    
+    // free the midi event
+    snd_seq_free_event(ev);
+}
+
+void* lp2midi(void* nothing)
+{
+    printf("waiting for launchpad events\n");
+    lp_rt_thread(lp_rt_input);
+    
+    // wait for events from any launchpad. all the events received are handled
+    // at once
+    while (!lp_grid_stopped(grid)) {
+	lp_grid_wait(grid, lp_grid_timeout(grid, lp_gestures_timeout(gestures, LOOP_TIMEOUT)));
+	
+	// the midi thread only wakes up for midi events, the writes held back
+	// by the rate are sent from here
+	if (lp_grid_backlog(grid) > 0) {
+	    lp_grid_lock(grid);
+	    lp_grid_flush(grid);
+	    lp_grid_unlock(grid);
+	}
+	
+	if (lp2midi_events() > 0) {
+		lp2midi_drain();
+	}
+    }
+    
+    return NULL;
 }
 
 void* midi2lp(void* nothing)
 {
-    printf("waiting for midi events\n");
+    struct pollfd fds[MAX_FDS];
     snd_seq_event_t *ev;
-    while (1) {
+    int n;
+    
+    printf("waiting for midi events\n");
+    lp_rt_thread(lp_rt_input);
+    n = snd_seq_poll_descriptors(midi_client, fds, MAX_FDS, POLLIN);
+    
+    // wait for midi events, checking now and then whether to stop. the thread
+    // is never cancelled, as it might hold the grid lock
+    while (!lp_grid_stopped(grid)) {
+	if (poll(fds, n, LOOP_TIMEOUT) <= 0) {
+	    continue;
+	}
 	
-	// get a new event. if there aren't any, wait for one
-	snd_seq_event_input(midi_client, &ev);
+	// get a new event, which poll said is there
+	if (snd_seq_event_input(midi_client, &ev) < 0) {
+	    continue;
+	}
+	
+	// stage the events read along with it, then flush all the launchpads.
+	// the animations stage on the grid too
+	lp_grid_lock(grid);
+	do {
+	    midi_stage(ev);
+	} while (snd_seq_event_input_pending(midi_client, 0) > 0
+		 && snd_seq_event_input(midi_client, &ev) >= 0);
+	
+	lp_grid_flush(grid);
+	lp_grid_unlock(grid);
+    }
+    
+    return NULL;
+}
 
-	// copy the data to send
-	switch (ev->type) {
-	    
-	case SND_SEQ_EVENT_NOTEON:
-	    lp_send3(lp, NOTE_ON, ev->data.note.note, ev->data.note.velocity);
-	    break;
-	    
-	case SND_SEQ_EVENT_NOTEOFF:
-	    lp_send3(lp, NOTE_OFF, ev->data.note.note, ev->data.note.velocity);
-	    break;
-	    
-	case SND_SEQ_EVENT_CONTROLLER:
-	    lp_send3(lp, CTRL, ev->data.control.param, ev->data.control.value);
-	    break;
+/* run the whole bridge in a single thread, polling the midi client, the
+ * launchpads and the signals */
+void bridge_loop(sigset_t *signals)
+{
+    struct pollfd fds[MAX_FDS];
+    struct signalfd_siginfo info;
+    snd_seq_event_t *ev;
+    int signal_fd, midi_fds, n, i;
+    int running = true;
+    
+    printf("waiting for launchpad and midi events\n");
+    lp_rt_thread(lp_rt_input);
+    snd_seq_nonblock(midi_client, 1);
+    signal_fd = signalfd(-1, signals, SFD_NONBLOCK);
+    
+    while (running && !lp_grid_stopped(grid)) {
+	fds[0].fd = signal_fd;
+	fds[0].events = POLLIN;
+	midi_fds = snd_seq_poll_descriptors(midi_client, fds + 1, MAX_FDS - 1, POLLIN);
+	n = 1 + midi_fds;
+	n += lp_grid_pollfds(grid, fds + n, MAX_FDS - n);
+	
+	if (poll(fds, n, lp_grid_timeout(grid, lp_gestures_timeout(gestures, LOOP_TIMEOUT))) < 0) {
+	    continue;
+	}
+	
+	// dump the latencies on SIGUSR1, stop on the others
+	while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+	    if (info.ssi_signo == SIGUSR1) {
+		lp_trace_dump(stderr);
+		lp_trace_write();
+		lp_grid_dump(grid, stderr);
+		lp_rt_dump(stderr);
+	    } else {
+		running = false;
+	    }
 	}
 	
-	// free the midi event
-	snd_seq_free_event(ev);
+	// midi to launchpad: the whole burst goes out in as few transfers as
+	// possible, along with the writes held back by the rate
+	for (i = 1; i <= midi_fds && !(fds[i].revents & POLLIN); i++);
+	if (i <= midi_fds || lp_grid_backlog(grid) > 0) {
+	    lp_grid_lock(grid);
+	    while (i <= midi_fds && snd_seq_event_input(midi_client, &ev) >= 0) {
+		midi_stage(ev);
+	    }
+	    lp_grid_flush(grid);
+	    lp_grid_unlock(grid);
+	}
+	
+	// launchpad to midi, drained once per loop
+	lp_grid_handle(grid, 0);
+	n = 0;
+	while ((i = lp2midi_events()) > 0) {
+	    n += i;
+	}
+	if (n > 0) {
+	    lp2midi_drain();
+	}
     }
+    
+    close(signal_fd);
 }
 
 int main(int argc, char* argv[])
 {
-    int err;
+    int err, opt, sig, i;
+    int devices = 1;
+    int tracing = false;
+    int single = false;
+    char *chrome = NULL;
+    char *capture = NULL;
+    char *rules = NULL;
+    char *frame = NULL;
+    char *input = NULL;
+    struct lp_gesture_config thresholds;
+    sigset_t signals;
     pthread_t lp2midi_thread, midi2lp_thread;
     
-    lp = lp_register();
-    midi_register();
+    lp_gestures_defaults(&thresholds);
+    while ((opt = getopt(argc, argv, "tc:C:d:er:g:s:i:R:")) != -1) {
+	switch (opt) {
+	case 't':
+	    tracing = true;
+	    break;
+	case 'c':
+	    tracing = true;
+	    chrome = optarg;
+	    break;
+	case 'C':
+	    capture = optarg;
+	    break;
+	case 'd':
+	    devices = atoi(optarg);
+	    break;
+	case 'e':
+	    single = true;
+	    break;
+	case 'r':
+	    rules = optarg;
+	    break;
+	case 's':
+	    frame = optarg;
+	    break;
+	case 'i':
+	    input = optarg;
+	    break;
+	case 'g':
+	    if (lp_gestures_configure(&thresholds, optarg) == 0)
+		break;
+	    fprintf(stderr, "unknown gesture threshold in %s\n", optarg);
+	    return 1;
+	case 'R':
+	    if (lp_rt_configure(optarg) == 0)
+		break;
+	    fprintf(stderr, "unknown real-time setting in %s\n", optarg);
+	    return 1;
+	default:
+	    fprintf(stderr, "usage: %s [-t] [-c trace.json] [-C capture] [-d devices] [-e] [-r rules] [-g thresholds] [-s shm] [-i ring] [-R real-time]\n", argv[0]);
+	    return 1;
+	}
+    }
+    
+    // signals are handled by the main thread only
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
     
-    // start listening to the launchpad
-    err = pthread_create(&lp2midi_thread, NULL, lp2midi, NULL);
-    if (err){
-	fprintf(stderr, "failed to start usb thread with error %d", err);
-	return 0;
+    // memory is locked before the threads and the buffers are allocated, so
+    // that none of them faults once running
+    lp_rt_start();
+    
+    // the midi thread flushes the leds drawn by each batch of midi events, so
+    // no writer thread is needed
+    grid = lp_grid_open(devices, 0);
+    if (grid == NULL) {
+	return 1;
+    }
+    for (i = 0; i < grid->count && tracing; i++) {
+	lp_trace_start(grid->lps[i], chrome);
+    }
+    for (i = 0; i < grid->count && capture != NULL; i++) {
+	if (lp_capture_start(grid->lps[i], capture) < 0) {
+	    return 1;
+	}
+    }
+    anim = lp_anim_start(grid, LP_ANIM_RATE);
+    if (anim == NULL) {
+	return 1;
     }
+    dither = lp_dither_start(grid, LP_DITHER_RATE);
+    if (dither == NULL) {
+	return 1;
+    }
+    reflex = lp_reflex_new(grid);
+    if (reflex == NULL || (rules != NULL && lp_reflex_load(reflex, rules) < 0)) {
+	return 1;
+    }
+    gestures = lp_gestures_new(grid, &thresholds);
+    if (gestures == NULL) {
+	return 1;
+    }
+    if (frame != NULL && (shm = lp_shm_serve(grid, frame)) == NULL) {
+	return 1;
+    }
+    if (input != NULL && (ring = lp_ring_create(input)) == NULL) {
+	return 1;
+    }
+    midi_register();
     
-    // start listening to the midi port
-    err = pthread_create(&midi2lp_thread, NULL, midi2lp, NULL);
-    if (err){
-	fprintf(stderr, "failed to start midi thread with error %d", err);
-	return 0;
+    if (single) {
+	bridge_loop(&signals);
+    } else {
+	// start listening to the launchpad
+	err = pthread_create(&lp2midi_thread, NULL, lp2midi, NULL);
+	if (err){
+	    fprintf(stderr, "failed to start usb thread with error %d", err);
+	    return 0;
+	}
+	
+	// start listening to the midi port
+	err = pthread_create(&midi2lp_thread, NULL, midi2lp, NULL);
+	if (err){
+	    fprintf(stderr, "failed to start midi thread with error %d", err);
+	    return 0;
+	}
+	
+	// dump the latencies on SIGUSR1, until asked to stop
+	while (sigwait(&signals, &sig) == 0 && sig == SIGUSR1) {
+	    lp_trace_dump(stderr);
+	    lp_trace_write();
+	    lp_grid_dump(grid, stderr);
+	    lp_rt_dump(stderr);
+	}
+	
+	// wait for the threads to finish
+	lp_grid_stop(grid);
+	pthread_join(lp2midi_thread, NULL);
+	pthread_join(midi2lp_thread, NULL);
     }
     
-    // wait for the threads to finish
-    pthread_join(lp2midi_thread, NULL);
-    pthread_join(midi2lp_thread, NULL);
+    if (tracing) {
+	lp_trace_dump(stderr);
+	lp_trace_write();
+	lp_grid_dump(grid, stderr);
+	lp_rt_dump(stderr);
+    }
     
     midi_deregister();
-    lp_deregister(lp);
+    if (shm != NULL) {
+	lp_shm_stop(shm);
+    }
+    if (ring != NULL) {
+	lp_ring_close(ring);
+    }
+    lp_dither_stop(dither);
+    lp_anim_stop(anim);
+    lp_reflex_free(reflex);
+    lp_gestures_free(gestures);
+    lp_grid_close(grid);
+    lp_capture_stop();
+    lp_rt_stop();
+    return 0;
 }
@@ -0,0 +1,476 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpnet.h"
+#include "lplog.h"
+#include "liblaunchpad.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+static const char* lp_net_names[] = { "udp", "unix", "tcp", "slip" };
+
+/* split a spec into its kind, address and buffer size, 0 when not given */
+static int lp_net_parse(const char* spec, enum lp_net_kind* kind, char* address, int* bytes)
+{
+    const char* colon = strchr(spec, ':');
+    const char* comma;
+    int i, length;
+    
+    for (i = 0; colon != NULL && i < 4; i++) {
+	if (strlen(lp_net_names[i]) == colon - spec && strncmp(spec, lp_net_names[i], colon - spec) == 0)
+	    break;
+    }
+    if (colon == NULL || i == 4) {
+	fprintf(stderr, "unknown socket %s, expected udp:port, unix:path, tcp:port or slip:port\n", spec);
+	return -1;
+    }
+    *kind = i;
+    
+    comma = strrchr(colon + 1, ',');
+    length = comma == NULL ? strlen(colon + 1) : comma - colon - 1;
+    *bytes = comma == NULL ? 0 : atoi(comma + 1);
+    if (length == 0 || length >= sizeof(((struct lp_net*) NULL)->address)) {
+	fprintf(stderr, "wrong address in %s\n", spec);
+	return -1;
+    }
+    memcpy(address, colon + 1, length);
+    address[length] = 0;
+    return 0;
+}
+
+/* resolve host:port or port, on host when there is none */
+static struct addrinfo* lp_net_resolve(const char* address, const char* host, int type, int flags)
+{
+    struct addrinfo hints, *found;
+    char copy[108];
+    char* port;
+    int err;
+    
+    strcpy(copy, address);
+    port = strrchr(copy, ':');
+    if (port != NULL) {
+	*port++ = 0;
+	host = copy;
+    } else {
+	port = copy;
+    }
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = type;
+    hints.ai_flags = flags;
+    err = getaddrinfo(host, port, &hints, &found);
+    if (err != 0) {
+	fprintf(stderr, "could not resolve %s: %s\n", address, gai_strerror(err));
+	return NULL;
+    }
+    return found;
+}
+
+/* set both socket buffers, when a size is given */
+static void lp_net_buffers(int fd, int bytes)
+{
+    if (bytes > 0) {
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+    }
+}
+
+/* the address of a unix socket, or -1 when the path does not fit in it */
+static int lp_net_unix_address(struct sockaddr_un* address, const char* path)
+{
+    size_t length = strlen(path);
+    
+    if (length >= sizeof(address->sun_path)) {
+	fprintf(stderr, "the path %s is too long for a unix socket\n", path);
+	return -1;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    memcpy(address->sun_path, path, length + 1);
+    return 0;
+}
+
+struct lp_net* lp_net_listen(const char* spec, lp_net_handler handler, void* data)
+{
+    struct lp_net* net;
+    struct sockaddr_un local;
+    struct addrinfo* found;
+    int bytes, type, on = 1;
+    
+    net = calloc(1, sizeof(struct lp_net));
+    if (net == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    net->handler = handler;
+    net->data = data;
+    net->fd = -1;
+    if (lp_net_parse(spec, &net->kind, net->address, &bytes) < 0) {
+	free(net);
+	return NULL;
+    }
+    
+    if (net->kind == lp_net_unix) {
+	// a socket left by a previous run would make bind fail
+	if (lp_net_unix_address(&local, net->address) < 0) {
+	    free(net);
+	    return NULL;
+	}
+	unlink(net->address);
+	net->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	lp_net_buffers(net->fd, bytes);
+	if (net->fd < 0 || bind(net->fd, (struct sockaddr*) &local, sizeof(local)) < 0) {
+	    fprintf(stderr, "could not bind the unix socket %s: %s\n", net->address, strerror(errno));
+	    lp_net_close(net);
+	    return NULL;
+	}
+	return net;
+    }
+    
+    // the buffers of a listening socket are those of its connections
+    type = net->kind == lp_net_udp ? SOCK_DGRAM : SOCK_STREAM;
+    found = lp_net_resolve(net->address, NULL, type, AI_PASSIVE);
+    if (found == NULL) {
+	lp_net_close(net);
+	return NULL;
+    }
+    net->fd = socket(found->ai_family, type | SOCK_NONBLOCK, 0);
+    setsockopt(net->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    lp_net_buffers(net->fd, bytes);
+    if (net->fd < 0 || bind(net->fd, found->ai_addr, found->ai_addrlen) < 0
+	|| (type == SOCK_STREAM && listen(net->fd, LP_NET_CLIENTS) < 0)) {
+	fprintf(stderr, "could not listen on %s: %s\n", net->address, strerror(errno));
+	freeaddrinfo(found);
+	lp_net_close(net);
+	return NULL;
+    }
+    freeaddrinfo(found);
+    return net;
+}
+
+static void lp_net_drop(struct lp_net* net, int i)
+{
+    close(net->clients[i]->fd);
+    free(net->clients[i]);
+    net->clients[i] = net->clients[--net->count];
+}
+
+void lp_net_close(struct lp_net* net)
+{
+    while (net->count > 0) {
+	lp_net_drop(net, 0);
+    }
+    if (net->fd >= 0) {
+	close(net->fd);
+	if (net->kind == lp_net_unix)
+	    unlink(net->address);
+    }
+    free(net);
+}
+
+int lp_net_pollfds(struct lp_net* net, struct pollfd* fds, int max)
+{
+    int i, n = 0;
+    
+    if (max > 0) {
+	fds[n].fd = net->fd;
+	fds[n++].events = POLLIN;
+    }
+    for (i = 0; i < net->count && n < max; i++) {
+	fds[n].fd = net->clients[i]->fd;
+	fds[n++].events = POLLIN;
+    }
+    return n;
+}
+
+static void lp_net_packet(struct lp_net* net, void* packet, int size)
+{
+    net->stats.packets++;
+    net->handler(packet, size, net->data);
+}
+
+/* the bytes read from a tcp client: its size on 4 bytes, then each packet */
+static int lp_net_read_sized(struct lp_net* net, struct lp_net_client* client, const unsigned char* bytes, int n)
+{
+    uint32_t size;
+    int k, packets = 0;
+    
+    while (n > 0) {
+	// the rest of a packet too large
+	if (client->skip > 0) {
+	    k = (unsigned int) n < client->skip ? n : client->skip;
+	    client->skip -= k;
+	    bytes += k;
+	    n -= k;
+	    continue;
+	}
+	
+	if (client->size < 4) {
+	    k = 4 - client->size;
+	} else {
+	    memcpy(&size, client->packet, 4);
+	    k = 4 + ntohl(size) - client->size;
+	}
+	k = n < k ? n : k;
+	memcpy(client->packet + client->size, bytes, k);
+	client->size += k;
+	bytes += k;
+	n -= k;
+	if (client->size < 4) {
+	    break;
+	}
+	
+	memcpy(&size, client->packet, 4);
+	size = ntohl(size);
+	if (size > LP_NET_PACKET) {
+	    net->stats.oversized++;
+	    client->skip = size;
+	    client->size = 0;
+	} else if (client->size == 4 + size) {
+	    if (size > 0) {
+		lp_net_packet(net, client->packet + 4, size);
+		packets++;
+	    }
+	    client->size = 0;
+	}
+    }
+    
+    return packets;
+}
+
+/* the bytes read from a slip client: packets ended with END, and END and ESC
+ * escaped within them */
+static int lp_net_read_slip(struct lp_net* net, struct lp_net_client* client, const unsigned char* bytes, int n)
+{
+    unsigned char c;
+    int i, packets = 0;
+    
+    for (i = 0; i < n; i++) {
+	c = bytes[i];
+	if (c == LP_SLIP_END) {
+	    if (client->size > 0 && !client->skip) {
+		lp_net_packet(net, client->packet, client->size);
+		packets++;
+	    }
+	    client->size = 0;
+	    client->skip = false;
+	    client->escaped = false;
+	    continue;
+	}
+	if (client->skip) {
+	    continue;
+	}
+	
+	if (client->escaped) {
+	    c = c == LP_SLIP_ESC_END ? LP_SLIP_END : c == LP_SLIP_ESC_ESC ? LP_SLIP_ESC : c;
+	    client->escaped = false;
+	} else if (c == LP_SLIP_ESC) {
+	    client->escaped = true;
+	    continue;
+	}
+	
+	// skip up to the next END
+	if (client->size == LP_NET_PACKET) {
+	    net->stats.oversized++;
+	    client->skip = true;
+	    continue;
+	}
+	client->packet[client->size++] = c;
+    }
+    
+    return packets;
+}
+
+static void lp_net_accept(struct lp_net* net)
+{
+    struct lp_net_client* client;
+    int fd;
+    
+    while ((fd = accept(net->fd, NULL, NULL)) >= 0) {
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	net->stats.connections++;
+	if (net->count == LP_NET_CLIENTS) {
+	    LP_LOG(lp_log_warning, "%s: too many clients, at most %d", net->address, LP_NET_CLIENTS);
+	    net->stats.refused++;
+	    close(fd);
+	    continue;
+	}
+	
+	client = calloc(1, sizeof(struct lp_net_client));
+	if (client == NULL) {
+	    LP_LOG(lp_log_error, "Unable to allocate memory");
+	    close(fd);
+	    continue;
+	}
+	client->fd = fd;
+	net->clients[net->count++] = client;
+    }
+}
+
+int lp_net_handle(struct lp_net* net)
+{
+    static unsigned char buffer[LP_NET_PACKET];
+    struct lp_net_client* client;
+    int i, n, packets = 0;
+    
+    if (net->kind == lp_net_udp || net->kind == lp_net_unix) {
+	// a datagram is a packet. MSG_TRUNC tells the size of those too large
+	while ((n = recv(net->fd, buffer, LP_NET_PACKET, MSG_TRUNC)) >= 0) {
+	    net->stats.bytes += n;
+	    if (n > LP_NET_PACKET) {
+		net->stats.oversized++;
+	    } else if (n > 0) {
+		lp_net_packet(net, buffer, n);
+		packets++;
+	    }
+	}
+	return packets;
+    }
+    
+    lp_net_accept(net);
+    for (i = 0; i < net->count; i++) {
+	client = net->clients[i];
+	while ((n = recv(client->fd, buffer, LP_NET_CHUNK, 0)) > 0) {
+	    net->stats.bytes += n;
+	    if (net->kind == lp_net_tcp) {
+		packets += lp_net_read_sized(net, client, buffer, n);
+	    } else {
+		packets += lp_net_read_slip(net, client, buffer, n);
+	    }
+	}
+	
+	// closed by the client
+	if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+	    lp_net_drop(net, i--);
+	}
+    }
+    
+    return packets;
+}
+
+int lp_net_connect(const char* spec)
+{
+    enum lp_net_kind kind;
+    char address[108];
+    struct sockaddr_un remote;
+    struct addrinfo *found, *at;
+    int bytes, type, fd = -1, on = 1;
+    
+    if (lp_net_parse(spec, &kind, address, &bytes) < 0) {
+	return -1;
+    }
+    
+    if (kind == lp_net_unix) {
+	if (lp_net_unix_address(&remote, address) < 0) {
+	    return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	lp_net_buffers(fd, bytes);
+	if (fd < 0 || connect(fd, (struct sockaddr*) &remote, sizeof(remote)) < 0) {
+	    fprintf(stderr, "could not connect to %s: %s\n", address, strerror(errno));
+	    if (fd >= 0)
+		close(fd);
+	    return -1;
+	}
+	return fd;
+    }
+    
+    type = kind == lp_net_udp ? SOCK_DGRAM : SOCK_STREAM;
+    found = lp_net_resolve(address, "localhost", type, 0);
+    if (found == NULL) {
+	return -1;
+    }
+    for (at = found; at != NULL; at = at->ai_next) {
+	fd = socket(at->ai_family, type, 0);
+	lp_net_buffers(fd, bytes);
+	if (fd >= 0 && connect(fd, at->ai_addr, at->ai_addrlen) == 0)
+	    break;
+	if (fd >= 0)
+	    close(fd);
+	fd = -1;
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+	fprintf(stderr, "could not connect to %s: %s\n", address, strerror(errno));
+	return -1;
+    }
+    
+    // small packets go out right away
+    if (type == SOCK_STREAM)
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+int lp_net_frame(enum lp_net_kind kind, const void* packet, int size, unsigned char* framed)
+{
+    const unsigned char* bytes = packet;
+    uint32_t big = htonl(size);
+    int i, n = 0;
+    
+    switch (kind) {
+    case lp_net_udp:
+    case lp_net_unix:
+	memcpy(framed, packet, size);
+	return size;
+    case lp_net_tcp:
+	memcpy(framed, &big, 4);
+	memcpy(framed + 4, packet, size);
+	return 4 + size;
+    case lp_net_slip:
+	// an END first too, to flush whatever noise came before
+	framed[n++] = LP_SLIP_END;
+	for (i = 0; i < size; i++) {
+	    if (bytes[i] == LP_SLIP_END) {
+		framed[n++] = LP_SLIP_ESC;
+		framed[n++] = LP_SLIP_ESC_END;
+	    } else if (bytes[i] == LP_SLIP_ESC) {
+		framed[n++] = LP_SLIP_ESC;
+		framed[n++] = LP_SLIP_ESC_ESC;
+	    } else {
+		framed[n++] = bytes[i];
+	    }
+	}
+	framed[n++] = LP_SLIP_END;
+	return n;
+    }
+    return 0;
+}
+
+void lp_net_dump(struct lp_net* net, FILE* out)
+{
+    fprintf(out, "%s %s: %lu packets, %lu bytes, %lu oversized, %d clients, %lu connections, %lu refused\n",
+	    lp_net_names[net->kind], net->address, net->stats.packets, net->stats.bytes,
+	    net->stats.oversized, net->count, net->stats.connections, net->stats.refused);
+}
@@ -0,0 +1,148 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPNET_H
+#define LPNET_H
+
+#include <stdio.h>
+#include <poll.h>
+#include <stdint.h>
+
+// largest packet received, that of a udp datagram
+#define LP_NET_PACKET 65536
+
+// most clients connected at once to a stream listener
+#define LP_NET_CLIENTS 16
+
+// bytes read from a socket at once
+#define LP_NET_CHUNK 16384
+
+// slip framing, from rfc 1055
+#define LP_SLIP_END 0xC0
+#define LP_SLIP_ESC 0xDB
+#define LP_SLIP_ESC_END 0xDC
+#define LP_SLIP_ESC_ESC 0xDD
+
+/**
+ * the kinds of socket packets are received on
+ */
+enum lp_net_kind {
+    lp_net_udp,		//! udp socket
+    lp_net_unix,	//! unix datagram socket, for clients on the same host
+    lp_net_tcp,		//! tcp stream, each packet preceded by its size on 4 bytes
+    lp_net_slip		//! tcp stream, packets framed with slip
+};
+
+/**
+ * called with each packet received
+ */
+typedef void (*lp_net_handler)(void* packet, int size, void* data);
+
+/**
+ * a client connected to a stream listener, and the packet it is sending
+ */
+struct lp_net_client {
+    int fd;					//! the connection
+    int size;					//! bytes of the packet received so far
+    int escaped;				//! whether the previous byte was a slip escape
+    unsigned int skip;				//! bytes of a packet too large left to skip with tcp, whether to skip up to the next END with slip
+    unsigned char packet[LP_NET_PACKET + 4];	//! the packet, and its size with tcp framing
+};
+
+/**
+ * counters of a listener
+ */
+struct lp_net_stats {
+    unsigned long packets;	//! packets received
+    unsigned long bytes;	//! bytes received
+    unsigned long oversized;	//! packets dropped because they were too large
+    unsigned long connections;	//! clients which connected
+    unsigned long refused;	//! clients turned away because there were too many
+};
+
+/**
+ * a socket packets are received on, and its clients
+ */
+struct lp_net {
+    enum lp_net_kind kind;				//! the socket and framing
+    char address[108];					//! path of a unix socket, or port of an ip one
+    int fd;						//! socket bound, listening for a stream
+    int count;						//! clients connected
+    struct lp_net_client* clients[LP_NET_CLIENTS];	//! the clients, for a stream
+    lp_net_handler handler;				//! called with each packet
+    void* data;						//! passed to handler
+    struct lp_net_stats stats;				//! counters
+};
+
+/** open a socket to receive packets on. spec is the kind of socket and its
+ * address, optionally followed by the size of the socket buffers in bytes:
+ *
+ *     udp:[host:]port[,bytes] -- a udp socket
+ *     unix:path[,bytes] -- a unix datagram socket, created at path
+ *     tcp:[host:]port[,bytes] -- a tcp socket, packets preceded by their size
+ *     slip:[host:]port[,bytes] -- a tcp socket, packets framed with slip
+ *
+ * \return the listener, or NULL when the socket could not be opened
+ */
+struct lp_net* lp_net_listen(const char* spec, lp_net_handler handler, void* data);
+
+/** close a listener, its clients, and remove its unix socket
+ */
+void lp_net_close(struct lp_net* net);
+
+/** the file descriptors to poll before lp_net_handle: the socket and those
+ * of the clients
+ *
+ * \return the amount of file descriptors filled in
+ */
+int lp_net_pollfds(struct lp_net* net, struct pollfd* fds, int max);
+
+/** accept the clients waiting, and pass every packet received to the handler,
+ * without waiting
+ *
+ * \return the amount of packets received
+ */
+int lp_net_handle(struct lp_net* net);
+
+/** connect to a listener, as a client. an ip one without a host is on
+ * localhost
+ *
+ * \return the socket, or -1 when it could not connect
+ */
+int lp_net_connect(const char* spec);
+
+/** frame a packet to send to a listener of the given kind. framed has room
+ * for 2 * size + 2 bytes
+ *
+ * \return the size of the framed packet
+ */
+int lp_net_frame(enum lp_net_kind kind, const void* packet, int size, unsigned char* framed);
+
+/** print the counters of a listener
+ */
+void lp_net_dump(struct lp_net* net, FILE* out);
+
+#endif
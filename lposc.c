@@ -26,144 +26,865 @@
 
 #include "lposc.h"
 
-struct launchpad *lp;
+struct lp_grid *grid;
 char *port = NULL;
 lo_server osc;
-lo_address dest;
+struct lp_net *nets[MAX_NETS];
+int nnets = 0;
+struct osc_dest dests[MAX_DESTS];
+int ndests = 0;
+unsigned char bundle[OSC_BUFFER];
+int bundle_size = 0;
+int bundle_messages = 0;
+int running = true;
+int dumping = false;
+int bundles = 0;
+unsigned long long bundle_due = 0;
+struct lp_sched *sched;
+struct lp_anim *anim;
+struct lp_dither *dither;
+struct lp_reflex *reflex;
+struct lp_gestures *gestures;
+struct lp_shm *shm;
+struct lp_ring *ring;
+unsigned char velocities[LP_GRID_DEVICES * LP_LEDS];
 
 void error_handler(int num, const char *msg, const char *path)
 {
-    printf("liblo server error %d in path %s: %s\n", num, path, msg);
-    fflush(stdout);
+    LP_LOG(lp_log_error, "liblo server error %d in path %s: %s", num, path, msg);
 }
 
 int generic_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
     int i;
 	
-    printf("path: <%s>\n", path);
+    if (lp_log_threshold < lp_log_debug)
+	return 1;
+    
+    LP_LOG(lp_log_debug, "path: <%s>", path);
     for (i=0; i<argc; i++) {
-	printf("arg %d '%c' ", i, types[i]);
-	lo_arg_pp(types[i], argv[i]);
-	printf("\n");
+	switch (types[i]) {
+	case 'i':
+	    LP_LOG(lp_log_debug, "arg %d 'i' %d", i, argv[i]->i);
+	    break;
+	case 'f':
+	    LP_LOG(lp_log_debug, "arg %d 'f' %f", i, argv[i]->f);
+	    break;
+	case 's':
+	    LP_LOG(lp_log_debug, "arg %d 's' \"%s\"", i, &argv[i]->s);
+	    break;
+	default:
+	    LP_LOG(lp_log_debug, "arg %d '%c'", i, types[i]);
+	    break;
+	}
     }
-    printf("\n");
-    fflush(stdout);
     return 1;
 }
 
+int osc_send3(int device, int data0, int data1, int data2)
+{
+	// messages of a bundle with a time tag wait for their time
+	if (bundle_due != 0) {
+		return lp_sched_send3(sched, bundle_due, device, data0, data1, data2);
+	}
+	return lp_grid_send3(grid, device, data0, data1, data2);
+}
+
+void osc_rows(int y, int rows, const unsigned char *velocities)
+{
+	int x, i, key, device;
+	
+	for (i = 0; i < rows; i++) {
+		for (x = 0; x < grid->width; x++) {
+			key = lp_grid_address(grid, x, y + i, &device);
+			if (key >= 0)
+				osc_send3(device, NOTE, key, velocities[i * grid->width + x]);
+		}
+	}
+}
+
 int matrix_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
 	int row = argv[0]->i;
 	int col = argv[1]->i;
 	int vel = argv[2]->i;
-	return lp_matrix(lp,row,col,vel);
+	int device;
+	int key = lp_grid_address(grid, col, row, &device);
+	if (key < 0)
+		return 0;
+	return osc_send3(device,NOTE,key,vel);
 }
 
 int scene_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
-	int row = argv[0]->i;
-	int vel = argv[1]->i;
-	return lp_scene(lp,row,vel);	
+	// the device comes first when there are three arguments
+	int device = argc == 3 ? argv[0]->i : 0;
+	int row = argv[argc-2]->i;
+	int vel = argv[argc-1]->i;
+	if (row < 0 || row > 7)
+		return 0;
+	return osc_send3(device,NOTE,row*16 + 8,vel);
 }
 
 int ctrl_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
-	int col = argv[0]->i;
-	int vel = argv[1]->i;
-	return lp_ctrl(lp,col,vel);		
+	int device = argc == 3 ? argv[0]->i : 0;
+	int col = argv[argc-2]->i;
+	int vel = argv[argc-1]->i;
+	if (col < 0 || col > 7)
+		return 0;
+	return osc_send3(device,CTRL,104 + col,vel);
+}
+
+int osc_velocities(const char *types, lo_arg **argv, int argc, unsigned char *velocities, int max)
+{
+	int i, size;
+	
+	// a blob of bytes
+	if (argc == 1 && types[0] == 'b') {
+		size = lo_blob_datasize((lo_blob) argv[0]);
+		if (size > max)
+			return -1;
+		memcpy(velocities, lo_blob_dataptr((lo_blob) argv[0]), size);
+		return size;
+	}
+	
+	// or integers
+	if (argc > max)
+		return -1;
+	for (i = 0; i < argc; i++) {
+		if (types[i] != 'i')
+			return -1;
+		velocities[i] = argv[i]->i;
+	}
+	return argc;
+}
+
+int frame_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	int matrix = grid->width * grid->height;
+	int n = osc_velocities(types, argv, argc, velocities, sizeof(velocities));
+	int i, j;
+	
+	if (n != matrix && n != matrix + 16 * grid->count) {
+		LP_LOG(lp_log_warning, "/lp/frame needs %d or %d velocities, got %d", matrix, matrix + 16 * grid->count, n);
+		return 0;
+	}
+	
+	osc_rows(0, grid->height, velocities);
+	
+	// then the scene and control buttons of each launchpad
+	for (i = 0; matrix < n && i < grid->count; i++) {
+		for (j = 0; j < 8; j++) {
+			osc_send3(i, NOTE, j*16 + 8, velocities[matrix + i*16 + j]);
+			osc_send3(i, CTRL, 104 + j, velocities[matrix + i*16 + 8 + j]);
+		}
+	}
+	return 0;
+}
+
+int rows_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	int n = -1;
+	
+	if (argc > 1 && types[0] == 'i') {
+		n = osc_velocities(types + 1, argv + 1, argc - 1, velocities, sizeof(velocities));
+	}
+	if (n <= 0 || n % grid->width != 0) {
+		LP_LOG(lp_log_warning, "/lp/rows needs a row, then whole rows of %d velocities", grid->width);
+		return 0;
+	}
+	
+	osc_rows(argv[0]->i, n / grid->width, velocities);
+	return 0;
+}
+
+unsigned long long osc_due(lo_timetag time)
+{
+	lo_timetag now;
+	unsigned long long clock = lp_now();
+	long long delay;
+	
+	if (time.sec == LO_TT_IMMEDIATE.sec && time.frac == LO_TT_IMMEDIATE.frac) {
+		return 0;
+	}
+	
+	// from the osc clock to lp_now's. a time before lp_now's origin is late
+	lo_timetag_now(&now);
+	delay = lo_timetag_diff(time, now) * 1e9;
+	return delay > -(long long) clock ? clock + delay : 1;
+}
+
+int bundle_start_handler(lo_timetag time, void *user_data)
+{
+	// the outermost bundle decides when its content is applied
+	if (bundles++ == 0) {
+		bundle_due = osc_due(time);
+	}
+	return 0;
+}
+
+int bundle_end_handler(void *user_data)
+{
+	// everything in a bundle goes out in one flush, now or at its time
+	if (--bundles == 0) {
+		if (bundle_due == 0) {
+			lp_grid_flush(grid);
+		}
+		bundle_due = 0;
+	}
+	return 0;
 }
 
 int reset_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
-	lp_reset(lp);
+	lp_grid_reset(grid);
+	return 0;
+}
+
+int commit_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	if (bundle_due != 0) {
+		lp_sched_swap(sched, bundle_due);
+	} else {
+		lp_grid_swap(grid);
+	}
+	return 0;
+}
+
+int fade_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	if (lp_anim_fade(anim, argv[0]->i, argv[1]->i, argv[2]->i, argv[3]->i, argv[4]->i, argv[5]->i, argv[6]->i) < 0)
+		LP_LOG(lp_log_warning, "%s: no room for another effect", path);
+	return 0;
+}
+
+int blink_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	if (lp_anim_blink(anim, argv[0]->i, argv[1]->i, argv[2]->i, argv[3]->i, argv[4]->i, argv[5]->i) < 0)
+		LP_LOG(lp_log_warning, "%s: no room for another effect", path);
+	return 0;
+}
+
+int sprite_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	int i, n = -1;
+	
+	// x y width height dx dy duration, then the velocities
+	for (i = 0; i < 7 && i < argc && types[i] == 'i'; i++);
+	if (i == 7 && argc > 7) {
+		n = osc_velocities(types + 7, argv + 7, argc - 7, velocities, LP_ANIM_SPRITE);
+	}
+	if (n <= 0 || argv[2]->i <= 0 || n % argv[2]->i != 0 || n / argv[2]->i != argv[3]->i) {
+		LP_LOG(lp_log_warning, "/lp/sprite needs x, y, width, height, dx, dy, duration, then width * height velocities");
+		return 0;
+	}
+	
+	if (lp_anim_sprite(anim, argv[0]->i, argv[1]->i, argv[2]->i, argv[3]->i, velocities,
+			   argv[4]->i, argv[5]->i, argv[6]->i) < 0)
+		LP_LOG(lp_log_warning, "%s: no room for another effect", path);
+	return 0;
+}
+
+int text_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	if (lp_anim_text(anim, argv[0]->i, argv[1]->i, argv[2]->i, &argv[6]->s, argv[3]->i, argv[4]->i, argv[5]->i != 0) < 0)
+		LP_LOG(lp_log_warning, "%s: text too long, or no room for another effect", path);
+	return 0;
+}
+
+int anim_stop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	if (argc == 2) {
+		lp_anim_cancel(anim, argv[0]->i, argv[1]->i);
+	} else {
+		lp_anim_cancel(anim, -1, -1);
+	}
+	return 0;
+}
+
+int dither_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	lp_dither_led(dither, argv[0]->i, argv[1]->i, argv[2]->i, argv[3]->i);
+	return 0;
+}
+
+int dither_clear_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	if (argc == 2) {
+		lp_dither_clear(dither, argv[0]->i, argv[1]->i);
+	} else {
+		lp_dither_clear(dither, -1, -1);
+	}
+	return 0;
+}
+
+int rule_add_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	struct lp_rule rule;
+	
+	if (lp_reflex_parse(&argv[0]->s, &rule) < 0) {
+		LP_LOG(lp_log_warning, "/lp/rule/add: not a rule: %s", &argv[0]->s);
+		return 0;
+	}
+	if (lp_reflex_add(reflex, &rule) < 0)
+		LP_LOG(lp_log_warning, "/lp/rule/add: too many rules");
+	return 0;
+}
+
+int rule_load_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	lp_reflex_load(reflex, &argv[0]->s);
+	return 0;
+}
+
+int rule_clear_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	lp_reflex_clear(reflex);
+	return 0;
+}
+
+int osc_resolve(const char *url, struct osc_dest *dest)
+{
+	struct sockaddr_storage server;
+	socklen_t length = sizeof(server);
+	struct addrinfo hints, *found;
+	lo_address address;
+	int err;
+	
+	address = lo_address_new_from_url(url);
+	if (address == NULL || lo_address_get_protocol(address) != LO_UDP) {
+		LP_LOG(lp_log_warning, "unsupported destination %s, only udp is", url);
+		if (address != NULL) lo_address_free(address);
+		return -1;
+	}
+	
+	// events go out through the server's socket, so look for an address of
+	// its family
+	getsockname(lo_server_get_socket_fd(osc), (struct sockaddr*) &server, &length);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = server.ss_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = server.ss_family == AF_INET6 ? AI_V4MAPPED : 0;
+	
+	err = getaddrinfo(lo_address_get_hostname(address), lo_address_get_port(address), &hints, &found);
+	lo_address_free(address);
+	if (err != 0) {
+		LP_LOG(lp_log_warning, "could not resolve %s: %s", url, gai_strerror(err));
+		return -1;
+	}
+	
+	memcpy(&dest->address, found->ai_addr, found->ai_addrlen);
+	dest->length = found->ai_addrlen;
+	freeaddrinfo(found);
 	return 0;
 }
 
 int dest_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
-	if (dest != NULL) free(dest);
-	dest = lo_address_new_from_url((char*) argv[0]);
+	// replace all the destinations
+	ndests = osc_resolve((char*) argv[0], &dests[0]) == 0;
+	LP_LOG(lp_log_info, "events sent to %s", ndests ? (char*) argv[0] : "nobody");
+	return 0;
+}
+
+int dest_add_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	if (ndests == MAX_DESTS) {
+		LP_LOG(lp_log_warning, "too many destinations, at most %d", MAX_DESTS);
+		return 0;
+	}
+	if (osc_resolve((char*) argv[0], &dests[ndests]) == 0) {
+		ndests++;
+		LP_LOG(lp_log_info, "events also sent to %s", (char*) argv[0]);
+	}
+	return 0;
+}
+
+int dest_remove_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+{
+	struct osc_dest removed;
+	int i;
+	
+	if (osc_resolve((char*) argv[0], &removed) != 0) {
+		return 0;
+	}
+	for (i = 0; i < ndests; i++) {
+		if (dests[i].length == removed.length
+		    && memcmp(&dests[i].address, &removed.address, removed.length) == 0) {
+			dests[i--] = dests[--ndests];
+			LP_LOG(lp_log_info, "events no longer sent to %s", (char*) argv[0]);
+		}
+	}
 	return 0;
 }
 
-void* lp2osc()
+/* append a string padded to 4 bytes, as osc wants it */
+static void osc_string(const char *string)
+{
+	int length = strlen(string) + 1;
+	
+	memcpy(bundle + bundle_size, string, length);
+	memset(bundle + bundle_size + length, 0, (4 - length % 4) % 4);
+	bundle_size += (length + 3) & ~3;
+}
+
+static void osc_int(int value)
+{
+	uint32_t big = htonl(value);
+	
+	memcpy(bundle + bundle_size, &big, 4);
+	bundle_size += 4;
+}
+
+void osc_begin()
+{
+	bundle_size = 0;
+	bundle_messages = 0;
+	osc_string("#bundle");
+	
+	// a time tag of 1 means immediately
+	osc_int(0);
+	osc_int(1);
+}
+
+void osc_add(const char *path, const int *args, int argc)
+{
+	char types[OSC_ARGS + 2] = ",";
+	uint32_t size;
+	int at = bundle_size;
+	int i;
+	
+	// room for the size, the path, the types and the arguments
+	if (argc > OSC_ARGS || bundle_size + 4 + strlen(path) + 4 + argc + 5 + 4 * argc > OSC_BUFFER) {
+		return;
+	}
+	
+	memset(types + 1, 'i', argc);
+	types[argc + 1] = 0;
+	
+	bundle_size += 4;
+	osc_string(path);
+	osc_string(types);
+	for (i = 0; i < argc; i++) {
+		osc_int(args[i]);
+	}
+	
+	// the size of the message goes before it
+	size = htonl(bundle_size - at - 4);
+	memcpy(bundle + at, &size, 4);
+	bundle_messages++;
+}
+
+void osc_send()
+{
+	int i;
+	
+	if (bundle_messages == 0) {
+		return;
+	}
+	
+	for (i = 0; i < ndests; i++) {
+		sendto(lo_server_get_socket_fd(osc), bundle, bundle_size, 0,
+		       (struct sockaddr*) &dests[i].address, dests[i].length);
+	}
+}
+
+/* add the gestures detected to the bundle, in rows and columns like the
+ * matrix events */
+void osc_gestures()
+{
+	struct lp_gesture detected[LP_GESTURE_QUEUE];
+	int args[OSC_ARGS];
+	int i, j, n;
+	
+	n = lp_gestures_read(gestures, detected, LP_GESTURE_QUEUE);
+	for (i = 0; i < n; i++) {
+		switch (detected[i].kind) {
+		case lp_gesture_long:
+		case lp_gesture_double:
+			args[0] = detected[i].y;
+			args[1] = detected[i].x;
+			osc_add(detected[i].kind == lp_gesture_long ? "/lp/gesture/long" : "/lp/gesture/double", args, 2);
+			break;
+		case lp_gesture_chord:
+			args[0] = detected[i].count;
+			for (j = 0; j < detected[i].count; j++) {
+				args[1 + 2*j] = detected[i].ys[j];
+				args[2 + 2*j] = detected[i].xs[j];
+			}
+			osc_add("/lp/gesture/chord", args, 1 + 2 * detected[i].count);
+			break;
+		case lp_gesture_swipe:
+			args[0] = detected[i].y;
+			args[1] = detected[i].x;
+			args[2] = detected[i].y + detected[i].dy * (detected[i].count - 1);
+			args[3] = detected[i].x + detected[i].dx * (detected[i].count - 1);
+			osc_add("/lp/gesture/swipe", args, 4);
+			break;
+		}
+	}
+}
+
+void stop_handler(int sig)
 {
-	int row,col,press;
+	running = false;
+}
+
+void dump_handler(int sig)
+{
+	dumping = true;
+}
+
+void sched_dump()
+{
+	struct lp_sched_stats stats = sched->stats;
 	
-    while (1) {
-		lp_receive(lp);
+	if (stats.scheduled == 0)
+		return;
+	
+	fprintf(stderr, "scheduled %lu, released %lu in %lu flushes, late %lu, dropped %lu\n",
+		stats.scheduled, stats.released, stats.flushes, stats.late, stats.dropped);
+	lp_histogram_header(stderr);
+	lp_histogram_print(stderr, &sched->jitter);
+}
+
+void lp2osc()
+{
+	struct lp_event events[LP_EVENTS];
+	int args[3];
+	int row,col,press,device,several;
+	unsigned long long emitted;
+	int i, n;
+	
+	// the events read at once go out in a single bundle, to every destination
+	while ((n = lp_grid_events(grid, events, LP_EVENTS)) > 0) {
+		// local feedback first, in one write
+		lp_grid_lock(grid);
+		if (lp_reflex_apply(reflex, events, n) > 0) {
+			lp_grid_flush(grid);
+		}
+		lp_grid_unlock(grid);
+		
+		// local readers next
+		if (ring != NULL) {
+			lp_ring_publish(ring, events, n);
+		}
+		
+		osc_begin();
+		several = grid->count > 1;
 		
-		if (dest != NULL) {
-			if (lp->event[0] == NOTE) {
-				// matrix or scene
-				row = lp->event[1] / 16;
-				col = lp->event[1] % 16;
-				press = lp->event[2];
-				
-				if (col == 8) {
-					// scene event
-					lo_send(dest, "/lp/scene", "ii", row, press);
-				} else {
-					// matrix event
-					lo_send(dest, "/lp/matrix", "iii", row, col, press);
-				}
-			} else {
+		for (i = 0; i < n; i++) {
+			device = events[i].device;
+			press = events[i].data2;
+			
+			if (lp_grid_position(grid, &events[i], &col, &row)) {
+				// matrix event, in grid coordinates
+				args[0] = row;
+				args[1] = col;
+				args[2] = press;
+				osc_add("/lp/matrix", args, 3);
+			} else if (events[i].status == NOTE && events[i].data1 % 16 == 8) {
+				// scene event, with its device when there are several
+				args[0] = device;
+				args[1] = events[i].data1 / 16;
+				args[2] = press;
+				osc_add("/lp/scene", args + !several, 3 - !several);
+			} else if (events[i].status == CTRL) {
 				// ctrl event
-				col = lp->event[1] - 104;
-				press = lp->event[2];
-				lo_send(dest, "/lp/ctrl", "ii", col, press);
+				args[0] = device;
+				args[1] = events[i].data1 - 104;
+				args[2] = press;
+				osc_add("/lp/ctrl", args + !several, 3 - !several);
+			}
+		}
+		
+		// and the gestures they complete
+		lp_gestures_feed(gestures, events, n);
+		osc_gestures();
+		osc_send();
+		
+		emitted = lp_now();
+		for (i = 0; i < n; i++) {
+			if (grid->lps[events[i].device]->tracing) {
+				lp_trace(&events[i], emitted);
 			}
 		}
 	}
+	
+	// gestures completed by time alone, like long presses
+	lp_gestures_advance(gestures, lp_now());
+	if (gestures->count > 0) {
+		osc_begin();
+		osc_gestures();
+		osc_send();
+	}
 }
 
-void* osc2lp()
+void osc_register()
 {
 	// register methods
 	lo_server_add_method(osc, NULL, NULL, generic_handler, NULL);
 	lo_server_add_method(osc, "/lp/matrix", "iii", matrix_handler, NULL);
 	lo_server_add_method(osc, "/lp/scene", "ii", scene_handler, NULL);
+	lo_server_add_method(osc, "/lp/scene", "iii", scene_handler, NULL);
 	lo_server_add_method(osc, "/lp/ctrl", "ii", ctrl_handler, NULL);
+	lo_server_add_method(osc, "/lp/ctrl", "iii", ctrl_handler, NULL);
+	lo_server_add_method(osc, "/lp/frame", NULL, frame_handler, NULL);
+	lo_server_add_method(osc, "/lp/rows", NULL, rows_handler, NULL);
 	lo_server_add_method(osc, "/lp/reset", "", reset_handler, NULL);
+	lo_server_add_method(osc, "/lp/commit", "", commit_handler, NULL);
+	lo_server_add_method(osc, "/lp/fade", "iiiiiii", fade_handler, NULL);
+	lo_server_add_method(osc, "/lp/blink", "iiiiii", blink_handler, NULL);
+	lo_server_add_method(osc, "/lp/sprite", NULL, sprite_handler, NULL);
+	lo_server_add_method(osc, "/lp/text", "iiiiiis", text_handler, NULL);
+	lo_server_add_method(osc, "/lp/stop", "", anim_stop_handler, NULL);
+	lo_server_add_method(osc, "/lp/stop", "ii", anim_stop_handler, NULL);
+	lo_server_add_method(osc, "/lp/dither", "iiii", dither_handler, NULL);
+	lo_server_add_method(osc, "/lp/dither/clear", "", dither_clear_handler, NULL);
+	lo_server_add_method(osc, "/lp/dither/clear", "ii", dither_clear_handler, NULL);
+	lo_server_add_method(osc, "/lp/rule/add", "s", rule_add_handler, NULL);
+	lo_server_add_method(osc, "/lp/rule/load", "s", rule_load_handler, NULL);
+	lo_server_add_method(osc, "/lp/rule/clear", "", rule_clear_handler, NULL);
 	lo_server_add_method(osc, "/lp/dest", "s", dest_handler, NULL);
-	
-	while (true) {
-		fflush(stdout);
-		lo_server_recv(osc);
-	}
+	lo_server_add_method(osc, "/lp/dest/add", "s", dest_add_handler, NULL);
+	lo_server_add_method(osc, "/lp/dest/remove", "s", dest_remove_handler, NULL);
+	lo_server_add_bundle_handlers(osc, bundle_start_handler, bundle_end_handler, NULL);
 }
 
-int main(unsigned int argc, char* argv[])
+/* a packet received on another socket than the osc server's, handled as if
+ * it came to the server */
+void net_handler(void* packet, int size, void* data)
 {
-	int err;
-	pthread_t lp2osc_thread, osc2lp_thread;
+	lo_server_dispatch_data(osc, packet, size);
+}
+
+int main(int argc, char* argv[])
+{
+	struct pollfd fds[MAX_FDS];
+	int i, n, opt, listened, received;
+	int devices = 1, columns = 0;
+	int tracing = false;
+	enum lp_log_level verbosity = lp_log_warning;
+	enum lp_late late = lp_late_merge;
+	unsigned long long tolerance = 0;
+	char *chrome = NULL;
+	char *capture = NULL;
+	char *rules = NULL;
+	char *frame = NULL;
+	char *input = NULL;
+	char *listens[MAX_NETS];
+	int nlistens = 0;
+	struct lp_gesture_config thresholds;
 	
-    // Launchpad initialization
-    lp = lp_register();
+	lp_gestures_defaults(&thresholds);
+	while ((opt = getopt(argc, argv, "tc:C:p:l:d:w:DL:r:g:s:i:vR:")) != -1) {
+		switch (opt) {
+		case 't':
+			tracing = true;
+			break;
+		case 'c':
+			tracing = true;
+			chrome = optarg;
+			break;
+		case 'C':
+			capture = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'l':
+			if (nlistens < MAX_NETS) {
+				listens[nlistens++] = optarg;
+				break;
+			}
+			fprintf(stderr, "too many sockets, at most %d\n", MAX_NETS);
+			return 1;
+		case 'd':
+			devices = atoi(optarg);
+			break;
+		case 'w':
+			columns = atoi(optarg);
+			break;
+		case 'D':
+			late = lp_late_drop;
+			break;
+		case 'L':
+			tolerance = atof(optarg) * 1000000;
+			break;
+		case 'r':
+			rules = optarg;
+			break;
+		case 's':
+			frame = optarg;
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 'v':
+			if (verbosity < lp_log_debug)
+				verbosity++;
+			break;
+		case 'g':
+			if (lp_gestures_configure(&thresholds, optarg) == 0)
+				break;
+			fprintf(stderr, "unknown gesture threshold in %s\n", optarg);
+			return 1;
+		case 'R':
+			if (lp_rt_configure(optarg) == 0)
+				break;
+			fprintf(stderr, "unknown real-time setting in %s\n", optarg);
+			return 1;
+		default:
+			fprintf(stderr, "usage: %s [-t] [-c trace.json] [-C capture] [-p port] [-l socket] [-d devices] [-w columns] [-D] [-L ms] [-r rules] [-g thresholds] [-s shm] [-i ring] [-v] [-R real-time]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+    // memory is locked before the threads and the buffers are allocated, so
+    // that none of them faults once running
+    lp_rt_start();
+    
+    // messages are written by a thread of their own, so that the loop never
+    // waits for the terminal
+    if (lp_log_start(stderr, verbosity) != 0) {
+	    return 1;
+    }
+    
+    // Launchpad initialization. the loop flushes the leds drawn by each
+    // batch of osc messages, so no writer thread is needed
+    grid = lp_grid_open(devices, columns);
+    if (grid == NULL) {
+	    return 1;
+    }
+    printf("grid: %d launchpads, %dx%d\n", grid->count, grid->width, grid->height);
+    for (i = 0; i < grid->count && tracing; i++) {
+	    lp_trace_start(grid->lps[i], chrome);
+    }
+    for (i = 0; i < grid->count && capture != NULL; i++) {
+	    if (lp_capture_start(grid->lps[i], capture) < 0)
+		    return 1;
+    }
+    sched = lp_sched_start(grid, late, tolerance);
+    if (sched == NULL) {
+	    return 1;
+    }
+    anim = lp_anim_start(grid, LP_ANIM_RATE);
+    if (anim == NULL) {
+	    return 1;
+    }
+    dither = lp_dither_start(grid, LP_DITHER_RATE);
+    if (dither == NULL) {
+	    return 1;
+    }
+    reflex = lp_reflex_new(grid);
+    if (reflex == NULL || (rules != NULL && lp_reflex_load(reflex, rules) < 0)) {
+	    return 1;
+    }
+    gestures = lp_gestures_new(grid, &thresholds);
+    if (gestures == NULL) {
+	    return 1;
+    }
+    if (frame != NULL && (shm = lp_shm_serve(grid, frame)) == NULL) {
+	    return 1;
+    }
+    if (input != NULL && (ring = lp_ring_create(input)) == NULL) {
+	    return 1;
+    }
 	
 	// OSC initialization
 	osc = lo_server_new(port, error_handler);
+	// bundles with a time tag go to the scheduler as they arrive, rather
+	// than wait in liblo's queue, which skips the bundle handlers
+	lo_server_enable_queue(osc, 0, 1);
 	printf("port: %d\n", lo_server_get_port(osc));
 	fflush(stdout);
-		
-	err = pthread_create(&lp2osc_thread, NULL, lp2osc, NULL);
-	if (err){
-		fprintf(stderr, "failed to start lp2osc thread, with error %d", err);
-		return 0;
+	osc_register();
+	for (i = 0; i < nlistens; i++) {
+		nets[nnets] = lp_net_listen(listens[i], net_handler, NULL);
+		if (nets[nnets++] == NULL) {
+			return 1;
+		}
 	}
-
-	err = pthread_create(&osc2lp_thread, NULL, osc2lp, NULL);
-	if (err){
-		fprintf(stderr, "failed to start osc2lp thread, with error %d", err);
-		return 0;
+	
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	signal(SIGUSR1, dump_handler);
+	
+	// a single loop serves both the osc server and the launchpad. it is
+	// raised once all the threads are started, or they would inherit it
+	lp_rt_thread(lp_rt_input);
+	while (running && !lp_grid_stopped(grid)) {
+		fds[0].fd = lo_server_get_socket_fd(osc);
+		fds[0].events = POLLIN;
+		n = 1;
+		for (i = 0; i < nnets; i++) {
+			n += lp_net_pollfds(nets[i], fds + n, MAX_FDS - n);
+		}
+		listened = n;
+		n += lp_grid_pollfds(grid, fds + n, MAX_FDS - n);
+		
+		if (poll(fds, n, lp_grid_timeout(grid, lp_gestures_timeout(gestures, LOOP_TIMEOUT))) < 0) {
+			// interrupted by a signal
+			if (dumping) {
+				lp_trace_dump(stderr);
+				lp_trace_write();
+				sched_dump();
+				lp_grid_dump(grid, stderr);
+				for (i = 0; i < nnets; i++)
+					lp_net_dump(nets[i], stderr);
+				lp_rt_dump(stderr);
+				dumping = false;
+			}
+			continue;
+		}
+		
+		// osc to launchpad, from every socket, and the writes held back
+		// by the rate. the scheduler stages on the grid too
+		for (i = 0, received = false; i < listened; i++) {
+			received |= fds[i].revents != 0;
+		}
+		if (received || lp_grid_backlog(grid) > 0) {
+			lp_grid_lock(grid);
+			while (lo_server_recv_noblock(osc, 0) > 0);
+			for (i = 0; i < nnets; i++) {
+				lp_net_handle(nets[i]);
+			}
+			lp_grid_flush(grid);
+			lp_grid_unlock(grid);
+		}
+		
+		// launchpad to osc
+		lp_grid_handle(grid, 0);
+		lp2osc();
 	}
 	
-    pthread_join(lp2osc_thread, NULL);
-    pthread_join(osc2lp_thread, NULL);
+	if (tracing) {
+		lp_trace_dump(stderr);
+		lp_trace_write();
+		sched_dump();
+		lp_grid_dump(grid, stderr);
+		for (i = 0; i < nnets; i++)
+			lp_net_dump(nets[i], stderr);
+		lp_rt_dump(stderr);
+	}
 	
-	lp_deregister(lp);
+	if (shm != NULL)
+		lp_shm_stop(shm);
+	if (ring != NULL)
+		lp_ring_close(ring);
+	lp_dither_stop(dither);
+	lp_anim_stop(anim);
+	lp_sched_stop(sched);
+	lp_reflex_free(reflex);
+	lp_gestures_free(gestures);
+	lp_grid_close(grid);
+	lp_capture_stop();
+	for (i = 0; i < nnets; i++)
+		lp_net_close(nets[i]);
 	lo_server_free(osc);
+	lp_log_stop();
+	lp_rt_stop();
 	
     return 0;
 }
@@ -3,25 +3,125 @@
 #include <unistd.h>
 #include <lo/lo.h>
 #include <string.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
 
-#include "liblaunchpad.h"
+#include "lpgrid.h"
+#include "lptrace.h"
+#include "lpsched.h"
+#include "lpanim.h"
+#include "lpdither.h"
+#include "lpreflex.h"
+#include "lpgesture.h"
+#include "lpshm.h"
+#include "lpring.h"
+#include "lpcapture.h"
+#include "lplog.h"
+#include "lprt.h"
+#include "lpnet.h"
+
+// most sockets served besides the osc server's
+#define MAX_NETS 8
+
+// most file descriptors watched by the main loop: the osc server, the sockets
+// and their clients, and the launchpads
+#define MAX_FDS (1 + MAX_NETS * (1 + LP_NET_CLIENTS) + 16)
+
+// longest wait in the main loop, in milliseconds
+#define LOOP_TIMEOUT 100
+
+// most addresses events are sent to
+#define MAX_DESTS 16
+
+// size of the bundle of events sent at once
+#define OSC_BUFFER 4096
+
+// most arguments of an event, those of the largest chord
+#define OSC_ARGS (1 + 2 * LP_GESTURE_CHORD)
+
+/**
+ * an address events are sent to
+ */
+struct osc_dest {
+    struct sockaddr_storage address;	//! where to send
+    socklen_t length;			//! size of address
+};
 
 void error_handler(int num, const char *msg, const char *path);
 
 int generic_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
+int osc_send3(int device, int data0, int data1, int data2);
+
+void osc_rows(int y, int rows, const unsigned char *velocities);
+
 int matrix_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
 int scene_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
 int ctrl_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
+int osc_velocities(const char *types, lo_arg **argv, int argc, unsigned char *velocities, int max);
+
+int frame_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int rows_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+unsigned long long osc_due(lo_timetag time);
+
+int bundle_start_handler(lo_timetag time, void *user_data);
+
+int bundle_end_handler(void *user_data);
+
 int reset_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
+int commit_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int fade_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int blink_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int sprite_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int text_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int anim_stop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int rule_add_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int rule_load_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int rule_clear_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int dest_add_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int dest_remove_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
+int osc_resolve(const char *url, struct osc_dest *dest);
+
+void osc_begin();
+
+void osc_add(const char *path, const int *args, int argc);
+
+void osc_send();
+
+void osc_gestures();
+
 int dest_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
-void* lp2osc();
+void stop_handler(int sig);
+
+void dump_handler(int sig);
+
+void sched_dump();
+
+void lp2osc();
+
+void osc_register();
 
-void* osc2lp();
+void net_handler(void* packet, int size, void* data);
 
-int main(unsigned int argc, char* argv[]);
+int main(int argc, char* argv[]);
@@ -0,0 +1,257 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpreflex.h"
+#include <string.h>
+
+struct lp_reflex* lp_reflex_new(struct lp_grid* grid)
+{
+    struct lp_reflex* reflex = calloc(1, sizeof(struct lp_reflex));
+    
+    if (reflex == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    reflex->grid = grid;
+    return reflex;
+}
+
+void lp_reflex_free(struct lp_reflex* reflex)
+{
+    free(reflex);
+}
+
+int lp_reflex_add(struct lp_reflex* reflex, const struct lp_rule* rule)
+{
+    if (reflex->count == LP_REFLEX_RULES) {
+	return -1;
+    }
+    
+    reflex->rules[reflex->count] = *rule;
+    return reflex->count++;
+}
+
+void lp_reflex_clear(struct lp_reflex* reflex)
+{
+    reflex->count = 0;
+    memset(reflex->lit, 0, sizeof(reflex->lit));
+}
+
+/* index of a name in a list, or -1 */
+static int lp_reflex_name(const char* name, const char* const* names, int count)
+{
+    int i;
+    
+    for (i = 0; i < count; i++) {
+	if (strcmp(name, names[i]) == 0) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+int lp_reflex_parse(const char* line, struct lp_rule* rule)
+{
+    static const char* const buttons[] = { "pad", "scene", "ctrl" };
+    static const char* const edges[] = { "press", "release", "both" };
+    static const char* const actions[] = { "light", "toggle", "radio", "momentary" };
+    char button[16], edge[16], action[16];
+    int n, kind, when, what;
+    
+    memset(rule, 0, sizeof(struct lp_rule));
+    n = sscanf(line, "%15s %d %d %d %d %d %15s %15s %d %d %d", button, &rule->device,
+	       &rule->x, &rule->y, &rule->width, &rule->height, edge, action,
+	       &rule->on, &rule->off, &rule->group);
+    if (n < 9) {
+	return -1;
+    }
+    
+    kind = lp_reflex_name(button, buttons, 3);
+    when = lp_reflex_name(edge, edges, 3);
+    what = lp_reflex_name(action, actions, 4);
+    if (kind < 0 || when < 0 || what < 0 || rule->width <= 0 || rule->height <= 0) {
+	return -1;
+    }
+    
+    rule->button = kind;
+    rule->edge = when;
+    rule->action = what;
+    return 0;
+}
+
+int lp_reflex_load(struct lp_reflex* reflex, const char* path)
+{
+    struct lp_rule rule;
+    char line[256];
+    int added = 0;
+    int number = 0;
+    FILE* file = fopen(path, "r");
+    
+    if (file == NULL) {
+	fprintf(stderr, "could not open the rules %s\n", path);
+	return -1;
+    }
+    
+    while (fgets(line, sizeof(line), file) != NULL) {
+	number++;
+	if (line[strspn(line, " \t\r\n")] == 0 || line[strspn(line, " \t")] == '#') {
+	    continue;
+	}
+	if (lp_reflex_parse(line, &rule) < 0) {
+	    fprintf(stderr, "%s:%d: not a rule\n", path, number);
+	} else if (lp_reflex_add(reflex, &rule) < 0) {
+	    fprintf(stderr, "%s:%d: too many rules\n", path, number);
+	} else {
+	    added++;
+	}
+    }
+    
+    fclose(file);
+    return added;
+}
+
+/* whether a rule covers a button, a key from LP_MATRIX_LED, LP_SCENE_LED or LP_CTRL_LED */
+static int lp_reflex_covers(const struct lp_grid* grid, const struct lp_rule* rule, int device, int led)
+{
+    int x, y;
+    
+    if (led < 64) {
+	x = device % grid->columns * LP_GRID_SIDE + led % 8;
+	y = device / grid->columns * LP_GRID_SIDE + led / 8;
+	return rule->button == lp_button_pad
+	    && x >= rule->x && x < rule->x + rule->width
+	    && y >= rule->y && y < rule->y + rule->height;
+    }
+    if (rule->device != device) {
+	return false;
+    }
+    if (led < 72) {
+	return rule->button == lp_button_scene && led - 64 >= rule->y && led - 64 < rule->y + rule->height;
+    }
+    return rule->button == lp_button_ctrl && led - 72 >= rule->x && led - 72 < rule->x + rule->width;
+}
+
+/* stage a led of a launchpad */
+static void lp_reflex_led(struct lp_reflex* reflex, int device, int led, int lit, int velocity)
+{
+    reflex->lit[device][led] = lit;
+    
+    if (led < 64) {
+	lp_grid_send3(reflex->grid, device, NOTE, led / 8 * 16 + led % 8, velocity);
+    } else if (led < 72) {
+	lp_grid_send3(reflex->grid, device, NOTE, (led - 64) * 16 + 8, velocity);
+    } else {
+	lp_grid_send3(reflex->grid, device, CTRL, 104 + led - 72, velocity);
+    }
+}
+
+/* turn off the lit leds of the other buttons of a radio group */
+static void lp_reflex_radio(struct lp_reflex* reflex, int group, int device, int led)
+{
+    struct lp_rule* rule;
+    int d, l;
+    
+    for (d = 0; d < reflex->grid->count; d++) {
+	for (l = 0; l < LP_LEDS; l++) {
+	    if (!reflex->lit[d][l] || (d == device && l == led)) {
+		continue;
+	    }
+	    
+	    // the first rule of the button tells its group
+	    for (rule = reflex->rules; rule < reflex->rules + reflex->count; rule++) {
+		if (lp_reflex_covers(reflex->grid, rule, d, l)) {
+		    if (rule->action == lp_action_radio && rule->group == group) {
+			lp_reflex_led(reflex, d, l, false, rule->off);
+		    }
+		    break;
+		}
+	    }
+	}
+    }
+}
+
+int lp_reflex_apply(struct lp_reflex* reflex, const struct lp_event* events, int n)
+{
+    const struct lp_rule* rule;
+    int i, device, led, press;
+    int matched = 0;
+    
+    for (i = 0; i < n; i++) {
+	device = events[i].device;
+	press = events[i].data2 != 0;
+	
+	// the button, as an led of its launchpad
+	if (events[i].status == NOTE && events[i].data1 % 16 < 8 && events[i].data1 / 16 < 8) {
+	    led = LP_MATRIX_LED(events[i].data1 / 16, events[i].data1 % 16);
+	} else if (events[i].status == NOTE && events[i].data1 % 16 == 8 && events[i].data1 / 16 < 8) {
+	    led = LP_SCENE_LED(events[i].data1 / 16);
+	} else if (events[i].status == CTRL && events[i].data1 >= 104 && events[i].data1 < 112) {
+	    led = LP_CTRL_LED(events[i].data1 - 104);
+	} else {
+	    continue;
+	}
+	
+	for (rule = reflex->rules; rule < reflex->rules + reflex->count; rule++) {
+	    if (lp_reflex_covers(reflex->grid, rule, device, led)) {
+		break;
+	    }
+	}
+	if (rule == reflex->rules + reflex->count) {
+	    continue;
+	}
+	
+	// momentary rules follow the button, the others only take their edge
+	if (rule->action == lp_action_momentary) {
+	    lp_reflex_led(reflex, device, led, press, press ? rule->on : rule->off);
+	    matched++;
+	    continue;
+	}
+	if (rule->edge != lp_edge_both && press != (rule->edge == lp_edge_press)) {
+	    continue;
+	}
+	matched++;
+	
+	switch (rule->action) {
+	case lp_action_toggle:
+	    if (reflex->lit[device][led]) {
+		lp_reflex_led(reflex, device, led, false, rule->off);
+		break;
+	    }
+	    lp_reflex_led(reflex, device, led, true, rule->on);
+	    break;
+	case lp_action_radio:
+	    lp_reflex_radio(reflex, rule->group, device, led);
+	    lp_reflex_led(reflex, device, led, true, rule->on);
+	    break;
+	default:
+	    lp_reflex_led(reflex, device, led, true, rule->on);
+	    break;
+	}
+    }
+    
+    reflex->applied += matched;
+    return matched;
+}
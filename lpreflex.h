@@ -0,0 +1,135 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPREFLEX_H
+#define LPREFLEX_H
+
+#include "lpgrid.h"
+
+// most rules in a table
+#define LP_REFLEX_RULES 256
+
+/**
+ * the buttons a rule applies to
+ */
+enum lp_button {
+    lp_button_pad,	//! the matrix, in grid coordinates
+    lp_button_scene,	//! the scene buttons of a launchpad, by row
+    lp_button_ctrl	//! the control buttons of a launchpad, by column
+};
+
+/**
+ * which events trigger a rule
+ */
+enum lp_edge {
+    lp_edge_press,	//! presses
+    lp_edge_release,	//! releases
+    lp_edge_both	//! both
+};
+
+/**
+ * what a rule does to the led of the button
+ */
+enum lp_action {
+    lp_action_light,		//! light it
+    lp_action_toggle,		//! light it, or turn it off when it is lit
+    lp_action_radio,		//! light it, and turn off the others of its group
+    lp_action_momentary		//! light it while pressed, whatever the edge
+};
+
+/**
+ * a rule, lighting the led of a button when it is pressed or released
+ */
+struct lp_rule {
+    enum lp_button button;	//! kind of the buttons
+    int device;			//! launchpad of scene and control buttons
+    int x, y, width, height;	//! area of the pads, rows of the scene buttons, columns of the control ones
+    enum lp_edge edge;		//! events triggering the rule
+    enum lp_action action;	//! what it does
+    int on, off;		//! velocities of the led when lit and off
+    int group;			//! group of a radio rule
+};
+
+/**
+ * a table of rules, run on the input events before they are forwarded so that
+ * the feedback takes a single write. the first rule matching an event applies.
+ *
+ * the table is changed and run while holding the grid's lock, see
+ * lp_grid_lock.
+ */
+struct lp_reflex {
+    struct lp_grid* grid;				//! where the leds are written
+    struct lp_rule rules[LP_REFLEX_RULES];		//! the rules, in order
+    int count;						//! amount of rules
+    unsigned char lit[LP_GRID_DEVICES][LP_LEDS];	//! whether the rules lit each led
+    unsigned long applied;				//! events which matched a rule
+};
+
+/** create an empty table
+ */
+struct lp_reflex* lp_reflex_new(struct lp_grid* grid);
+
+/** free a table
+ */
+void lp_reflex_free(struct lp_reflex* reflex);
+
+/** add a rule at the end of the table
+ *
+ * \return the index of the rule, or -1 when the table is full
+ */
+int lp_reflex_add(struct lp_reflex* reflex, const struct lp_rule* rule);
+
+/** remove all the rules
+ */
+void lp_reflex_clear(struct lp_reflex* reflex);
+
+/** parse a rule, as written in a configuration file:
+ *
+ *     button device x y width height edge action on off group
+ *
+ * button is pad, scene or ctrl. edge is press, release or both. action is
+ * light, toggle, radio or momentary. off and group are optional, and 0 by
+ * default.
+ *
+ * \return 0, or -1 when the line is not a rule
+ */
+int lp_reflex_parse(const char* line, struct lp_rule* rule);
+
+/** add the rules of a configuration file. empty lines and lines starting
+ * with # are skipped
+ *
+ * \return the amount of rules added, or -1 when the file could not be read
+ */
+int lp_reflex_load(struct lp_reflex* reflex, const char* path);
+
+/** run the rules on events, staging the leds they light. the caller flushes
+ * the grid
+ *
+ * \return the amount of events which matched a rule
+ */
+int lp_reflex_apply(struct lp_reflex* reflex, const struct lp_event* events, int n);
+
+#endif
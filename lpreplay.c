@@ -0,0 +1,218 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * replays a capture against simulated launchpads, see lpcapture.h.
+ *
+ *     lpreplay [-x speed] [-o] capture -- parse the replayed input in
+ *         process and print how fast it went
+ *     lpreplay [-x speed] capture program [args...] -- run lposc or lpmidi
+ *         with the replayed input
+ */
+
+#include "liblaunchpad.h"
+#include "lpcapture.h"
+#include "lpgrid.h"
+#include "lptrace.h"
+#include <string.h>
+#include <unistd.h>
+
+// longest wait for input, in ms
+#define REPLAY_WAIT 10
+
+/* amount of launchpads captured */
+static int replay_devices(const char* path)
+{
+    struct lp_replay* replay;
+    const struct lp_capture_record* record;
+    int devices = 0;
+    
+    replay = lp_replay_open(path);
+    if (replay == NULL) {
+	return -1;
+    }
+    while ((record = lp_replay_next(replay)) != NULL) {
+	if (record->device >= devices) {
+	    devices = record->device + 1;
+	}
+    }
+    lp_replay_close(replay);
+    
+    return devices > 0 ? devices : 1;
+}
+
+/* whether all the launchpads replayed their input */
+static int replay_done(struct lp_grid* grid)
+{
+    int i, done = true;
+    
+    for (i = 0; i < grid->count; i++) {
+	pthread_mutex_lock(&grid->lps[i]->lock);
+	done = done && grid->lps[i]->stopped;
+	pthread_mutex_unlock(&grid->lps[i]->lock);
+    }
+    return done;
+}
+
+/* send the captured output which is due, and tell when the next is */
+static unsigned long long replay_output(struct lp_grid* grid, struct lp_replay* replay, const struct lp_capture_record** record, unsigned long long start, double speed)
+{
+    unsigned long long due;
+    struct launchpad* lp;
+    
+    while (*record != NULL) {
+	due = speed > 0 ? start + ((*record)->time - replay->origin) / speed : start;
+	if (due > lp_now()) {
+	    return due;
+	}
+	
+	if ((*record)->direction == lp_outbound && (*record)->device < grid->count) {
+	    lp = grid->lps[(*record)->device];
+	    lp_grid_lock(grid);
+	    memcpy(lp->tdata, (*record)->data, (*record)->size);
+	    lp_send(lp, (*record)->size);
+	    lp_grid_unlock(grid);
+	}
+	*record = lp_replay_next(replay);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int opt, devices, n, i, timeout, done;
+    int output = false;
+    double speed = 1;
+    char count[16];
+    const char* path;
+    struct lp_grid* grid;
+    struct lp_replay* replay = NULL;
+    const struct lp_capture_record* record = NULL;
+    struct lp_event events[LP_EVENTS];
+    struct lp_histogram latency = {"replay"};
+    unsigned long long start, now, next, elapsed;
+    unsigned long received = 0, packets = 0, lost = 0, transfers = 0;
+    
+    while ((opt = getopt(argc, argv, "+x:o")) != -1) {
+	switch (opt) {
+	case 'x':
+	    speed = atof(optarg);
+	    break;
+	case 'o':
+	    output = true;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-x speed] [-o] capture [program args...]\n", argv[0]);
+	    return 1;
+	}
+    }
+    if (optind >= argc) {
+	fprintf(stderr, "usage: %s [-x speed] [-o] capture [program args...]\n", argv[0]);
+	return 1;
+    }
+    path = argv[optind];
+    
+    // as many simulated launchpads as captured ones, all replaying the capture
+    devices = replay_devices(path);
+    if (devices < 0) {
+	return 1;
+    }
+    snprintf(count, sizeof(count), "%d", devices);
+    setenv("LP_TRANSPORT", "virtual", true);
+    setenv("LP_DEVICES", count, true);
+    setenv("LP_REPLAY", path, true);
+    snprintf(count, sizeof(count), "%g", speed);
+    setenv("LP_SPEED", count, true);
+    
+    if (optind + 1 < argc) {
+	execvp(argv[optind + 1], &argv[optind + 1]);
+	fprintf(stderr, "could not run %s\n", argv[optind + 1]);
+	return 1;
+    }
+    
+    grid = lp_grid_open(devices, 0);
+    if (grid == NULL) {
+	return 1;
+    }
+    if (output) {
+	replay = lp_replay_open(path);
+	if (replay == NULL) {
+	    lp_grid_close(grid);
+	    return 1;
+	}
+	record = lp_replay_next(replay);
+    }
+    
+    // read everything replayed, until all the launchpads stop
+    start = lp_now();
+    do {
+	done = replay_done(grid);
+	
+	timeout = REPLAY_WAIT;
+	if (replay != NULL) {
+	    next = replay_output(grid, replay, &record, start, speed);
+	    now = lp_now();
+	    if (next != 0 && next < now + REPLAY_WAIT * 1000000ULL) {
+		timeout = (next - now) / 1000000;
+	    }
+	}
+	if (!done) {
+	    lp_grid_wait(grid, timeout);
+	}
+	
+	while ((n = lp_grid_events(grid, events, LP_EVENTS)) > 0) {
+	    now = lp_now();
+	    for (i = 0; i < n; i++) {
+		lp_histogram_record(&latency, now - events[i].time);
+	    }
+	    received += n;
+	}
+    } while (!done);
+    elapsed = lp_now() - start;
+    
+    for (i = 0; i < grid->count; i++) {
+	lost += grid->lps[i]->stats.lost;
+	transfers += grid->lps[i]->stats.transfers;
+    }
+    if (replay != NULL) {
+	lp_replay_close(replay);
+    }
+    
+    // packets replayed, from the capture
+    replay = lp_replay_open(path);
+    while ((record = lp_replay_next(replay)) != NULL) {
+	packets += record->direction == lp_inbound;
+    }
+    lp_replay_close(replay);
+    
+    printf("%lu packets, %lu events in %.3f s: %.0f events/s, %lu packets lost, %lu transfers\n",
+	   packets, received, elapsed / 1e9, received / (elapsed / 1e9), lost, transfers);
+    lp_histogram_header(stdout);
+    lp_histogram_print(stdout, &latency);
+    
+    lp_grid_close(grid);
+    return 0;
+}
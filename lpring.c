@@ -0,0 +1,201 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpring.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* map a ring, creating it with the given permissions or not */
+static struct lp_ring* lp_ring_map(const char* name, int flags, mode_t mode)
+{
+    struct lp_ring* ring;
+    int fd;
+    
+    ring = calloc(1, sizeof(struct lp_ring));
+    if (ring == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    strncpy(ring->name, name, sizeof(ring->name) - 1);
+    
+    // a ring left by a previous publisher gets the permissions asked for too
+    fd = shm_open(name, flags, mode);
+    if (fd < 0 || ((flags & O_CREAT) && (fchmod(fd, mode) < 0 || ftruncate(fd, sizeof(struct lp_ring_region)) < 0))) {
+	fprintf(stderr, "could not open the shared memory %s\n", name);
+	if (fd >= 0) {
+	    close(fd);
+	}
+	free(ring);
+	return NULL;
+    }
+    
+    ring->region = mmap(NULL, sizeof(struct lp_ring_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring->region == MAP_FAILED) {
+	fprintf(stderr, "could not map the shared memory %s\n", name);
+	free(ring);
+	return NULL;
+    }
+    
+    return ring;
+}
+
+struct lp_ring* lp_ring_create(const char* name)
+{
+    const char* mode = getenv("LP_RING_MODE");
+    struct lp_ring* ring = lp_ring_map(name, O_RDWR | O_CREAT, mode != NULL ? strtol(mode, NULL, 8) : LP_RING_MODE);
+    
+    if (ring == NULL) {
+	return NULL;
+    }
+    ring->owner = true;
+    
+    // a ring left by a previous publisher starts again from scratch
+    memset(ring->region, 0, sizeof(struct lp_ring_region));
+    __atomic_store_n(&ring->region->magic, LP_RING_MAGIC, __ATOMIC_RELEASE);
+    return ring;
+}
+
+struct lp_ring* lp_ring_attach(const char* name)
+{
+    struct lp_ring* ring = lp_ring_map(name, O_RDWR, 0);
+    
+    if (ring == NULL) {
+	return NULL;
+    }
+    if (__atomic_load_n(&ring->region->magic, __ATOMIC_ACQUIRE) != LP_RING_MAGIC) {
+	fprintf(stderr, "%s is not a launchpad input ring\n", name);
+	lp_ring_close(ring);
+	return NULL;
+    }
+    
+    ring->cursor = __atomic_load_n(&ring->region->head, __ATOMIC_ACQUIRE);
+    return ring;
+}
+
+void lp_ring_close(struct lp_ring* ring)
+{
+    munmap(ring->region, sizeof(struct lp_ring_region));
+    if (ring->owner) {
+	shm_unlink(ring->name);
+    }
+    free(ring);
+}
+
+void lp_ring_publish(struct lp_ring* ring, const struct lp_event* events, int n)
+{
+    struct lp_ring_region* region = ring->region;
+    struct lp_ring_slot* slot;
+    uint64_t head = ring->head;
+    int i;
+    
+    if (n <= 0) {
+	return;
+    }
+    
+    // each slot is marked while written, so that a reader lapped by the
+    // writer notices
+    for (i = 0; i < n; i++, head++) {
+	slot = &region->slots[head % LP_RING_SIZE];
+	__atomic_store_n(&slot->sequence, 2 * head + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->event = events[i];
+	__atomic_store_n(&slot->sequence, 2 * head + 2, __ATOMIC_RELEASE);
+    }
+    ring->head = head;
+    __atomic_store_n(&region->head, head, __ATOMIC_RELEASE);
+    
+    // only a system call when someone sleeps
+    __atomic_add_fetch(&region->signal, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&region->waiters, __ATOMIC_SEQ_CST) > 0) {
+	syscall(SYS_futex, &region->signal, FUTEX_WAKE, 1 << 30, NULL, NULL, 0);
+    }
+}
+
+int lp_ring_read(struct lp_ring* ring, struct lp_event* events, int max)
+{
+    struct lp_ring_region* region = ring->region;
+    struct lp_ring_slot* slot;
+    uint64_t head, sequence;
+    int n = 0;
+    
+    head = __atomic_load_n(&region->head, __ATOMIC_ACQUIRE);
+    while (n < max && ring->cursor < head) {
+	// lapped: skip to the oldest event still there
+	if (head - ring->cursor > LP_RING_SIZE) {
+	    ring->lost += head - ring->cursor - LP_RING_SIZE;
+	    ring->cursor = head - LP_RING_SIZE;
+	}
+	
+	slot = &region->slots[ring->cursor % LP_RING_SIZE];
+	sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+	if (sequence == 2 * ring->cursor + 2) {
+	    events[n] = slot->event;
+	    
+	    // the copy is good if the writer did not come back meanwhile
+	    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	    if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence) {
+		n++;
+		ring->cursor++;
+		continue;
+	    }
+	}
+	
+	// overwritten while reading it: look at the head again
+	ring->lost++;
+	ring->cursor++;
+	head = __atomic_load_n(&region->head, __ATOMIC_ACQUIRE);
+    }
+    
+    ring->read += n;
+    return n;
+}
+
+int lp_ring_wait(struct lp_ring* ring, int timeout)
+{
+    struct lp_ring_region* region = ring->region;
+    struct timespec relative;
+    uint32_t signal = __atomic_load_n(&region->signal, __ATOMIC_SEQ_CST);
+    
+    if (__atomic_load_n(&region->head, __ATOMIC_ACQUIRE) != ring->cursor) {
+	return true;
+    }
+    
+    // the publisher bumps signal after head, so nothing is missed between the
+    // check and the sleep
+    relative.tv_sec = timeout / 1000;
+    relative.tv_nsec = timeout % 1000 * 1000000L;
+    __atomic_add_fetch(&region->waiters, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &region->signal, FUTEX_WAIT, signal, &relative, NULL, 0);
+    __atomic_sub_fetch(&region->waiters, 1, __ATOMIC_SEQ_CST);
+    
+    return __atomic_load_n(&region->head, __ATOMIC_ACQUIRE) != ring->cursor;
+}
@@ -0,0 +1,116 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPRING_H
+#define LPRING_H
+
+#include "liblaunchpad.h"
+#include <stdint.h>
+
+// name of the ring, unless given another
+#define LP_RING_NAME "/launchpad-input"
+
+// first bytes of a ring, to recognize it
+#define LP_RING_MAGIC 0x4C504952
+
+// events kept in the ring, a power of two
+#define LP_RING_SIZE 1024
+
+// permissions of a ring, unless LP_RING_MODE gives others in octal
+#define LP_RING_MODE 0600
+
+/**
+ * a slot of the ring
+ */
+struct lp_ring_slot {
+    uint64_t sequence;		//! 2n + 1 while the event n is written, 2n + 2 once written
+    struct lp_event event;	//! the event
+};
+
+/**
+ * the shared memory region: one process publishes the events, and any amount
+ * of readers follow them at their own pace. a reader too slow loses the
+ * events overwritten meanwhile, and knows how many.
+ */
+struct lp_ring_region {
+    uint32_t magic;				//! LP_RING_MAGIC
+    uint32_t signal;				//! bumped with each batch published, readers sleep on it
+    uint32_t waiters;				//! readers sleeping
+    uint32_t padding;
+    uint64_t head;				//! events published, as the publisher counts them
+    struct lp_ring_slot slots[LP_RING_SIZE];	//! the last events published
+};
+
+/**
+ * a mapped ring, published to or read from
+ */
+struct lp_ring {
+    char name[64];			//! name of the ring
+    struct lp_ring_region* region;	//! the mapping
+    int owner;				//! whether this process publishes, and removes the ring
+    uint64_t head;			//! events published, for the publisher. the readers may write the region
+    uint64_t cursor;			//! next event to read
+    unsigned long read;			//! events read
+    unsigned long lost;			//! events overwritten before being read
+};
+
+/** create a ring to publish events to
+ *
+ * only the user may read the ring, unless the LP_RING_MODE environment
+ * variable gives other permissions, like 0660 for the group.
+ * \return the ring, or NULL when it could not be created
+ */
+struct lp_ring* lp_ring_create(const char* name);
+
+/** attach to a ring published by another process. the reader starts with the
+ * next event published
+ *
+ * \return the ring, or NULL when there is none
+ */
+struct lp_ring* lp_ring_attach(const char* name);
+
+/** detach from a ring, removing it when this process created it
+ */
+void lp_ring_close(struct lp_ring* ring);
+
+/** publish events, and wake the readers sleeping
+ */
+void lp_ring_publish(struct lp_ring* ring, const struct lp_event* events, int n);
+
+/** read the events published since the previous read, without waiting
+ *
+ * \return the amount of events read
+ */
+int lp_ring_read(struct lp_ring* ring, struct lp_event* events, int max);
+
+/** wait for events to read
+ *
+ * \param timeout in ms
+ * \return whether there are events to read
+ */
+int lp_ring_wait(struct lp_ring* ring, int timeout);
+
+#endif
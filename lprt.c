@@ -0,0 +1,250 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// for the affinity and the default stack size of the threads
+#define _GNU_SOURCE
+
+#include "lprt.h"
+#include "liblaunchpad.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// size of the pages touched on the stack
+#define LP_RT_PAGE 4096
+
+// most cpus the threads can be pinned to
+#define LP_RT_CPUS 64
+
+static struct lp_rt_config lp_rt = {false, LP_RT_PRIORITY, 0};
+static struct lp_rt_stats lp_rt_stats;
+
+// whether the refusals were reported already
+static int lp_rt_warned_priority;
+static int lp_rt_warned_cpus;
+
+int lp_rt_configure(const char* spec)
+{
+    char copy[256];
+    char *name, *value, *save, *end;
+    long first, last;
+    
+    strncpy(copy, spec, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = 0;
+    
+    for (name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+	value = strchr(name, '=');
+	if (value == NULL) {
+	    return -1;
+	}
+	*value++ = 0;
+	
+	if (strcmp(name, "priority") == 0) {
+	    lp_rt.priority = atoi(value);
+	    if (lp_rt.priority < 1 || lp_rt.priority > 99) {
+		return -1;
+	    }
+	} else if (strcmp(name, "cpu") == 0) {
+	    first = last = strtol(value, &end, 10);
+	    if (*end == '-') {
+		last = strtol(end + 1, &end, 10);
+	    }
+	    if (end == value || *end != 0 || first < 0 || last < first || last >= LP_RT_CPUS) {
+		return -1;
+	    }
+	    for (; first <= last; first++) {
+		lp_rt.cpus |= 1ULL << first;
+	    }
+	} else {
+	    return -1;
+	}
+    }
+    
+    lp_rt.enabled = true;
+    return 0;
+}
+
+/* touch the stack the thread will use, so that it is mapped before it's
+ * needed. returns what was read back, 0 */
+static int __attribute__((noinline)) lp_rt_prefault()
+{
+    unsigned char stack[LP_RT_STACK];
+    volatile unsigned char* touch = stack;
+    unsigned char sum = 0;
+    int i;
+    
+    // through a volatile pointer, and read back, so the writes stay
+    for (i = 0; i < LP_RT_STACK; i += LP_RT_PAGE) {
+	touch[i] = 0;
+    }
+    for (i = 0; i < LP_RT_STACK; i += LP_RT_PAGE) {
+	sum |= touch[i];
+    }
+    return sum;
+}
+
+/* whether the process may lock all the memory it needs */
+static int lp_rt_lockable()
+{
+    struct rlimit limit;
+    
+    if (geteuid() == 0 || getrlimit(RLIMIT_MEMLOCK, &limit) != 0) {
+	return true;
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < LP_RT_MEMORY) {
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_MEMLOCK, &limit);
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < LP_RT_MEMORY) {
+	fprintf(stderr, "real-time: the memory lock limit is %llu KB, memory is not locked\n",
+		(unsigned long long)limit.rlim_cur / 1024);
+	return false;
+    }
+    return true;
+}
+
+int lp_rt_start()
+{
+    pthread_attr_t attr;
+    
+    if (!lp_rt.enabled) {
+	return 0;
+    }
+    
+    // a single arena, never trimmed nor mapped apart: freed memory is kept
+    // locked for the next allocations
+    mallopt(M_ARENA_MAX, 1);
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    
+    // the stacks of the threads are locked whole
+    if (pthread_attr_init(&attr) == 0) {
+	pthread_attr_setstacksize(&attr, LP_RT_THREAD_STACK);
+	pthread_setattr_default_np(&attr);
+	pthread_attr_destroy(&attr);
+    }
+    
+    if (!lp_rt_lockable()) {
+	return -1;
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+	fprintf(stderr, "real-time: could not lock memory, error %d\n", errno);
+	return -1;
+    }
+    lp_rt_prefault();
+    lp_rt_stats.locked = true;
+    
+    return 0;
+}
+
+void lp_rt_stop()
+{
+    if (lp_rt_stats.locked) {
+	munlockall();
+    }
+    memset(&lp_rt_stats, 0, sizeof(lp_rt_stats));
+    lp_rt.enabled = false;
+}
+
+int lp_rt_thread(enum lp_rt_role role)
+{
+    struct sched_param param;
+    cpu_set_t cpus;
+    int err, i;
+    
+    if (!lp_rt.enabled) {
+	return 0;
+    }
+    lp_rt_prefault();
+    
+    // the input threads first, the others just below them
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = lp_rt.priority - role;
+    if (param.sched_priority < sched_get_priority_min(SCHED_FIFO)) {
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    }
+    err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+	if (!__atomic_exchange_n(&lp_rt_warned_priority, true, __ATOMIC_RELAXED)) {
+	    fprintf(stderr, "real-time: could not get priority %d, error %d\n", param.sched_priority, err);
+	}
+	__atomic_add_fetch(&lp_rt_stats.refused, 1, __ATOMIC_RELAXED);
+	return -1;
+    }
+    __atomic_add_fetch(&lp_rt_stats.threads, 1, __ATOMIC_RELAXED);
+    
+    if (lp_rt.cpus == 0) {
+	return 0;
+    }
+    CPU_ZERO(&cpus);
+    for (i = 0; i < LP_RT_CPUS; i++) {
+	if (lp_rt.cpus & (1ULL << i)) {
+	    CPU_SET(i, &cpus);
+	}
+    }
+    err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0) {
+	if (!__atomic_exchange_n(&lp_rt_warned_cpus, true, __ATOMIC_RELAXED)) {
+	    fprintf(stderr, "real-time: could not pin to the cpus, error %d\n", err);
+	}
+	__atomic_add_fetch(&lp_rt_stats.refused, 1, __ATOMIC_RELAXED);
+	return -1;
+    }
+    __atomic_add_fetch(&lp_rt_stats.pinned, 1, __ATOMIC_RELAXED);
+    
+    return 0;
+}
+
+void lp_rt_dump(FILE* out)
+{
+    int i;
+    
+    if (!lp_rt.enabled) {
+	fprintf(out, "real-time: off\n");
+	return;
+    }
+    
+    fprintf(out, "real-time: priority %d, cpus", lp_rt.priority);
+    if (lp_rt.cpus == 0) {
+	fprintf(out, " any");
+    }
+    for (i = 0; i < LP_RT_CPUS; i++) {
+	if (lp_rt.cpus & (1ULL << i)) {
+	    fprintf(out, " %d", i);
+	}
+    }
+    fprintf(out, ", memory %s, %d threads, %d pinned, %d refused\n",
+	    lp_rt_stats.locked ? "locked" : "not locked",
+	    __atomic_load_n(&lp_rt_stats.threads, __ATOMIC_RELAXED),
+	    __atomic_load_n(&lp_rt_stats.pinned, __ATOMIC_RELAXED),
+	    __atomic_load_n(&lp_rt_stats.refused, __ATOMIC_RELAXED));
+}
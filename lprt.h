@@ -0,0 +1,116 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPRT_H
+#define LPRT_H
+
+#include <stdio.h>
+
+// priority of the usb and dispatch threads by default, out of 1 to 99. the
+// writer and the timer threads run just below
+#define LP_RT_PRIORITY 80
+
+// stack touched by each real-time thread before it runs, in bytes
+#define LP_RT_STACK (128 * 1024)
+
+// stack of the threads started once memory is locked, in bytes. all of it is
+// locked, so it is kept well below the default
+#define LP_RT_THREAD_STACK (1024 * 1024)
+
+// memory the process may need to lock, in bytes. below this limit memory is
+// not locked at all, rather than failing the allocations later
+#define LP_RT_MEMORY (64 * 1024 * 1024)
+
+/**
+ * what a thread does, which sets its priority in real-time mode
+ */
+enum lp_rt_role {
+    lp_rt_input,	//! handles the usb events and dispatches the clients' messages
+    lp_rt_output,	//! writes to the launchpads
+    lp_rt_timer		//! the scheduler, animations, dithering and shared frames
+};
+
+/**
+ * the real-time mode, off unless configured
+ */
+struct lp_rt_config {
+    int enabled;		//! whether the mode was asked for
+    int priority;		//! SCHED_FIFO priority of the input threads
+    unsigned long long cpus;	//! the cpus the threads are pinned to, as a mask, 0 for any
+};
+
+/**
+ * what real-time mode achieved
+ */
+struct lp_rt_stats {
+    int locked;		//! whether memory is locked
+    int threads;	//! threads running with a real-time priority
+    int pinned;		//! threads pinned to the cpus
+    int refused;	//! threads which could not get their priority or cpus
+};
+
+/** turn real-time mode on
+ *
+ * \param spec a comma separated list of name=value, of priority, the
+ * priority of the input threads, and of cpu, a cpu or a range of cpus like
+ * 2-3 the threads are pinned to, which can be given several times. an empty
+ * spec keeps the defaults
+ * \return 0, or -1 if the spec isn't understood
+ */
+int lp_rt_configure(const char* spec);
+
+/** lock the memory of the process, before the threads are started
+ *
+ * the memory mapped so far and from now on stays in ram, and freed memory is
+ * kept for the next allocations, so that neither the threads nor the buffers
+ * fault once running. nothing is done unless real-time mode is on.
+ * \return 0, or -1 if memory could not be locked: a warning is printed and
+ * the program runs unlocked
+ */
+int lp_rt_start();
+
+/** undo lp_rt_start and turn real-time mode off
+ *
+ * the threads keep their priority and cpus.
+ */
+void lp_rt_stop();
+
+/** give the calling thread its real-time priority and cpus
+ *
+ * called first thing by each thread of the library and by the loops of the
+ * bridges, after the threads they start are started, since these would
+ * inherit the priority. the stack is touched so that it doesn't fault later.
+ * nothing is done unless real-time mode is on.
+ * \return 0, or -1 if the priority or cpus were refused: a warning is printed
+ * the first time, and the thread runs as it was
+ */
+int lp_rt_thread(enum lp_rt_role role);
+
+/** print what real-time mode achieved
+ */
+void lp_rt_dump(FILE* out);
+
+#endif
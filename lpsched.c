@@ -0,0 +1,254 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpsched.h"
+#include "lprt.h"
+#include <string.h>
+
+/* whether an update goes before another */
+static int lp_sched_before(const struct lp_sched_entry* a, const struct lp_sched_entry* b)
+{
+    return a->due < b->due || (a->due == b->due && a->order < b->order);
+}
+
+/* add an update to the heap. the lock is held */
+static void lp_sched_push(struct lp_sched* sched, const struct lp_sched_entry* entry)
+{
+    struct lp_sched_entry* heap = sched->heap;
+    int i = sched->count++;
+    
+    // move the parents down until the entry fits
+    while (i > 0 && lp_sched_before(entry, &heap[(i - 1) / 2])) {
+	heap[i] = heap[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    heap[i] = *entry;
+}
+
+/* remove the first update of the heap. the lock is held */
+static void lp_sched_pop(struct lp_sched* sched, struct lp_sched_entry* entry)
+{
+    struct lp_sched_entry* heap = sched->heap;
+    struct lp_sched_entry* last = &heap[--sched->count];
+    int i = 0;
+    int child;
+    
+    *entry = heap[0];
+    
+    // move the children up until the last entry fits
+    while ((child = 2 * i + 1) < sched->count) {
+	if (child + 1 < sched->count && lp_sched_before(&heap[child + 1], &heap[child])) {
+	    child++;
+	}
+	if (!lp_sched_before(&heap[child], last)) {
+	    break;
+	}
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = *last;
+}
+
+/* apply a batch of updates. the grid's lock is held */
+static void lp_sched_apply(struct lp_sched* sched, const struct lp_sched_entry* batch, int n)
+{
+    int i;
+    
+    for (i = 0; i < n; i++) {
+	if (batch[i].device < 0) {
+	    lp_grid_swap(sched->grid);
+	} else {
+	    lp_grid_send3(sched->grid, batch[i].device,
+			  batch[i].message[0], batch[i].message[1], batch[i].message[2]);
+	}
+    }
+    lp_grid_flush(sched->grid);
+}
+
+static void* lp_sched_run(void* data)
+{
+    struct lp_sched* sched = data;
+    struct lp_sched_entry batch[LP_EVENTS];
+    struct timespec until;
+    unsigned long long now;
+    int n;
+    
+    lp_rt_thread(lp_rt_timer);
+    pthread_mutex_lock(&sched->lock);
+    
+    while (sched->running) {
+	if (sched->count == 0) {
+	    pthread_cond_wait(&sched->changed, &sched->lock);
+	    continue;
+	}
+	
+	// sleep until the first update is due, or until an earlier one comes
+	now = lp_now();
+	if (sched->heap[0].due > now) {
+	    until.tv_sec = sched->heap[0].due / 1000000000ULL;
+	    until.tv_nsec = sched->heap[0].due % 1000000000ULL;
+	    pthread_cond_timedwait(&sched->changed, &sched->lock, &until);
+	    continue;
+	}
+	
+	// take everything due, and apply it in one flush
+	for (n = 0; n < LP_EVENTS && sched->count > 0 && sched->heap[0].due <= now; n++) {
+	    lp_sched_pop(sched, &batch[n]);
+	    lp_histogram_record(&sched->jitter, now - batch[n].due);
+	}
+	sched->stats.released += n;
+	sched->stats.flushes++;
+	pthread_mutex_unlock(&sched->lock);
+	
+	lp_grid_lock(sched->grid);
+	lp_sched_apply(sched, batch, n);
+	lp_grid_unlock(sched->grid);
+	
+	pthread_mutex_lock(&sched->lock);
+    }
+    
+    pthread_mutex_unlock(&sched->lock);
+    return NULL;
+}
+
+struct lp_sched* lp_sched_start(struct lp_grid* grid, enum lp_late late, unsigned long long tolerance)
+{
+    struct lp_sched* sched;
+    pthread_condattr_t attr;
+    int err;
+    
+    sched = calloc(1, sizeof(struct lp_sched));
+    if (sched == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    sched->grid = grid;
+    sched->late = late;
+    sched->tolerance = tolerance;
+    sched->jitter.name = "release delay";
+    sched->running = true;
+    
+    // timed waits follow lp_now
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sched->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    err = pthread_create(&sched->thread, NULL, lp_sched_run, sched);
+    if (err) {
+	fprintf(stderr, "failed to start the scheduler thread, with error %d\n", err);
+	free(sched);
+	return NULL;
+    }
+    
+    return sched;
+}
+
+void lp_sched_stop(struct lp_sched* sched)
+{
+    pthread_mutex_lock(&sched->lock);
+    sched->running = false;
+    pthread_cond_signal(&sched->changed);
+    pthread_mutex_unlock(&sched->lock);
+    
+    pthread_join(sched->thread, NULL);
+    pthread_cond_destroy(&sched->changed);
+    pthread_mutex_destroy(&sched->lock);
+    free(sched);
+}
+
+/* schedule an update, applying the policy for late ones */
+static int lp_sched_add(struct lp_sched* sched, struct lp_sched_entry* entry)
+{
+    unsigned long long now = lp_now();
+    
+    pthread_mutex_lock(&sched->lock);
+    sched->stats.scheduled++;
+    
+    if (entry->due + sched->tolerance < now) {
+	sched->stats.late++;
+	if (sched->late == lp_late_drop) {
+	    sched->stats.dropped++;
+	    pthread_mutex_unlock(&sched->lock);
+	    return 0;
+	}
+	
+	// due right away, along with whatever else is due
+	entry->due = now;
+    }
+    
+    if (sched->count == LP_SCHED_SIZE) {
+	sched->stats.dropped++;
+	pthread_mutex_unlock(&sched->lock);
+	return 0;
+    }
+    
+    entry->order = sched->order++;
+    lp_sched_push(sched, entry);
+    
+    // the thread only needs waking when the first update changed
+    if (sched->heap[0].order == entry->order) {
+	pthread_cond_signal(&sched->changed);
+    }
+    
+    pthread_mutex_unlock(&sched->lock);
+    return 3;
+}
+
+int lp_sched_send3(struct lp_sched* sched, unsigned long long due, int device,
+		   unsigned int data0, unsigned int data1, unsigned int data2)
+{
+    struct lp_sched_entry entry;
+    
+    entry.due = due;
+    entry.device = device;
+    entry.message[0] = data0;
+    entry.message[1] = data1;
+    entry.message[2] = data2;
+    return lp_sched_add(sched, &entry);
+}
+
+int lp_sched_swap(struct lp_sched* sched, unsigned long long due)
+{
+    struct lp_sched_entry entry;
+    
+    entry.due = due;
+    entry.device = -1;
+    memset(entry.message, 0, sizeof(entry.message));
+    return lp_sched_add(sched, &entry);
+}
+
+int lp_sched_pending(struct lp_sched* sched)
+{
+    int count;
+    
+    pthread_mutex_lock(&sched->lock);
+    count = sched->count;
+    pthread_mutex_unlock(&sched->lock);
+    
+    return count;
+}
@@ -0,0 +1,117 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPSCHED_H
+#define LPSCHED_H
+
+#include "lpgrid.h"
+#include "lptrace.h"
+
+// most updates waiting for their time
+#define LP_SCHED_SIZE 4096
+
+/**
+ * what to do with updates which are already late when scheduled
+ */
+enum lp_late {
+    lp_late_merge,	//! apply them with the next updates released
+    lp_late_drop	//! forget them
+};
+
+/**
+ * an update waiting for its time
+ */
+struct lp_sched_entry {
+    unsigned long long due;	//! when to apply it, see lp_now
+    unsigned long order;	//! order of scheduling, for updates due at the same time
+    int device;			//! launchpad of the grid, or -1 to swap all of them
+    unsigned char message[3];	//! message to stage
+};
+
+/**
+ * counters of the scheduler
+ */
+struct lp_sched_stats {
+    unsigned long scheduled;	//! updates scheduled
+    unsigned long released;	//! updates applied
+    unsigned long late;		//! updates already late when scheduled
+    unsigned long dropped;	//! updates dropped, late or because the scheduler was full
+    unsigned long flushes;	//! batches released
+};
+
+/**
+ * a thread applying updates to a grid at their due time.
+ *
+ * updates are kept in a heap ordered by due time. the thread sleeps until the
+ * first one is due, then stages all the updates due by then and flushes them
+ * at once. programs staging updates on the same grid from other threads must
+ * hold the grid's lock, see lp_grid_lock.
+ */
+struct lp_sched {
+    struct lp_grid* grid;			//! where updates are applied
+    pthread_mutex_t lock;			//! protects everything below
+    pthread_cond_t changed;			//! signalled when the first update changes
+    pthread_t thread;				//! thread applying the updates
+    int running;				//! whether the thread runs
+    struct lp_sched_entry heap[LP_SCHED_SIZE];	//! updates, the first one due first
+    int count;					//! amount of updates
+    unsigned long order;			//! order given to the next update
+    enum lp_late late;				//! policy for late updates
+    unsigned long long tolerance;		//! how late an update may be before the policy applies, in ns
+    struct lp_sched_stats stats;		//! counters
+    struct lp_histogram jitter;			//! delay between the due time and the release
+};
+
+/** start a scheduler
+ *
+ * \param late what to do with late updates
+ * \param tolerance how late an update may be before the policy applies, in
+ * nanoseconds
+ * \return the scheduler, or NULL when it could not start
+ */
+struct lp_sched* lp_sched_start(struct lp_grid* grid, enum lp_late late, unsigned long long tolerance);
+
+/** stop the scheduler and forget the updates left
+ */
+void lp_sched_stop(struct lp_sched* sched);
+
+/** schedule a message for a launchpad of the grid
+ *
+ * \param due when to apply it, see lp_now
+ * \return 3 when the message was scheduled, 0 when it was dropped
+ */
+int lp_sched_send3(struct lp_sched* sched, unsigned long long due, int device,
+		   unsigned int data0, unsigned int data1, unsigned int data2);
+
+/** schedule a swap of all the launchpads, see lp_grid_swap
+ */
+int lp_sched_swap(struct lp_sched* sched, unsigned long long due);
+
+/** amount of updates waiting
+ */
+int lp_sched_pending(struct lp_sched* sched);
+
+#endif
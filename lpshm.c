@@ -0,0 +1,319 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpshm.h"
+#include "lprt.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* sleep while a word keeps a value, at most timeout ms */
+static void lp_shm_wait(uint32_t* word, uint32_t value, int timeout)
+{
+    struct timespec relative;
+    
+    relative.tv_sec = timeout / 1000;
+    relative.tv_nsec = timeout % 1000 * 1000000L;
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &relative, NULL, 0);
+}
+
+/* wake the processes sleeping on a word */
+static void lp_shm_wake(uint32_t* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, 1 << 30, NULL, NULL, 0);
+}
+
+/* wait for a writer to finish its frame. yield a few times, then sleep, so
+ * that a writer of a lower priority on the same cpu gets to run */
+static void lp_shm_pause(struct lp_shm_frame* frame, uint32_t sequence, int* spins)
+{
+    if (++*spins < LP_SHM_SPINS) {
+	sched_yield();
+    } else {
+	lp_shm_wait(&frame->sequence, sequence, LP_SHM_NAP);
+    }
+}
+
+/* end the frame of a writer which stopped in the middle of it, a process
+ * killed for instance, once the sequence stayed odd for LP_SHM_TIMEOUT.
+ * returns whether it did */
+static int lp_shm_recover(struct lp_shm* shm, uint32_t sequence)
+{
+    struct lp_shm_frame* frame = shm->frame;
+    unsigned long long now = lp_now();
+    
+    if (sequence != shm->stuck) {
+	shm->stuck = sequence;
+	shm->stuck_since = now;
+	return false;
+    }
+    if (now - shm->stuck_since < LP_SHM_TIMEOUT * 1000000ULL) {
+	return false;
+    }
+    
+    // the leds it wrote are flushed as a frame of their own
+    if (__atomic_compare_exchange_n(&frame->sequence, &sequence, sequence + 1,
+				    false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	fprintf(stderr, "a writer of %s stopped in the middle of a frame\n", shm->name);
+	__atomic_add_fetch(&frame->generation, 1, __ATOMIC_SEQ_CST);
+	shm->stats.recovered++;
+    }
+    return true;
+}
+
+/* map a region, creating it with the given permissions or not */
+static struct lp_shm* lp_shm_map(const char* name, int flags, mode_t mode)
+{
+    struct lp_shm* shm;
+    int fd;
+    
+    shm = calloc(1, sizeof(struct lp_shm));
+    if (shm == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return NULL;
+    }
+    strncpy(shm->name, name, sizeof(shm->name) - 1);
+    
+    // a region left by a previous server gets the permissions asked for too
+    fd = shm_open(name, flags, mode);
+    if (fd < 0 || ((flags & O_CREAT) && (fchmod(fd, mode) < 0 || ftruncate(fd, sizeof(struct lp_shm_frame)) < 0))) {
+	fprintf(stderr, "could not open the shared memory %s\n", name);
+	if (fd >= 0) {
+	    close(fd);
+	}
+	free(shm);
+	return NULL;
+    }
+    
+    shm->frame = mmap(NULL, sizeof(struct lp_shm_frame), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm->frame == MAP_FAILED) {
+	fprintf(stderr, "could not map the shared memory %s\n", name);
+	free(shm);
+	return NULL;
+    }
+    
+    return shm;
+}
+
+uint32_t lp_shm_read(struct lp_shm* shm, unsigned char leds[][LP_LEDS])
+{
+    struct lp_shm_frame* frame = shm->frame;
+    uint32_t sequence, generation, devices;
+    int spins = 0;
+    
+    for (;;) {
+	sequence = __atomic_load_n(&frame->sequence, __ATOMIC_ACQUIRE);
+	if (sequence & 1) {
+	    shm->stats.retries++;
+	    if (shm->grid == NULL || !lp_shm_recover(shm, sequence)) {
+		lp_shm_pause(frame, sequence, &spins);
+	    }
+	    continue;
+	}
+	
+	generation = __atomic_load_n(&frame->generation, __ATOMIC_RELAXED);
+	// the count is written by the clients too: the server copies its own
+	// launchpads, and nobody copies more than the region holds
+	devices = shm->grid != NULL ? shm->grid->count : __atomic_load_n(&frame->devices, __ATOMIC_RELAXED);
+	if (devices > LP_GRID_DEVICES) {
+	    devices = LP_GRID_DEVICES;
+	}
+	memcpy(leds, frame->leds, devices * LP_LEDS);
+	
+	// the copy is good if no writer started meanwhile
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&frame->sequence, __ATOMIC_RELAXED) == sequence) {
+	    return generation;
+	}
+	shm->stats.retries++;
+    }
+}
+
+/* stage the leds which changed since the previous frame. the grid's lock is held */
+static int lp_shm_stage(struct lp_shm* shm, unsigned char leds[][LP_LEDS])
+{
+    int device, led;
+    int staged = 0;
+    
+    for (device = 0; device < shm->grid->count; device++) {
+	for (led = 0; led < LP_LEDS; led++) {
+	    if (leds[device][led] == shm->shown[device][led]) {
+		continue;
+	    }
+	    shm->shown[device][led] = leds[device][led];
+	    staged++;
+	    
+	    if (led < 64) {
+		lp_grid_send3(shm->grid, device, NOTE, led / 8 * 16 + led % 8, leds[device][led]);
+	    } else if (led < 72) {
+		lp_grid_send3(shm->grid, device, NOTE, (led - 64) * 16 + 8, leds[device][led]);
+	    } else {
+		lp_grid_send3(shm->grid, device, CTRL, 104 + led - 72, leds[device][led]);
+	    }
+	}
+    }
+    
+    return staged;
+}
+
+static void* lp_shm_run(void* data)
+{
+    struct lp_shm* shm = data;
+    struct lp_shm_frame* frame = shm->frame;
+    unsigned char leds[LP_GRID_DEVICES][LP_LEDS];
+    uint32_t generation, sequence;
+    
+    lp_rt_thread(lp_rt_timer);
+    while (shm->running) {
+	generation = __atomic_load_n(&frame->generation, __ATOMIC_ACQUIRE);
+	
+	// sleep until a frame is committed. writers only wake the server when
+	// it says it sleeps, and it checks again once it said so
+	if (generation == shm->flushed) {
+	    __atomic_store_n(&frame->waiting, 1, __ATOMIC_SEQ_CST);
+	    if (__atomic_load_n(&frame->generation, __ATOMIC_SEQ_CST) == shm->flushed) {
+		lp_shm_wait(&frame->generation, shm->flushed, LP_SHM_TIMEOUT);
+	    }
+	    __atomic_store_n(&frame->waiting, 0, __ATOMIC_SEQ_CST);
+	    
+	    // a writer gone in the middle of a frame commits nothing
+	    sequence = __atomic_load_n(&frame->sequence, __ATOMIC_ACQUIRE);
+	    if (sequence & 1) {
+		lp_shm_recover(shm, sequence);
+	    }
+	    continue;
+	}
+	
+	generation = lp_shm_read(shm, leds);
+	shm->stats.merged += generation - shm->flushed - 1;
+	shm->flushed = generation;
+	shm->stats.frames++;
+	
+	lp_grid_lock(shm->grid);
+	shm->stats.leds += lp_shm_stage(shm, leds);
+	lp_grid_flush(shm->grid);
+	lp_grid_unlock(shm->grid);
+    }
+    
+    return NULL;
+}
+
+struct lp_shm* lp_shm_serve(struct lp_grid* grid, const char* name)
+{
+    const char* mode = getenv("LP_SHM_MODE");
+    struct lp_shm* shm;
+    int err;
+    
+    shm = lp_shm_map(name, O_RDWR | O_CREAT, mode != NULL ? strtol(mode, NULL, 8) : LP_SHM_MODE);
+    
+    if (shm == NULL) {
+	return NULL;
+    }
+    shm->grid = grid;
+    shm->running = true;
+    memset(shm->shown, LED_UNKNOWN, sizeof(shm->shown));
+    
+    // a region left by a previous server starts again from scratch
+    memset(shm->frame, 0, sizeof(struct lp_shm_frame));
+    shm->frame->devices = grid->count;
+    __atomic_store_n(&shm->frame->magic, LP_SHM_MAGIC, __ATOMIC_RELEASE);
+    
+    err = pthread_create(&shm->thread, NULL, lp_shm_run, shm);
+    if (err) {
+	fprintf(stderr, "failed to start the shared memory thread, with error %d\n", err);
+	munmap(shm->frame, sizeof(struct lp_shm_frame));
+	shm_unlink(name);
+	free(shm);
+	return NULL;
+    }
+    
+    return shm;
+}
+
+void lp_shm_stop(struct lp_shm* shm)
+{
+    shm->running = false;
+    lp_shm_wake(&shm->frame->generation);
+    pthread_join(shm->thread, NULL);
+    
+    shm_unlink(shm->name);
+    lp_shm_detach(shm);
+}
+
+struct lp_shm* lp_shm_attach(const char* name)
+{
+    struct lp_shm* shm = lp_shm_map(name, O_RDWR, 0);
+    
+    if (shm != NULL && __atomic_load_n(&shm->frame->magic, __ATOMIC_ACQUIRE) != LP_SHM_MAGIC) {
+	fprintf(stderr, "%s is not a launchpad frame\n", name);
+	lp_shm_detach(shm);
+	return NULL;
+    }
+    
+    return shm;
+}
+
+void lp_shm_detach(struct lp_shm* shm)
+{
+    munmap(shm->frame, sizeof(struct lp_shm_frame));
+    free(shm);
+}
+
+void lp_shm_begin(struct lp_shm* shm)
+{
+    uint32_t sequence;
+    int spins = 0;
+    
+    // take the odd sequence from an even one, waiting for other writers
+    for (;;) {
+	sequence = __atomic_load_n(&shm->frame->sequence, __ATOMIC_RELAXED);
+	if (!(sequence & 1) && __atomic_compare_exchange_n(&shm->frame->sequence, &sequence, sequence + 1,
+							   false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+	    shm->taken = sequence + 1;
+	    return;
+	}
+	lp_shm_pause(shm->frame, sequence, &spins);
+    }
+}
+
+void lp_shm_commit(struct lp_shm* shm)
+{
+    struct lp_shm_frame* frame = shm->frame;
+    uint32_t taken = shm->taken;
+    
+    // unless the server took this writer for gone, and ended the frame itself
+    __atomic_compare_exchange_n(&frame->sequence, &taken, taken + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&frame->generation, 1, __ATOMIC_SEQ_CST);
+    
+    if (__atomic_load_n(&frame->waiting, __ATOMIC_SEQ_CST)) {
+	lp_shm_wake(&frame->generation);
+    }
+}
@@ -0,0 +1,140 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPSHM_H
+#define LPSHM_H
+
+#include "lpgrid.h"
+#include <stdint.h>
+
+// name of the region, unless given another
+#define LP_SHM_NAME "/launchpad"
+
+// first bytes of a region, to recognize it
+#define LP_SHM_MAGIC 0x4C504642
+
+// permissions of a region, unless LP_SHM_MODE gives others in octal
+#define LP_SHM_MODE 0600
+
+// longest wait of the serving thread before checking whether to stop, in ms.
+// a writer in the middle of a frame for longer is taken for gone
+#define LP_SHM_TIMEOUT 100
+
+// times a reader or a writer yields while a writer writes, before sleeping
+#define LP_SHM_SPINS 64
+
+// sleep of a reader or a writer while a writer writes, in ms
+#define LP_SHM_NAP 1
+
+/**
+ * the shared memory region: the leds of each launchpad, guarded by a seqlock.
+ *
+ * a writer makes sequence odd while it writes, then even again, and bumps
+ * generation once its frame is complete. a reader copies the leds, and
+ * copies again if sequence was odd or changed meanwhile.
+ */
+struct lp_shm_frame {
+    uint32_t magic;				//! LP_SHM_MAGIC
+    uint32_t devices;				//! launchpads of the grid
+    uint32_t sequence;				//! odd while a writer writes
+    uint32_t generation;			//! frames committed
+    uint32_t waiting;				//! whether the server sleeps, waiting for a frame
+    unsigned char leds[LP_GRID_DEVICES][LP_LEDS];	//! velocities, indexed with LP_MATRIX_LED, LP_SCENE_LED and LP_CTRL_LED
+};
+
+/**
+ * counters of a served region
+ */
+struct lp_shm_stats {
+    unsigned long frames;	//! frames flushed
+    unsigned long merged;	//! frames committed while the previous one was flushed, and flushed with the next
+    unsigned long leds;		//! leds written
+    unsigned long retries;	//! copies done again because a writer was writing
+    unsigned long recovered;	//! frames left in the middle by a writer, and ended by the server
+};
+
+/**
+ * a mapped region, served or attached to
+ */
+struct lp_shm {
+    char name[64];				//! name of the region
+    struct lp_shm_frame* frame;			//! the mapping
+    struct lp_grid* grid;			//! the grid served, NULL for a client
+    pthread_t thread;				//! thread flushing the frames, for the server
+    int running;				//! whether the thread runs
+    uint32_t flushed;				//! generation last flushed
+    uint32_t taken;				//! odd sequence of the frame being written, for a client
+    uint32_t stuck;				//! odd sequence seen last, for the server
+    unsigned long long stuck_since;		//! when it was first seen
+    unsigned char shown[LP_GRID_DEVICES][LP_LEDS];	//! leds last flushed
+    struct lp_shm_stats stats;			//! counters, for the server
+};
+
+/** create a region for a grid, and a thread flushing the frames written to it
+ *
+ * only the user may use the region, unless the LP_SHM_MODE environment
+ * variable gives other permissions, like 0660 for the group. the thread
+ * stages the leds which changed since the previous frame, while holding the
+ * grid's lock, and flushes them at once. the leds written by other means are
+ * not known to it.
+ * \return the region, or NULL when it could not be created
+ */
+struct lp_shm* lp_shm_serve(struct lp_grid* grid, const char* name);
+
+/** stop serving a region, and remove it
+ */
+void lp_shm_stop(struct lp_shm* shm);
+
+/** attach to a region served by another process
+ *
+ * \return the region, or NULL when there is none
+ */
+struct lp_shm* lp_shm_attach(const char* name);
+
+/** detach from a region
+ */
+void lp_shm_detach(struct lp_shm* shm);
+
+/** start writing a frame: write to shm->frame->leds directly, then call
+ * lp_shm_commit. writers of several threads or processes take turns. a writer
+ * which does not commit within LP_SHM_TIMEOUT is taken for gone, and its
+ * frame ended by the server
+ */
+void lp_shm_begin(struct lp_shm* shm);
+
+/** end writing a frame, which the server flushes. the server is only woken,
+ * with a system call, when it sleeps
+ */
+void lp_shm_commit(struct lp_shm* shm);
+
+/** copy a consistent frame
+ *
+ * \param leds room for the leds of every launchpad
+ * \return the generation of the frame
+ */
+uint32_t lp_shm_read(struct lp_shm* shm, unsigned char leds[][LP_LEDS]);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lptrace.h"
+
+static struct lp_histogram queued = { "usb to parse" };
+static struct lp_histogram sent = { "parse to emit" };
+static struct lp_histogram total = { "usb to emit" };
+
+static const char* chrome_file = NULL;
+static struct lp_trace_event events[LP_TRACE_EVENTS];
+static unsigned long traced = 0;
+
+/* bucket of a latency */
+static int lp_bucket(unsigned long long latency)
+{
+    int e;
+    
+    if (latency < 16) {
+	return latency;
+    }
+    
+    // position of the highest bit, then the next 4 bits
+    e = 63 - __builtin_clzll(latency);
+    return (e - 3) * 16 + (latency >> (e - 4)) - 16;
+}
+
+/* lowest latency of a bucket */
+static unsigned long long lp_bucket_value(int bucket)
+{
+    if (bucket < 16) {
+	return bucket;
+    }
+    
+    return (unsigned long long) (bucket % 16 + 16) << (bucket / 16 - 1);
+}
+
+void lp_histogram_record(struct lp_histogram* histogram, unsigned long long latency)
+{
+    histogram->counts[lp_bucket(latency)]++;
+    histogram->total++;
+    if (latency > histogram->max) {
+	histogram->max = latency;
+    }
+}
+
+static void lp_record(struct lp_histogram* histogram, unsigned long long from, unsigned long long to)
+{
+    lp_histogram_record(histogram, to > from ? to - from : 0);
+}
+
+unsigned long long lp_histogram_percentile(const struct lp_histogram* histogram, double ratio)
+{
+    unsigned long seen = 0;
+    unsigned long wanted = histogram->total * ratio;
+    int i;
+    
+    for (i = 0; i < LP_BUCKETS; i++) {
+	seen += histogram->counts[i];
+	if (seen > wanted) {
+	    return lp_bucket_value(i);
+	}
+    }
+    
+    return histogram->max;
+}
+
+void lp_histogram_header(FILE* out)
+{
+    fprintf(out, "%-14s %10s %10s %10s %10s %10s %10s\n",
+	    "latency (us)", "events", "p50", "p90", "p99", "p99.9", "max");
+}
+
+void lp_histogram_print(FILE* out, const struct lp_histogram* histogram)
+{
+    fprintf(out, "%-14s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+	    histogram->name, histogram->total,
+	    lp_histogram_percentile(histogram, 0.50) / 1000.0,
+	    lp_histogram_percentile(histogram, 0.90) / 1000.0,
+	    lp_histogram_percentile(histogram, 0.99) / 1000.0,
+	    lp_histogram_percentile(histogram, 0.999) / 1000.0,
+	    histogram->max / 1000.0);
+}
+
+void lp_trace_start(struct launchpad* lp, const char* chrome)
+{
+    chrome_file = chrome;
+    lp->tracing = true;
+}
+
+void lp_trace(const struct lp_event* event, unsigned long long emitted)
+{
+    struct lp_trace_event* traced_event;
+    
+    lp_record(&queued, event->time, event->parsed);
+    lp_record(&sent, event->parsed, emitted);
+    lp_record(&total, event->time, emitted);
+    
+    if (chrome_file != NULL) {
+	traced_event = &events[traced % LP_TRACE_EVENTS];
+	traced_event->time = event->time;
+	traced_event->parsed = event->parsed;
+	traced_event->emitted = emitted;
+	traced_event->status = event->status;
+	traced_event->data1 = event->data1;
+	traced++;
+    }
+}
+
+void lp_trace_dump(FILE* out)
+{
+    lp_histogram_header(out);
+    lp_histogram_print(out, &queued);
+    lp_histogram_print(out, &sent);
+    lp_histogram_print(out, &total);
+    fflush(out);
+}
+
+void lp_trace_write()
+{
+    FILE* out;
+    unsigned long i;
+    struct lp_trace_event* event;
+    
+    if (chrome_file == NULL) {
+	return;
+    }
+    
+    out = fopen(chrome_file, "w");
+    if (out == NULL) {
+	fprintf(stderr, "could not open %s\n", chrome_file);
+	return;
+    }
+    
+    // one slice for each stage of the last events
+    fprintf(out, "[\n");
+    i = traced > LP_TRACE_EVENTS ? traced - LP_TRACE_EVENTS : 0;
+    for (; i < traced; i++) {
+	event = &events[i % LP_TRACE_EVENTS];
+	fprintf(out, "{\"name\":\"parse\",\"cat\":\"lp\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+		"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"status\":%d,\"data\":%d}},\n",
+		event->time / 1000.0, (event->parsed - event->time) / 1000.0,
+		event->status, event->data1);
+	fprintf(out, "{\"name\":\"emit\",\"cat\":\"lp\",\"ph\":\"X\",\"pid\":1,\"tid\":2,"
+		"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"status\":%d,\"data\":%d}}%s\n",
+		event->parsed / 1000.0, (event->emitted - event->parsed) / 1000.0,
+		event->status, event->data1, i + 1 < traced ? "," : "");
+    }
+    fprintf(out, "]\n");
+    fclose(out);
+}
@@ -0,0 +1,102 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPTRACE_H
+#define LPTRACE_H
+
+#include "liblaunchpad.h"
+
+// amount of buckets in a histogram, 16 for each power of two
+#define LP_BUCKETS 976
+
+// amount of events kept for the chrome trace
+#define LP_TRACE_EVENTS 65536
+
+/**
+ * a log-linear histogram of latencies, in nanoseconds. each power of two is
+ * split in 16 buckets, so that any latency is known within 6%.
+ */
+struct lp_histogram {
+    const char* name;			//! what is measured
+    unsigned long counts[LP_BUCKETS];	//! amount of latencies in each bucket
+    unsigned long total;		//! amount of latencies
+    unsigned long long max;		//! highest latency
+};
+
+/**
+ * the timestamps of a traced event, kept for the chrome trace
+ */
+struct lp_trace_event {
+    unsigned long long time;	//! when the usb transfer completed
+    unsigned long long parsed;	//! when the event was parsed
+    unsigned long long emitted;	//! when the event was sent to the clients
+    int status;			//! midi status byte
+    int data1;			//! key or controller
+};
+
+/** record a latency
+ */
+void lp_histogram_record(struct lp_histogram* histogram, unsigned long long latency);
+
+/** latency below which a ratio of the recorded latencies are
+ *
+ * \param ratio 0.5 for the median, 0.99 for the 99th percentile...
+ */
+unsigned long long lp_histogram_percentile(const struct lp_histogram* histogram, double ratio);
+
+/** print the titles of the columns printed by lp_histogram_print
+ */
+void lp_histogram_header(FILE* out);
+
+/** print the amount of latencies and the percentiles, in microseconds
+ */
+void lp_histogram_print(FILE* out, const struct lp_histogram* histogram);
+
+/** start tracing the events of a launchpad
+ *
+ * the library then stamps each event when it is parsed, and the programs call
+ * lp_trace once the event is sent to their clients.
+ * \param chrome where to write the chrome trace, or NULL
+ */
+void lp_trace_start(struct launchpad* lp, const char* chrome);
+
+/** record the latencies of an event
+ *
+ * \param emitted when the event was sent, see lp_now
+ */
+void lp_trace(const struct lp_event* event, unsigned long long emitted);
+
+/** print the histograms
+ */
+void lp_trace_dump(FILE* out);
+
+/** write the recorded events as a chrome trace, if one was asked for
+ *
+ * the file can be loaded in chrome://tracing or perfetto.
+ */
+void lp_trace_write();
+
+#endif
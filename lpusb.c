@@ -0,0 +1,625 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "liblaunchpad.h"
+#include <string.h>
+
+// most launchpads open at once
+#define LP_USB_DEVICES 16
+
+// how often an unplugged launchpad is looked for without hotplug support, in
+// milliseconds
+#define LP_USB_RETRY 1000
+
+// most usb ports from the root hub to a device
+#define LP_USB_PORTS 7
+
+/**
+ * the usb side of a launchpad
+ */
+struct lp_usb_data {
+    struct libusb_context* context;		//! usb context
+    struct libusb_device_handle* device;	//! usb device, NULL while unplugged
+    int left;					//! whether the device went away, and is closed once its transfers are done
+    int arrived;				//! whether a launchpad was plugged since the device went away
+    unsigned long long retry;			//! when to look for the device again, without hotplug support
+    int located;				//! whether the device was ever plugged, and where is known
+    uint8_t bus;				//! usb bus of the device
+    uint8_t ports[LP_USB_PORTS];		//! usb ports from the root hub to the device, where it must come back
+    int nports;					//! amount of ports
+    struct libusb_transfer* in[LP_IN_TRANSFERS];	//! input transfers
+    int in_flight;				//! amount of input transfers in flight
+    struct libusb_transfer* out[LP_OUT_TRANSFERS];	//! output transfers, the free ones first
+    int out_free;				//! amount of free output transfers
+};
+
+// all the launchpads share a usb context, so that a single loop serves them
+static struct libusb_context* lp_usb_context = NULL;
+static int lp_usb_users = 0;
+static pthread_mutex_t lp_usb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the launchpads open, told when a device comes and goes. lp_usb_lock guards
+// the list, the lock of each launchpad its device, taken in that order
+static struct launchpad* lp_usb_open_lps[LP_USB_DEVICES];
+static int lp_usb_hotplug = false;
+static libusb_hotplug_callback_handle lp_usb_callback;
+
+/* a launchpad was plugged or unplugged. this runs while handling the usb
+ * events, where devices can not be opened: the launchpads reopen theirs in
+ * lp_usb_recover */
+static int LIBUSB_CALL lp_usb_hotplug_event(libusb_context* context, libusb_device* device,
+					    libusb_hotplug_event event, void* data)
+{
+    struct launchpad* gone = NULL;
+    struct launchpad* lp;
+    struct lp_usb_data* usb;
+    int i;
+    
+    pthread_mutex_lock(&lp_usb_lock);
+    for (i = 0; i < LP_USB_DEVICES; i++) {
+	lp = lp_usb_open_lps[i];
+	if (lp == NULL) {
+	    continue;
+	}
+	usb = lp->transport_data;
+	
+	pthread_mutex_lock(&lp->lock);
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED && usb->device == NULL) {
+	    usb->arrived = true;
+	} else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT && usb->device != NULL
+		   && libusb_get_device(usb->device) == device) {
+	    usb->left = true;
+	    gone = lp;
+	}
+	pthread_mutex_unlock(&lp->lock);
+    }
+    pthread_mutex_unlock(&lp_usb_lock);
+    
+    if (gone != NULL) {
+	lp_detach(gone);
+    }
+    return 0;
+}
+
+/* the shared usb context, initialized by its first user */
+static struct libusb_context* lp_usb_acquire()
+{
+    struct libusb_context* context;
+    
+    pthread_mutex_lock(&lp_usb_lock);
+    if (lp_usb_users == 0) {
+	if (libusb_init(&lp_usb_context) != 0) {
+	    pthread_mutex_unlock(&lp_usb_lock);
+	    return NULL;
+	}
+	
+	// without hotplug, unplugged launchpads are looked for from time to time
+	lp_usb_hotplug = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)
+	    && libusb_hotplug_register_callback(lp_usb_context,
+						LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+						LIBUSB_HOTPLUG_NO_FLAGS, ID_VENDOR, ID_PRODUCT,
+						LIBUSB_HOTPLUG_MATCH_ANY, lp_usb_hotplug_event, NULL,
+						&lp_usb_callback) == 0;
+    }
+    lp_usb_users++;
+    context = lp_usb_context;
+    pthread_mutex_unlock(&lp_usb_lock);
+    
+    return context;
+}
+
+static void lp_usb_release()
+{
+    pthread_mutex_lock(&lp_usb_lock);
+    if (--lp_usb_users == 0) {
+	if (lp_usb_hotplug) {
+	    libusb_hotplug_deregister_callback(lp_usb_context, lp_usb_callback);
+	}
+	libusb_exit(lp_usb_context);
+	lp_usb_context = NULL;
+    }
+    pthread_mutex_unlock(&lp_usb_lock);
+}
+
+/* whether a usb device is already open by a launchpad. lp_usb_lock is held */
+static int lp_usb_taken(struct libusb_device* device)
+{
+    struct launchpad* lp;
+    struct lp_usb_data* usb;
+    int i, taken = false;
+    
+    for (i = 0; i < LP_USB_DEVICES && !taken; i++) {
+	lp = lp_usb_open_lps[i];
+	if (lp == NULL) {
+	    continue;
+	}
+	usb = lp->transport_data;
+	
+	pthread_mutex_lock(&lp->lock);
+	taken = usb->device != NULL && libusb_get_device(usb->device) == device;
+	pthread_mutex_unlock(&lp->lock);
+    }
+    return taken;
+}
+
+/* remember where the device of a launchpad is plugged */
+static void lp_usb_locate(struct lp_usb_data* usb, struct libusb_device* device)
+{
+    usb->bus = libusb_get_bus_number(device);
+    usb->nports = libusb_get_port_numbers(device, usb->ports, LP_USB_PORTS);
+    usb->located = usb->nports >= 0;
+}
+
+/* whether a device is plugged where the device of a launchpad was, so that
+ * the launchpads of a grid keep their place. any will do for a launchpad
+ * which never had one */
+static int lp_usb_same_port(const struct lp_usb_data* usb, struct libusb_device* device)
+{
+    uint8_t ports[LP_USB_PORTS];
+    int n;
+    
+    if (!usb->located) {
+	return true;
+    }
+    n = libusb_get_port_numbers(device, ports, LP_USB_PORTS);
+    return libusb_get_bus_number(device) == usb->bus
+	&& n == usb->nports && memcmp(ports, usb->ports, n) == 0;
+}
+
+/* whether a usb device is a launchpad */
+static int lp_usb_match(struct libusb_device* device)
+{
+    struct libusb_device_descriptor descriptor;
+    
+    return libusb_get_device_descriptor(device, &descriptor) == 0
+	&& descriptor.idVendor == ID_VENDOR
+	&& descriptor.idProduct == ID_PRODUCT;
+}
+
+/* open the launchpad found at an index, in the order usb lists them */
+static struct libusb_device_handle* lp_usb_find(struct libusb_context* context, int index)
+{
+    struct libusb_device** devices;
+    struct libusb_device_handle* handle = NULL;
+    ssize_t n, i;
+    
+    n = libusb_get_device_list(context, &devices);
+    for (i = 0; i < n; i++) {
+	if (lp_usb_match(devices[i]) && index-- == 0) {
+	    if (libusb_open(devices[i], &handle) != 0) {
+		handle = NULL;
+	    }
+	    break;
+	}
+    }
+    
+    if (n >= 0) {
+	libusb_free_device_list(devices, 1);
+    }
+    return handle;
+}
+
+/* open the launchpad plugged where the device of a launchpad was, unless
+ * another launchpad has it open */
+static struct libusb_device_handle* lp_usb_find_free(struct lp_usb_data* usb)
+{
+    struct libusb_device** devices;
+    struct libusb_device_handle* handle = NULL;
+    ssize_t n, i;
+    
+    n = libusb_get_device_list(usb->context, &devices);
+    pthread_mutex_lock(&lp_usb_lock);
+    for (i = 0; i < n && handle == NULL; i++) {
+	if (lp_usb_match(devices[i]) && lp_usb_same_port(usb, devices[i]) && !lp_usb_taken(devices[i])
+	    && libusb_open(devices[i], &handle) != 0) {
+	    handle = NULL;
+	}
+    }
+    pthread_mutex_unlock(&lp_usb_lock);
+    
+    if (n >= 0) {
+	libusb_free_device_list(devices, 1);
+    }
+    return handle;
+}
+
+/* an input transfer completed: queue the packet and resubmit the transfer */
+static void LIBUSB_CALL lp_in_done(struct libusb_transfer* transfer)
+{
+    struct launchpad* lp = transfer->user_data;
+    struct lp_usb_data* usb = lp->transport_data;
+    int gone = false;
+    
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length > 0) {
+	lp_packet(lp, transfer->buffer, transfer->actual_length);
+    }
+    
+    pthread_mutex_lock(&lp->lock);
+    
+    // the device was unplugged, it is closed once all its transfers are back
+    if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+	gone = !usb->left;
+	usb->left = true;
+    }
+    
+    if (lp->stopped || usb->left
+	|| transfer->status == LIBUSB_TRANSFER_CANCELLED
+	|| libusb_submit_transfer(transfer) != 0) {
+	usb->in_flight--;
+    }
+    
+    pthread_mutex_unlock(&lp->lock);
+    
+    if (gone) {
+	lp_detach(lp);
+    }
+}
+
+/* an output transfer completed: give it back to the pool */
+static void LIBUSB_CALL lp_out_done(struct libusb_transfer* transfer)
+{
+    struct launchpad* lp = transfer->user_data;
+    struct lp_usb_data* usb = lp->transport_data;
+    
+    pthread_mutex_lock(&lp->lock);
+    
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+	lp->stats.failed++;
+    }
+    usb->out[usb->out_free++] = transfer;
+    
+    pthread_mutex_unlock(&lp->lock);
+    lp_completed(lp);
+}
+
+/* keep the input transfers in flight. returns 0 on success */
+static int lp_usb_submit(struct lp_usb_data* usb)
+{
+    for (usb->in_flight = 0; usb->in_flight < LP_IN_TRANSFERS; usb->in_flight++) {
+	if (libusb_submit_transfer(usb->in[usb->in_flight]) != 0) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/* close the device unplugged once its transfers are back, and open the one
+ * plugged instead. this runs after handling the usb events */
+static void lp_usb_recover(struct launchpad* lp)
+{
+    struct lp_usb_data* usb = lp->transport_data;
+    struct libusb_device_handle* handle;
+    int i, idle, look, plugged;
+    
+    pthread_mutex_lock(&lp->lock);
+    idle = usb->in_flight == 0 && usb->out_free == LP_OUT_TRANSFERS;
+    handle = usb->left && idle ? usb->device : NULL;
+    if (handle != NULL) {
+	usb->device = NULL;
+	usb->left = false;
+	usb->retry = 0;
+    }
+    pthread_mutex_unlock(&lp->lock);
+    
+    if (handle != NULL) {
+	printf("launchpad %d unplugged\n", lp->index);
+	pthread_mutex_lock(&lp_usb_lock);
+	libusb_close(handle);
+	pthread_mutex_unlock(&lp_usb_lock);
+    }
+    
+    // look for the device when hotplug says one came, or from time to time
+    pthread_mutex_lock(&lp->lock);
+    look = usb->device == NULL && idle && !lp->stopped
+	&& (usb->arrived || (!lp_usb_hotplug && lp_now() >= usb->retry));
+    if (look) {
+	usb->arrived = false;
+	usb->retry = lp_now() + LP_USB_RETRY * 1000000ULL;
+    }
+    pthread_mutex_unlock(&lp->lock);
+    if (!look) {
+	return;
+    }
+    
+    handle = lp_usb_find_free(usb);
+    if (handle == NULL) {
+	return;
+    }
+    if (libusb_claim_interface(handle, 0) != 0) {
+	libusb_close(handle);
+	return;
+    }
+    
+    for (i = 0; i < LP_IN_TRANSFERS; i++) {
+	usb->in[i]->dev_handle = handle;
+    }
+    for (i = 0; i < LP_OUT_TRANSFERS; i++) {
+	usb->out[i]->dev_handle = handle;
+    }
+    
+    if (!usb->located) {
+	lp_usb_locate(usb, libusb_get_device(handle));
+    }
+    
+    pthread_mutex_lock(&lp->lock);
+    usb->device = handle;
+    plugged = lp_usb_submit(usb) == 0;
+    if (!plugged) {
+	usb->left = true;
+    }
+    pthread_mutex_unlock(&lp->lock);
+    
+    if (plugged) {
+	printf("launchpad %d plugged back\n", lp->index);
+	lp_attach(lp);
+    }
+}
+
+static int lp_usb_open(struct launchpad* lp)
+{
+    struct lp_usb_data* usb;
+    int i, wait;
+    
+    usb = calloc(1, sizeof(struct lp_usb_data));
+    if (usb == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return -1;
+    }
+    lp->transport_data = usb;
+    
+    //initialize usb
+    usb->context = lp_usb_acquire();
+    if (usb->context == NULL) {
+	fprintf(stderr,"Unable to initialize usb\n");
+	return -1;
+    } else {
+        printf("usb initialized\n");
+    }
+    
+    //find the device, or wait for it to be plugged
+    wait = getenv("LP_WAIT") != NULL && atoi(getenv("LP_WAIT"));
+    usb->device = lp_usb_find(usb->context, lp->index);
+    if (usb->device == NULL && !wait) {
+	fprintf(stderr,"Unable to find launchpad %d\n", lp->index);
+ 	return -1;
+    } else if (usb->device == NULL) {
+	printf("waiting for launchpad %d\n", lp->index);
+    } else {
+        printf("launchpad %d found\n", lp->index);
+	lp_usb_locate(usb, libusb_get_device(usb->device));
+    }
+    
+    //claim the device
+    if (usb->device != NULL && libusb_claim_interface(usb->device, 0) != 0) {
+	fprintf(stderr,"Unable to claim the launchpad\n");
+	return -1;
+    } else if (usb->device != NULL) {
+	printf("launchpad claimed\n");
+    }
+    
+    //told when the device comes and goes
+    pthread_mutex_lock(&lp_usb_lock);
+    for (i = 0; i < LP_USB_DEVICES && lp_usb_open_lps[i] != NULL; i++);
+    if (i < LP_USB_DEVICES) {
+	lp_usb_open_lps[i] = lp;
+    }
+    pthread_mutex_unlock(&lp_usb_lock);
+    
+    //allocate the pool of output transfers
+    for (usb->out_free = 0; usb->out_free < LP_OUT_TRANSFERS; usb->out_free++) {
+	usb->out[usb->out_free] = libusb_alloc_transfer(0);
+	if (usb->out[usb->out_free] == NULL) {
+	    fprintf(stderr,"could not allocate output transfers\n");
+	    return -1;
+	}
+	libusb_fill_interrupt_transfer(usb->out[usb->out_free], usb->device, EP_OUT,
+				       malloc(MAX_TRANSFER_SIZE), 0,
+				       lp_out_done, lp, LP_OUT_TIMEOUT);
+    }
+    
+    //keep input transfers in flight
+    for (i = 0; i < LP_IN_TRANSFERS; i++) {
+	usb->in[i] = libusb_alloc_transfer(0);
+	if (usb->in[i] == NULL) {
+	    fprintf(stderr,"could not allocate input transfers\n");
+	    return -1;
+	}
+	libusb_fill_interrupt_transfer(usb->in[i], usb->device, EP_IN,
+				       malloc(MAX_PACKET_SIZE), MAX_PACKET_SIZE,
+				       lp_in_done, lp, 0);
+    }
+    if (usb->device == NULL) {
+	lp_detach(lp);
+    } else if (lp_usb_submit(usb) != 0) {
+	fprintf(stderr,"could not submit input transfers\n");
+	return -1;
+    }
+    
+    return 0;
+}
+
+static void lp_usb_stop(struct launchpad* lp)
+{
+    struct lp_usb_data* usb = lp->transport_data;
+    int i;
+    
+    for (i = 0; i < LP_IN_TRANSFERS; i++) {
+	libusb_cancel_transfer(usb->in[i]);
+    }
+}
+
+static void lp_usb_close(struct launchpad* lp)
+{
+    struct lp_usb_data* usb = lp->transport_data;
+    int i;
+    
+    //wait for the transfers in flight
+    while (usb->in_flight > 0 || usb->out_free < LP_OUT_TRANSFERS) {
+	libusb_handle_events(usb->context);
+    }
+    
+    pthread_mutex_lock(&lp_usb_lock);
+    for (i = 0; i < LP_USB_DEVICES; i++) {
+	if (lp_usb_open_lps[i] == lp)
+	    lp_usb_open_lps[i] = NULL;
+    }
+    pthread_mutex_unlock(&lp_usb_lock);
+    
+    //free the transfers
+    for (i = 0; i < LP_IN_TRANSFERS; i++) {
+	free(usb->in[i]->buffer);
+	libusb_free_transfer(usb->in[i]);
+    }
+    for (i = 0; i < LP_OUT_TRANSFERS; i++) {
+	free(usb->out[i]->buffer);
+	libusb_free_transfer(usb->out[i]);
+    }
+    
+    //declaim and close the device, unless it is unplugged
+    if (usb->device != NULL) {
+	libusb_release_interface(usb->device,0);
+	libusb_close(usb->device);
+    }
+    
+    //close usb, once no launchpad uses it
+    lp_usb_release();
+    free(usb);
+}
+
+static int lp_usb_send(struct launchpad* lp, const unsigned char* data, int size)
+{
+    struct lp_usb_data* usb = lp->transport_data;
+    struct libusb_transfer* transfer;
+    
+    // wait for a free transfer. stalled transfers time out after LP_OUT_TIMEOUT
+    pthread_mutex_lock(&lp->lock);
+    while (usb->out_free == 0 && !lp->stopped && usb->device != NULL && !usb->left) {
+	pthread_mutex_unlock(&lp->lock);
+	libusb_handle_events(usb->context);
+	pthread_mutex_lock(&lp->lock);
+    }
+    
+    // the data for a device unplugged is lost, its leds get restored
+    if (lp->stopped || usb->device == NULL || usb->left) {
+	pthread_mutex_unlock(&lp->lock);
+	return 0;
+    }
+    
+    transfer = usb->out[--usb->out_free];
+    pthread_mutex_unlock(&lp->lock);
+    
+    // send the data
+    memcpy(transfer->buffer, data, size);
+    transfer->length = size;
+    if (libusb_submit_transfer(transfer) != 0) {
+	transfer->status = LIBUSB_TRANSFER_ERROR;
+	lp_out_done(transfer);
+	return 0;
+    }
+    
+    return size;
+}
+
+static int lp_usb_handle(struct launchpad* lp, int timeout)
+{
+    struct lp_usb_data* usb = lp->transport_data;
+    struct timeval tv;
+    int err, unplugged;
+    
+    // without hotplug, nothing wakes us up when the device is plugged back
+    pthread_mutex_lock(&lp->lock);
+    unplugged = usb->device == NULL;
+    pthread_mutex_unlock(&lp->lock);
+    if (unplugged && !lp_usb_hotplug && (timeout < 0 || timeout > LP_USB_RETRY)) {
+	timeout = LP_USB_RETRY;
+    }
+    
+    if (timeout < 0) {
+	err = libusb_handle_events(usb->context);
+    } else {
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	err = libusb_handle_events_timeout_completed(usb->context, &tv, NULL);
+    }
+    
+    lp_usb_recover(lp);
+    return err;
+}
+
+static int lp_usb_pollfds(struct launchpad* lp, struct pollfd* fds, int max)
+{
+    struct lp_usb_data* usb = lp->transport_data;
+    const struct libusb_pollfd** usbfds;
+    int n;
+    
+    usbfds = libusb_get_pollfds(usb->context);
+    if (usbfds == NULL) {
+	return 0;
+    }
+    
+    for (n = 0; n < max && usbfds[n] != NULL; n++) {
+	fds[n].fd = usbfds[n]->fd;
+	fds[n].events = usbfds[n]->events;
+	fds[n].revents = 0;
+    }
+    
+    libusb_free_pollfds(usbfds);
+    return n;
+}
+
+static int lp_usb_count()
+{
+    struct libusb_context* context = lp_usb_acquire();
+    struct libusb_device** devices;
+    ssize_t n, i;
+    int count = 0;
+    
+    if (context == NULL) {
+	return 0;
+    }
+    
+    n = libusb_get_device_list(context, &devices);
+    for (i = 0; i < n; i++) {
+	count += lp_usb_match(devices[i]);
+    }
+    
+    if (n >= 0) {
+	libusb_free_device_list(devices, 1);
+    }
+    lp_usb_release();
+    return count;
+}
+
+const struct lp_transport lp_usb = {
+    "usb",
+    lp_usb_open,
+    lp_usb_close,
+    lp_usb_stop,
+    lp_usb_send,
+    lp_usb_handle,
+    lp_usb_pollfds,
+    lp_usb_count
+};
@@ -0,0 +1,536 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lpvirtual.h"
+#include "lpcapture.h"
+#include "lprt.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/**
+ * an output transfer handled by the device
+ */
+struct lp_virtual_transfer {
+    unsigned long long due;		//! when the device is done with it
+    int size;				//! amount of data
+    unsigned char data[MAX_TRANSFER_SIZE];	//! the data
+};
+
+/**
+ * an input packet waiting to be delivered
+ */
+struct lp_virtual_packet {
+    unsigned long long due;		//! when to deliver it
+    int size;				//! amount of data
+    unsigned char data[MAX_PACKET_SIZE];	//! the data
+};
+
+/**
+ * the state of the simulated device
+ */
+struct lp_virtual_data {
+    pthread_mutex_t lock;			//! protects everything below
+    pthread_cond_t changed;			//! signalled whenever something happens
+    pthread_t device;				//! thread acting as the device
+    int closing;				//! whether the device is closing
+    int unplugged;				//! whether the device is unplugged
+    int loopback;				//! whether written leds are sent back
+    int cursor;					//! next led written by a rapid update
+    unsigned long long latency;			//! time taken by each output packet
+    unsigned long long busy;			//! when the device is done with the output
+    struct lp_virtual_transfer flight[LP_OUT_TRANSFERS];	//! output in flight
+    int flight_head;				//! oldest output in flight
+    int flight_count;				//! amount of output in flight
+    struct lp_virtual_packet input[LP_VIRTUAL_PACKETS];	//! scripted input
+    int input_head;				//! next input to deliver
+    int input_count;				//! amount of input to deliver
+    unsigned char output[LP_VIRTUAL_OUTPUT];	//! recorded output
+    int output_size;				//! amount of recorded output
+    int wake[2];				//! pipe written when data is delivered
+    struct lp_replay* replay;			//! capture replayed as input, NULL for none
+    const struct lp_capture_record* record;	//! next record replayed
+    double speed;				//! speed of the replay, 0 for as fast as possible
+    unsigned long long start;			//! when the replay started
+};
+
+/* the next input of a launchpad in the replayed capture */
+static const struct lp_capture_record* lp_virtual_next(struct lp_virtual_data* v, struct launchpad* lp)
+{
+    const struct lp_capture_record* record;
+    
+    while ((record = lp_replay_next(v->replay)) != NULL) {
+	if (record->direction == lp_inbound && record->device == lp->index) {
+	    return record;
+	}
+    }
+    return NULL;
+}
+
+/* when to deliver the next replayed input */
+static unsigned long long lp_virtual_due(struct lp_virtual_data* v)
+{
+    if (v->speed <= 0) {
+	return v->start;
+    }
+    return v->start + (v->record->time - v->replay->origin) / v->speed;
+}
+
+/* queue an input packet. the lock is held */
+static void lp_virtual_queue(struct lp_virtual_data* v, const unsigned char* data, int size, unsigned long long at)
+{
+    struct lp_virtual_packet* packet;
+    
+    if (v->input_count == LP_VIRTUAL_PACKETS) {
+	return;
+    }
+    
+    packet = &v->input[(v->input_head + v->input_count++) % LP_VIRTUAL_PACKETS];
+    packet->due = at;
+    packet->size = size < MAX_PACKET_SIZE ? size : MAX_PACKET_SIZE;
+    memcpy(packet->data, data, packet->size);
+}
+
+/* add a press to the packet being built, with running status. the packet is
+ * queued once full. the lock is held */
+static void lp_virtual_press(struct lp_virtual_data* v, struct lp_virtual_packet* packet,
+			     int status, int key, int velocity, unsigned long long now)
+{
+    if (packet->size > 0 && (packet->data[0] != status || packet->size + 2 > MAX_PACKET_SIZE)) {
+	lp_virtual_queue(v, packet->data, packet->size, now);
+	packet->size = 0;
+    }
+    
+    if (packet->size == 0) {
+	packet->data[packet->size++] = status;
+    }
+    packet->data[packet->size++] = key;
+    packet->data[packet->size++] = velocity;
+}
+
+/* press the button of a led written by a rapid update */
+static void lp_virtual_rapid(struct lp_virtual_data* v, struct lp_virtual_packet* packet,
+			     int velocity, unsigned long long now)
+{
+    int led = v->cursor++;
+    
+    if (led < 64) {
+	lp_virtual_press(v, packet, NOTE, led / 8 * 16 + led % 8, velocity, now);
+    } else if (led < 72) {
+	lp_virtual_press(v, packet, NOTE, (led - 64) * 16 + 8, velocity, now);
+    } else if (led < LP_LEDS) {
+	lp_virtual_press(v, packet, CTRL, 104 + led - 72, velocity, now);
+    }
+}
+
+/* send the leds written by a transfer back as presses. the lock is held */
+static void lp_virtual_echo(struct lp_virtual_data* v, const struct lp_virtual_transfer* transfer, unsigned long long now)
+{
+    struct lp_virtual_packet packet;
+    const unsigned char* message;
+    int i;
+    
+    packet.size = 0;
+    for (i = 0; i + 3 <= transfer->size; i += 3) {
+	message = transfer->data + i;
+	
+	if (message[0] == RAPID) {
+	    lp_virtual_rapid(v, &packet, message[1], now);
+	    lp_virtual_rapid(v, &packet, message[2], now);
+	    continue;
+	}
+	
+	// any other message moves the rapid update cursor back to the first led
+	v->cursor = 0;
+	if (message[0] == NOTE || (message[0] == CTRL && message[1] >= 104)) {
+	    lp_virtual_press(v, &packet, message[0], message[1], message[2], now);
+	}
+    }
+    
+    if (packet.size > 0) {
+	lp_virtual_queue(v, packet.data, packet.size, now);
+    }
+}
+
+/* the device: completes the output and delivers the input when they are due */
+static void* lp_virtual_run(void* data)
+{
+    struct launchpad* lp = data;
+    struct lp_virtual_data* v = lp->transport_data;
+    struct lp_virtual_transfer* transfer;
+    struct lp_virtual_packet* packet;
+    unsigned long long now, next, until_replay;
+    struct timespec until;
+    int delivered;
+    
+    // the simulated device stands for the usb side, and runs as its thread
+    lp_rt_thread(lp_rt_input);
+    pthread_mutex_lock(&v->lock);
+    
+    while (!v->closing) {
+	now = lp_now();
+	delivered = false;
+	
+	while (v->flight_count > 0 && v->flight[v->flight_head].due <= now) {
+	    transfer = &v->flight[v->flight_head];
+	    if (v->loopback) {
+		lp_virtual_echo(v, transfer, now);
+	    }
+	    v->flight_head = (v->flight_head + 1) % LP_OUT_TRANSFERS;
+	    v->flight_count--;
+	    lp_completed(lp);
+	}
+	
+	while (!v->unplugged && v->input_count > 0 && v->input[v->input_head].due <= now) {
+	    packet = &v->input[v->input_head];
+	    lp_packet(lp, packet->data, packet->size);
+	    v->input_head = (v->input_head + 1) % LP_VIRTUAL_PACKETS;
+	    v->input_count--;
+	    delivered = true;
+	}
+	
+	// replayed input, as fast as it is parsed at most
+	while (v->record != NULL && lp_virtual_due(v) <= now && lp->packet_count < LP_PACKETS) {
+	    lp_packet(lp, v->record->data, v->record->size);
+	    v->record = lp_virtual_next(v, lp);
+	    delivered = true;
+	}
+	
+	if (delivered) {
+	    write(v->wake[1], "", 1);
+	}
+	pthread_cond_broadcast(&v->changed);
+	
+	// once the whole replay is parsed, the launchpad stops
+	if (v->replay != NULL && v->record == NULL && lp->packet_count == 0) {
+	    lp_replay_close(v->replay);
+	    v->replay = NULL;
+	    pthread_mutex_unlock(&v->lock);
+	    lp_stop(lp);
+	    pthread_mutex_lock(&v->lock);
+	    continue;
+	}
+	
+	// sleep until the next thing to do
+	next = 0;
+	if (v->flight_count > 0) {
+	    next = v->flight[v->flight_head].due;
+	}
+	if (!v->unplugged && v->input_count > 0 && (next == 0 || v->input[v->input_head].due < next)) {
+	    next = v->input[v->input_head].due;
+	}
+	if (v->replay != NULL) {
+	    // or until the packets delivered are parsed
+	    until_replay = v->record != NULL && lp->packet_count < LP_PACKETS ? lp_virtual_due(v) : now + 100000;
+	    if (next == 0 || until_replay < next) {
+		next = until_replay;
+	    }
+	}
+	
+	if (next == 0) {
+	    pthread_cond_wait(&v->changed, &v->lock);
+	} else {
+	    until.tv_sec = next / 1000000000ULL;
+	    until.tv_nsec = next % 1000000000ULL;
+	    pthread_cond_timedwait(&v->changed, &v->lock, &until);
+	}
+    }
+    
+    pthread_mutex_unlock(&v->lock);
+    return NULL;
+}
+
+static int lp_virtual_open(struct launchpad* lp)
+{
+    struct lp_virtual_data* v;
+    pthread_condattr_t attr;
+    const char* env;
+    
+    v = calloc(1, sizeof(struct lp_virtual_data));
+    if (v == NULL) {
+	fprintf(stderr,"Unable to allocate memory\n");
+	return -1;
+    }
+    lp->transport_data = v;
+    
+    // timed waits follow lp_now
+    pthread_mutex_init(&v->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&v->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    if (pipe(v->wake) != 0) {
+	fprintf(stderr,"could not create the wake up pipe\n");
+	return -1;
+    }
+    fcntl(v->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(v->wake[1], F_SETFL, O_NONBLOCK);
+    
+    env = getenv("LP_LATENCY");
+    if (env != NULL) {
+	v->latency = atoll(env) * 1000;
+    }
+    env = getenv("LP_LOOPBACK");
+    v->loopback = env != NULL && atoi(env);
+    
+    // a capture replayed as input, see lpcapture.h
+    env = getenv("LP_REPLAY");
+    if (env != NULL) {
+	v->replay = lp_replay_open(env);
+	if (v->replay == NULL) {
+	    return -1;
+	}
+	v->record = lp_virtual_next(v, lp);
+	env = getenv("LP_SPEED");
+	v->speed = env != NULL ? atof(env) : 1;
+	v->start = lp_now();
+    }
+    
+    if (pthread_create(&v->device, NULL, lp_virtual_run, lp) != 0) {
+	fprintf(stderr,"could not start the virtual launchpad\n");
+	return -1;
+    }
+    
+    return 0;
+}
+
+static void lp_virtual_stop(struct launchpad* lp)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    // wake up whoever waits for data
+    pthread_mutex_lock(&v->lock);
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->lock);
+}
+
+static void lp_virtual_close(struct launchpad* lp)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    pthread_mutex_lock(&v->lock);
+    v->closing = true;
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->lock);
+    pthread_join(v->device, NULL);
+    
+    if (v->replay != NULL) {
+	lp_replay_close(v->replay);
+    }
+    close(v->wake[0]);
+    close(v->wake[1]);
+    pthread_cond_destroy(&v->changed);
+    pthread_mutex_destroy(&v->lock);
+    free(v);
+}
+
+static int lp_virtual_send(struct launchpad* lp, const unsigned char* data, int size)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    struct lp_virtual_transfer* transfer;
+    unsigned long long now;
+    
+    pthread_mutex_lock(&v->lock);
+    
+    // like with usb, only so many transfers can be in flight
+    while (v->flight_count == LP_OUT_TRANSFERS && !v->closing && !lp->stopped && !v->unplugged) {
+	pthread_cond_wait(&v->changed, &v->lock);
+    }
+    
+    // like with usb, the data for a device unplugged is lost
+    if (v->closing || lp->stopped || v->unplugged) {
+	pthread_mutex_unlock(&v->lock);
+	return 0;
+    }
+    
+    // the device handles the packets one after the other
+    now = lp_now();
+    transfer = &v->flight[(v->flight_head + v->flight_count++) % LP_OUT_TRANSFERS];
+    transfer->size = size;
+    memcpy(transfer->data, data, size);
+    v->busy = (v->busy > now ? v->busy : now)
+	+ v->latency * ((size + MAX_PACKET_SIZE - 1) / MAX_PACKET_SIZE);
+    transfer->due = v->busy;
+    
+    // record the output
+    if (v->output_size + size <= LP_VIRTUAL_OUTPUT) {
+	memcpy(v->output + v->output_size, data, size);
+	v->output_size += size;
+    }
+    
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->lock);
+    return size;
+}
+
+static int lp_virtual_handle(struct launchpad* lp, int timeout)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    unsigned long long until;
+    struct timespec deadline;
+    char buffer[64];
+    
+    // forget the wake ups, the packets are already queued
+    while (read(v->wake[0], buffer, sizeof(buffer)) > 0);
+    
+    if (timeout == 0) {
+	return 0;
+    }
+    
+    pthread_mutex_lock(&v->lock);
+    
+    if (timeout < 0) {
+	while (lp->packet_count == 0 && !lp->stopped && !v->closing) {
+	    pthread_cond_wait(&v->changed, &v->lock);
+	}
+    } else {
+	until = lp_now() + timeout * 1000000ULL;
+	deadline.tv_sec = until / 1000000000ULL;
+	deadline.tv_nsec = until % 1000000000ULL;
+	while (lp->packet_count == 0 && !lp->stopped && !v->closing
+	       && pthread_cond_timedwait(&v->changed, &v->lock, &deadline) == 0);
+    }
+    
+    pthread_mutex_unlock(&v->lock);
+    return 0;
+}
+
+static int lp_virtual_pollfds(struct launchpad* lp, struct pollfd* fds, int max)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    if (max < 1) {
+	return 0;
+    }
+    
+    fds[0].fd = v->wake[0];
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    return 1;
+}
+
+static int lp_virtual_count()
+{
+    const char* env = getenv("LP_DEVICES");
+    
+    return env != NULL ? atoi(env) : 1;
+}
+
+const struct lp_transport lp_virtual = {
+    "virtual",
+    lp_virtual_open,
+    lp_virtual_close,
+    lp_virtual_stop,
+    lp_virtual_send,
+    lp_virtual_handle,
+    lp_virtual_pollfds,
+    lp_virtual_count
+};
+
+void lp_virtual_input(struct launchpad* lp, const unsigned char* data, int size, unsigned long long at)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    pthread_mutex_lock(&v->lock);
+    lp_virtual_queue(v, data, size, at);
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->lock);
+}
+
+int lp_virtual_output(struct launchpad* lp, unsigned char* data, int max)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    int size;
+    
+    pthread_mutex_lock(&v->lock);
+    size = v->output_size < max ? v->output_size : max;
+    memcpy(data, v->output, size);
+    memmove(v->output, v->output + size, v->output_size - size);
+    v->output_size -= size;
+    pthread_mutex_unlock(&v->lock);
+    
+    return size;
+}
+
+void lp_virtual_latency(struct launchpad* lp, unsigned long long latency)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    pthread_mutex_lock(&v->lock);
+    v->latency = latency;
+    pthread_mutex_unlock(&v->lock);
+}
+
+void lp_virtual_loopback(struct launchpad* lp, enum bool loopback)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    pthread_mutex_lock(&v->lock);
+    v->loopback = loopback;
+    pthread_mutex_unlock(&v->lock);
+}
+
+void lp_virtual_drain(struct launchpad* lp)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    pthread_mutex_lock(&v->lock);
+    while (v->flight_count > 0 && !v->closing) {
+	pthread_cond_wait(&v->changed, &v->lock);
+    }
+    pthread_mutex_unlock(&v->lock);
+}
+
+void lp_virtual_unplug(struct launchpad* lp)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    // the output in flight is lost with the device
+    pthread_mutex_lock(&v->lock);
+    v->unplugged = true;
+    v->flight_count = 0;
+    v->busy = 0;
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->lock);
+    
+    lp_detach(lp);
+}
+
+void lp_virtual_plug(struct launchpad* lp)
+{
+    struct lp_virtual_data* v = lp->transport_data;
+    
+    pthread_mutex_lock(&v->lock);
+    v->unplugged = false;
+    v->cursor = 0;
+    pthread_cond_broadcast(&v->changed);
+    pthread_mutex_unlock(&v->lock);
+    
+    // wake up a poll loop, which flushes the restore
+    lp_attach(lp);
+    write(v->wake[1], "", 1);
+}
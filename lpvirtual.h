@@ -0,0 +1,98 @@
+/*
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of California, Berkeley nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS AND CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LPVIRTUAL_H
+#define LPVIRTUAL_H
+
+#include "liblaunchpad.h"
+
+// amount of input packets waiting to be delivered by the device
+#define LP_VIRTUAL_PACKETS 1024
+
+// amount of output data recorded
+#define LP_VIRTUAL_OUTPUT 65536
+
+/**
+ * a simulated launchpad, for running and measuring without a device.
+ *
+ * input packets are scripted with lp_virtual_input, output is recorded for
+ * lp_virtual_output. the device handles one packet of output data at a time,
+ * each taking the configured latency. in loopback mode, every led written is
+ * sent back as if its button had been pressed with the written velocity.
+ *
+ * the LP_LATENCY environment variable sets the latency in microseconds,
+ * LP_LOOPBACK=1 turns the loopback on, and LP_DEVICES sets the amount of
+ * launchpads which can be opened.
+ *
+ * LP_REPLAY=file replays the input of a capture, see lpcapture.h, at the
+ * speed factor given by LP_SPEED (1 by default, 0 for as fast as the input is
+ * parsed). each launchpad replays the packets captured from the launchpad of
+ * the same index, and stops once they are all parsed.
+ */
+
+/** script an input packet
+ *
+ * \param at when to deliver the packet, see lp_now. packets are delivered in
+ * the order they were scripted
+ */
+void lp_virtual_input(struct launchpad* lp, const unsigned char* data, int size, unsigned long long at);
+
+/** take the recorded output
+ *
+ * \param data where to copy the output
+ * \param max the size of data
+ * \return the amount of data copied
+ */
+int lp_virtual_output(struct launchpad* lp, unsigned char* data, int max);
+
+/** set the time the device takes for each packet of output, in nanoseconds
+ */
+void lp_virtual_latency(struct launchpad* lp, unsigned long long latency);
+
+/** send the written leds back as button presses, or not
+ */
+void lp_virtual_loopback(struct launchpad* lp, enum bool loopback);
+
+/** wait until the device handled all the output sent to it
+ */
+void lp_virtual_drain(struct launchpad* lp);
+
+/** unplug the device
+ *
+ * the launchpad is detached, see lp_detach: the output in flight and the
+ * output sent until the device is plugged back are lost, and no input is
+ * delivered meanwhile.
+ */
+void lp_virtual_unplug(struct launchpad* lp);
+
+/** plug the device back
+ *
+ * the device comes back blank and the launchpad is attached again, see
+ * lp_attach.
+ */
+void lp_virtual_plug(struct launchpad* lp);
+
+#endif